@@ -0,0 +1,106 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ctrmus_dir_h
+#define ctrmus_dir_h
+
+/* Entry of a directory listing. */
+struct dirEntry_t
+{
+	/* Offset of the name in the string arena, and its length. */
+	uint32_t	name;
+	uint16_t	len;
+	uint8_t		isDir;
+};
+
+/*
+ * Listing of a directory, read in a single pass. Names are stored one after
+ * another in a string arena, so that the listing is freed by resetting the
+ * arena rather than freeing every name. Folders are listed before files, and
+ * each are sorted by name.
+ */
+struct dirList_t
+{
+	/* String arena. */
+	char*				names;
+	size_t				namesLen;
+	size_t				namesCap;
+
+	struct dirEntry_t*	entries;
+	size_t				entriesCap;
+
+	int					dirNum;
+	int					fileNum;
+
+	/* Path of the listed directory, stored in the arena. */
+	const char*			currentDir;
+};
+
+/**
+ * Read a directory, replacing the previous listing. Hidden entries, with
+ * names starting with '.', are skipped.
+ *
+ * \param	dirList	Listing to store entries in, which must be zeroed before
+ *					its first use.
+ * \param	path	Directory to read, or NULL for the current working
+ *					directory.
+ * \return			Number of entries, or -1 on failure with errno set.
+ */
+int readDirList(struct dirList_t* dirList, const char* path);
+
+/**
+ * Start a new listing, replacing the previous one. Entries are then added
+ * with addDirEntry() and the listing completed with endDirList().
+ *
+ * \param	dirList	Listing, which must be zeroed before its first use.
+ * \param	path	Path of the listed directory.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int beginDirList(struct dirList_t* dirList, const char* path);
+
+/**
+ * Add an entry to a listing started with beginDirList().
+ *
+ * \param	name	Name of entry.
+ * \param	len		Length of name.
+ * \param	isDir	Entry is a folder.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int addDirEntry(struct dirList_t* dirList, const char* name, size_t len,
+		int isDir);
+
+/**
+ * Complete a listing started with beginDirList().
+ *
+ * \param	sort	Sort entries, which is not needed if they were added in
+ *					order.
+ */
+void endDirList(struct dirList_t* dirList, int sort);
+
+/**
+ * Merge a sorted listing into another, keeping it sorted. Used to add
+ * entries read in the background as they arrive.
+ *
+ * \param	dirList	Sorted listing to add entries to.
+ * \param	add		Sorted listing of entries to add. Its path is not copied.
+ * \param	keep	Index of an entry of dirList, updated to the index of the
+ *					same entry once merged, or NULL.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int mergeDirList(struct dirList_t* dirList, const struct dirList_t* add,
+		int* keep);
+
+/**
+ * Get the name of an entry.
+ *
+ * \param	n	Entry, from 0 to dirNum + fileNum - 1. Folders come first.
+ * \return		Name of entry.
+ */
+const char* getDirEntryName(const struct dirList_t* dirList, int n);
+
+/**
+ * Free memory used by a listing.
+ */
+void freeDirList(struct dirList_t* dirList);
+
+#endif
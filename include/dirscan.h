@@ -0,0 +1,55 @@
+#include <stdbool.h>
+
+#include "dir.h"
+
+#ifndef ctrmus_dirscan_h
+#define ctrmus_dirscan_h
+
+/**
+ * Start the directory scanner thread, which reads folders in the background
+ * so that the UI is not blocked by large folders.
+ *
+ * \return	0 on success, or -1 on failure.
+ */
+int startDirScanner(void);
+
+/**
+ * Stop the directory scanner thread.
+ */
+void exitDirScanner(void);
+
+/**
+ * Start reading a folder in the background, cancelling any folder being
+ * read. The listing is emptied, and entries are added to it by
+ * updateDirScan() as they are read.
+ *
+ * \param	dirList	Listing to add entries to.
+ * \param	path	Folder to read.
+ * \return			0 on success, or -1 if the scanner is not running.
+ */
+int requestDirScan(struct dirList_t* dirList, const char* path);
+
+/**
+ * Cancel reading a folder, such as when the user leaves it.
+ */
+void cancelDirScan(void);
+
+/**
+ * Add entries read since the last call to the listing passed to
+ * requestDirScan(), keeping it sorted.
+ *
+ * \param	dirList	Listing passed to requestDirScan().
+ * \param	keep	Index of an entry, such as the selected entry, updated to
+ *					the index of the same entry once entries are added. May
+ *					be NULL.
+ * \return			1 if entries were added, 0 if not, or -1 if the folder
+ *					could not be read.
+ */
+int updateDirScan(struct dirList_t* dirList, int* keep);
+
+/**
+ * Whether a folder is still being read.
+ */
+bool isDirScanning(void);
+
+#endif
@@ -1,6 +1,4 @@
-#if defined __arm__
-#include <3ds.h>
-#endif
+#include "platform.h"
 
 /* Errors that can't be explained with errno */
 #define NDSP_INIT_FAIL			1000
@@ -8,8 +6,6 @@
 #define FILE_NOT_SUPPORTED		1002
 #define UNSUPPORTED_CHANNELS	1003
 
-#if defined __arm__
-
 /**
  * Struct to help error handling across threads.
  */
@@ -32,5 +28,3 @@ struct errInfo_t
  * \param err	Error number.
  */
 char* ctrmus_strerror(int err);
-
-#endif
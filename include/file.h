@@ -1,3 +1,18 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef ctrmus_file_h
+#define ctrmus_file_h
+
+/* Bytes read from the start of a file to detect its type. */
+#define PROBE_SIZE	4096
+
+/* Bytes read after an ID3v2 tag that ends past the start of a file, which
+ * hold three MP3 frames at usual bitrates, or two of the largest. */
+#define PROBE_FRAMES_SIZE	4096
+
 enum file_types
 {
 	FILE_TYPE_ERROR = 0,
@@ -9,6 +24,9 @@ enum file_types
 	FILE_TYPE_SID
 };
 
+/* Number of file_types. */
+#define FILE_TYPES	(FILE_TYPE_SID + 1)
+
 /**
  * Obtain file type string from file_types enum.
  *
@@ -17,6 +35,55 @@ enum file_types
  */
 const char* fileToStr(enum file_types ft);
 
+/* Start of a file, read once to detect its type. */
+struct probe_t
+{
+	uint8_t	data[PROBE_SIZE];
+	size_t	len;
+
+	/* Start of the audio after an ID3v2 tag too large to check the frames
+	 * after it within data, such as one holding cover art, or empty. */
+	uint8_t	frames[PROBE_FRAMES_SIZE];
+	size_t	framesLen;
+};
+
+/**
+ * Read the start of an opened file, and the block after its ID3v2 tag where
+ * the tag ends too late to check the MP3 frames after it.
+ *
+ * \param	f		File, positioned at its start. Its position is unknown
+ *					afterwards.
+ * \param	probe	Output start of file.
+ */
+void readProbe(FILE* f, struct probe_t* probe);
+
+/**
+ * Read the start of a file.
+ *
+ * \param	file	File location.
+ * \param	probe	Output start of file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int probeFile(const char* file, struct probe_t* probe);
+
+/**
+ * Detect the type of a file from its start.
+ *
+ * \param	probe	Start of file.
+ * \return			file_types enum, or 0 if not supported.
+ */
+enum file_types probeType(const struct probe_t* probe);
+
+/**
+ * Whether a file has the extension of files that commonly sit alongside
+ * music, such as cover art and rip logs, so that it may be passed over
+ * without being read. Other files are detected by their start as usual.
+ *
+ * \param	file	File location.
+ * \return			true if the file is not an audio file.
+ */
+bool hasOtherExtension(const char* file);
+
 /**
  * Obtains file type.
  *
@@ -24,3 +91,5 @@ const char* fileToStr(enum file_types ft);
  * \return			file_types enum or 0 on error and errno set.
  */
 enum file_types getFileType(const char *file);
+
+#endif
@@ -1,4 +1,3 @@
 #include "playback.h"
 
 void setFlac(struct decoder_fn* decoder);
-int isFlac(const char* in);
@@ -0,0 +1,206 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dir.h"
+#include "tags.h"
+
+#ifndef ctrmus_library_h
+#define ctrmus_library_h
+
+/* Version of the index file format. Older or newer indexes are rebuilt. */
+#define LIBRARY_VERSION		2
+
+/* Value of an absent string or entry index. */
+#define LIBRARY_NONE		UINT32_MAX
+
+/* Type of a folder entry, alongside the values of file_types. */
+#define LIBRARY_TYPE_DIR	0xFF
+
+/*
+ * Entry of the library index. Entries are stored in the index file as they
+ * are in memory, which is little-endian on both the 3DS and the hosts the
+ * Linux build runs on.
+ */
+struct libEntry_t
+{
+	/* Size and modification time of files, to detect changes. */
+	uint64_t	size;
+	int64_t		mtime;
+
+	/* Offset of the name in the strings. The name of the root folder is
+	 * its full path. */
+	uint32_t	name;
+
+	/* Index of the parent folder, or LIBRARY_NONE for the root folder. */
+	uint32_t	parent;
+
+	/* Children of a folder are contiguous, in the order of dirList_t. */
+	uint32_t	first;
+	uint32_t	count;
+
+	/* Duration of a file, or 0 if unknown. */
+	uint32_t	durationMs;
+	uint32_t	rate;
+
+	/* Offsets of tags in the strings, or LIBRARY_NONE. */
+	uint32_t	title;
+	uint32_t	artist;
+	uint32_t	album;
+
+	/* enum file_types, or LIBRARY_TYPE_DIR. */
+	uint8_t		type;
+	uint8_t		channels;
+
+	/* Track number, or 0 if absent. */
+	uint16_t	track;
+};
+
+/* Index of the folders and files below a root folder. */
+struct library_t
+{
+	/* Entries, of which the first is the root folder. */
+	struct libEntry_t*	entries;
+	uint32_t			count;
+	uint32_t			cap;
+
+	/* Names and tags, each terminated by a null character. */
+	char*				strings;
+	uint32_t			stringsLen;
+	uint32_t			stringsCap;
+
+	/* Single allocation holding a loaded index, or NULL. */
+	void*				block;
+};
+
+/**
+ * Load an index file with a single read.
+ *
+ * \param	lib		Output library.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int loadLibrary(struct library_t* lib, const char* file);
+
+/**
+ * Write an index file. The previous file is only replaced once the new one
+ * has been written.
+ *
+ * \param	lib		Library to write.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int saveLibrary(const struct library_t* lib, const char* file);
+
+/**
+ * Index every folder and file below a root folder. Files that have the same
+ * size and modification time as in a previous index keep their information
+ * from it. Other files are opened to detect their type and duration.
+ *
+ * \param	lib		Output library, which must be zeroed.
+ * \param	old		Previous index of the same root folder, or NULL.
+ * \param	root	Root folder.
+ * \param	abort	Stop scanning once this is true, or NULL.
+ * \return			0 on success, or -1 on failure or if aborted.
+ */
+int scanLibrary(struct library_t* lib, const struct library_t* old,
+		const char* root, volatile bool* abort);
+
+/**
+ * Find the entry of a folder.
+ *
+ * \param	path	Full path of folder.
+ * \return			Index of entry, or LIBRARY_NONE if the folder is not in the
+ *					library.
+ */
+uint32_t findLibraryDir(const struct library_t* lib, const char* path);
+
+/**
+ * Get a name or tag.
+ *
+ * \param	off	Offset of string.
+ * \return		String, or NULL if off is LIBRARY_NONE.
+ */
+const char* getLibraryString(const struct library_t* lib, uint32_t off);
+
+/**
+ * Free a library.
+ */
+void freeLibrary(struct library_t* lib);
+
+/**
+ * Load the index of a root folder and update it on a background thread.
+ * The updated index is written back to the index file.
+ *
+ * \param	root	Root folder.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure.
+ */
+int startLibrary(const char* root, const char* file);
+
+/**
+ * List a folder from the index.
+ *
+ * \param	path	Full path of folder.
+ * \param	dirList	Output listing.
+ * \return			Number of entries, or -1 if the folder is not indexed.
+ */
+int getLibraryDirList(const char* path, struct dirList_t* dirList);
+
+/**
+ * Get the tags of a file from the index.
+ *
+ * \param	file	Full path of file.
+ * \param	tags	Output tags.
+ * \return			1 if the file has tags, 0 if it has none, or -1 if the
+ *					file is not indexed.
+ */
+int getLibraryTags(const char* file, struct tags_t* tags);
+
+/**
+ * Get the type of a file from the index.
+ *
+ * \param	file	Full path of file.
+ * \return			enum file_types, which is FILE_TYPE_ERROR for files that
+ *					are not audio files, or -1 if the file is not indexed.
+ */
+int getLibraryFileType(const char* file);
+
+/**
+ * Count the entries below a folder and every folder below it, and find the
+ * number of a file among them. The entries are numbered from 0 in the order
+ * of the index, in which they are contiguous.
+ *
+ * \param	path	Full path of folder.
+ * \param	file	Full path of a file below the folder, or NULL.
+ * \param	n		Output number of file, or LIBRARY_NONE if it is not
+ *					below the folder. May be NULL.
+ * \return			Number of entries, or -1 if the folder is not indexed.
+ */
+int getLibraryTreeSize(const char* path, const char* file, uint32_t* n);
+
+/**
+ * Get the path of an entry below a folder, numbered as by
+ * getLibraryTreeSize().
+ *
+ * \param	path	Full path of folder.
+ * \param	n		Number of entry.
+ * \param	file	Output path.
+ * \param	len		Size of file.
+ * \return			0 on success, or -1 if the entry is not a file that may be
+ *					played.
+ */
+int getLibraryTreeFile(const char* path, uint32_t n, char* file, size_t len);
+
+/**
+ * Number of times the index has been updated since startLibrary(), so that
+ * listings taken from it may be refreshed.
+ */
+unsigned getLibraryGen(void);
+
+/**
+ * Stop updating the index and free it.
+ */
+void exitLibrary(void);
+
+#endif
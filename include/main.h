@@ -15,6 +15,21 @@
 /* Default folder */
 #define DEFAULT_DIR		"sdmc:/"
 
+/* Folder for files written by ctrmus */
+#define CTRMUS_DIR		"sdmc:/3ds/ctrmus"
+
+/* Playback health statistics are appended to this file */
+#define HEALTH_LOG		CTRMUS_DIR "/health.log"
+
+/* Index of the music library */
+#define LIBRARY_FILE	CTRMUS_DIR "/library.idx"
+
+/* Shuffle mode and seed of the shuffled order */
+#define SHUFFLE_FILE	CTRMUS_DIR "/shuffle.cfg"
+
+/* Seek indexes of files played, one file each */
+#define SEEK_INDEX_DIR	CTRMUS_DIR "/seek"
+
 /* Maximum number of lines that can be displayed on bottom screen */
 #define	MAX_LIST		28
 /* Arbitrary cap for number of stored parent positions in folder to avoid
@@ -29,23 +44,4 @@ struct watchdogInfo
 	struct errInfo_t*	errInfo;
 };
 
-struct dirList_t
-{
-	char**	files;
-	int		fileNum;
-
-	char**	directories;
-	int		dirNum;
-
-	char*	currentDir;
-};
-
-/**
- * Get number of files in current working folder
- *
- * \return	Number of files in current working folder, -1 on failure with
- *			errno set.
- */
-int getNumberFiles(void);
-
 #endif
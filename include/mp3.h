@@ -1,5 +1,11 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include "playback.h"
 
+struct seekIndex_t;
+
 void setMp3(struct decoder_fn* decoder);
-int isMp3(const char *path);
+int initMp3Library(void);
+void exitMp3Library(void);
+int indexMp3(struct stream_t* stream, struct seekIndex_t* index,
+		volatile bool* abort);
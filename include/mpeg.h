@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ctrmus_mpeg_h
+#define ctrmus_mpeg_h
+
+/* Size of an ID3v2 tag header. */
+#define ID3V2_HEADER_SIZE	10
+
+/* Largest MPEG audio frame, of MPEG-2.5 layer II at 160 kbit/s and 8 kHz. */
+#define MPEG_MAX_FRAME		2881
+
+/* Bytes of the first frame of an MP3 file that hold its Xing, Info or VBRI
+ * header and LAME tag. */
+#define MPEG_INFO_SIZE		192
+
+/* Header of an MPEG audio frame. */
+struct mpegHeader_t
+{
+	/* 1 for MPEG-1, 2 for MPEG-2, or 3 for MPEG-2.5. */
+	uint8_t		version;
+	uint8_t		layer;
+	uint8_t		channels;
+
+	/* Header is followed by a CRC. */
+	uint8_t		crc;
+
+	uint32_t	rate;
+	uint32_t	bitrate;
+
+	/* Samples of each channel in the frame. */
+	uint32_t	samples;
+
+	/* Bytes in the frame, with its header. */
+	uint32_t	size;
+};
+
+/**
+ * Parse the header of an MPEG audio frame. Free format frames, whose size is
+ * not given by their header, are not accepted.
+ *
+ * \param	h		Four bytes of header.
+ * \param	header	Output header.
+ * \return			0 on success, or -1 if not a valid header.
+ */
+int parseMpegHeader(const uint8_t* h, struct mpegHeader_t* header);
+
+/**
+ * Check that data starts with consecutive MPEG audio frames, each following
+ * the last by the frame size given by its header, with the same version,
+ * layer, sampling rate and channels.
+ *
+ * \param	data	Data to check.
+ * \param	len		Bytes in data.
+ * \param	frames	Frames to check. Fewer are checked where the data ends
+ *					first, but never fewer than two.
+ * \return			true if the frames were found.
+ */
+bool checkMpegFrames(const uint8_t* data, size_t len, unsigned frames);
+
+/**
+ * Get the size of an ID3v2 tag at the start of a file.
+ *
+ * \param	data	Start of file.
+ * \param	len		Bytes in data, at least ID3V2_HEADER_SIZE for a tag to be
+ *					found.
+ * \return			Bytes in tag, with its header and footer, or 0 if there
+ *					is no tag.
+ */
+uint64_t getId3v2Size(const uint8_t* data, size_t len);
+
+/**
+ * Get the length of an MP3 file from the Xing, Info or VBRI header of its
+ * first frame, without the encoder delay and padding given by a LAME tag.
+ *
+ * \param	frame	First frame, of which up to MPEG_INFO_SIZE bytes are read.
+ * \param	len		Bytes in frame.
+ * \param	header	Parsed header of the frame.
+ * \return			Samples of each channel, or 0 if the frame has no header
+ *					giving the length.
+ */
+uint64_t getMpegInfoSamples(const uint8_t* frame, size_t len,
+		const struct mpegHeader_t* header);
+
+#endif
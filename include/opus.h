@@ -2,4 +2,14 @@
 #include "playback.h"
 
 void setOpus(struct decoder_fn* decoder);
-int isOpus(const char* in);
+
+struct tags_t;
+
+/**
+ * Read the tags of an Opus file from its comment header.
+ *
+ * \param	stream	Opened Opus file, positioned at its start.
+ * \param	tags	Tags to store comments in.
+ * \return			0 on success, or -1 if the headers could not be read.
+ */
+int readOpusTags(struct stream_t* stream, struct tags_t* tags);
@@ -0,0 +1,111 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+#ifndef ctrmus_output_h
+#define ctrmus_output_h
+
+/* Status of a buffer submitted to an output backend. */
+enum output_status
+{
+	OUTPUT_BUF_FREE = 0,
+	OUTPUT_BUF_QUEUED,
+	OUTPUT_BUF_PLAYING,
+	OUTPUT_BUF_DONE
+};
+
+/* Buffer of samples submitted to an output backend. Owned by the caller, and
+ * must remain valid until the backend reports it done or is cleared. */
+struct outputBuf_t
+{
+#if defined __arm__
+	ndspWaveBuf				waveBuf;
+#else
+	const int16_t*			data;
+	size_t					frames;
+	volatile int			status;
+	struct outputBuf_t*		next;
+#endif
+};
+
+/* Audio output backend. Only one backend may be initialised at a time. */
+struct output_fn
+{
+	/**
+	 * Initialise the backend.
+	 * \return	0 on success, else an errno or custom error code.
+	 */
+	int (*init)(void);
+
+	/**
+	 * Set function to call from the backend whenever a buffer may have
+	 * finished playing. Must not block.
+	 */
+	void (*setCallback)(void (*callback)(void* data), void* data);
+
+	/**
+	 * Drop all submitted buffers and return the channel to its default state.
+	 */
+	void (*reset)(void);
+
+	/**
+	 * Set sampling rate and number of channels of following buffers. Only
+	 * called whilst no buffers are queued.
+	 */
+	void (*setFormat)(uint32_t rate, uint8_t channels);
+
+	/**
+	 * Queue interleaved samples to play after all previously submitted
+	 * buffers.
+	 * \param	buf		Buffer to track the samples with.
+	 * \param	data	Samples, which must have been flushed from the data
+	 *					cache.
+	 * \param	frames	Samples per channel.
+	 */
+	void (*submit)(struct outputBuf_t* buf, const int16_t* data,
+			size_t frames);
+
+	enum output_status (*status)(const struct outputBuf_t* buf);
+
+	/**
+	 * Drop all submitted buffers.
+	 */
+	void (*clear)(void);
+
+	void (*setPaused)(bool paused);
+
+	/**
+	 * Get number of frames of the playing buffer that have been played.
+	 */
+	size_t (*position)(void);
+
+	void (*exit)(void);
+};
+
+#if defined __arm__
+/**
+ * Set output to the NDSP channel CHANNEL.
+ */
+void setNdspOutput(struct output_fn* output);
+#else
+/**
+ * Set output to a sink that discards samples.
+ *
+ * \param	speed	Multiple of real time to consume samples at, or 0 to
+ *					consume samples as fast as they are submitted.
+ */
+void setNullOutput(struct output_fn* output, unsigned speed);
+
+/**
+ * Set output to a 16-bit PCM WAV file. Samples are written as fast as they
+ * are submitted. The format of the file is that of the first buffers
+ * played.
+ *
+ * \param	file	File to create.
+ */
+void setWavOutput(struct output_fn* output, const char* file);
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef ctrmus_platform_h
+#define ctrmus_platform_h
+
+#if defined __arm__
+#include <3ds.h>
+#else
+/*
+ * The subset of libctru used by the playback engine, implemented with POSIX
+ * threads so that the engine can be built and run on the host.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t		u8;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int32_t		s32;
+typedef int64_t		s64;
+typedef s32			Result;
+
+/* Handles refer to events created with svcCreateEvent(). */
+typedef uintptr_t	Handle;
+
+#define U64_MAX				UINT64_MAX
+#define CUR_THREAD_HANDLE	0xFFFF8000
+
+/* Ticks per second of svcGetSystemTick(). */
+#define SYSCLOCK_ARM11		1000000000
+
+typedef enum
+{
+	RESET_ONESHOT	= 0,
+	RESET_STICKY	= 1
+} ResetType;
+
+typedef pthread_mutex_t LightLock;
+
+typedef struct
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	bool			signalled;
+	ResetType		type;
+} LightEvent;
+
+typedef struct thread_t* Thread;
+typedef void (*ThreadFunc)(void* arg);
+
+void LightLock_Init(LightLock* lock);
+void LightLock_Lock(LightLock* lock);
+void LightLock_Unlock(LightLock* lock);
+
+void LightEvent_Init(LightEvent* event, ResetType type);
+void LightEvent_Clear(LightEvent* event);
+void LightEvent_Signal(LightEvent* event);
+void LightEvent_Wait(LightEvent* event);
+
+/**
+ * Wait for an event to be signalled.
+ *
+ * \param	timeout_ns	Timeout in nanoseconds.
+ * \return				0 if signalled, or 1 on timeout.
+ */
+int LightEvent_WaitTimeout(LightEvent* event, s64 timeout_ns);
+
+/**
+ * Create a thread. Priority and core are ignored on the host.
+ *
+ * \return	Thread, or NULL on failure.
+ */
+Thread threadCreate(ThreadFunc entry, void* arg, size_t stack_size, int prio,
+		int core_id, bool detached);
+Result threadJoin(Thread thread, u64 timeout_ns);
+void threadFree(Thread thread);
+
+void svcSleepThread(s64 ns);
+Result svcGetThreadPriority(s32* out, Handle handle);
+Result svcCreateEvent(Handle* event, ResetType reset_type);
+Result svcSignalEvent(Handle handle);
+Result svcWaitSynchronization(Handle handle, s64 timeout_ns);
+Result svcCloseHandle(Handle handle);
+Result APT_CheckNew3DS(bool* out);
+
+/**
+ * Milliseconds elapsed since an arbitrary point in time.
+ */
+u64 osGetTime(void);
+
+/**
+ * Ticks elapsed since an arbitrary point in time. On the host, a tick is a
+ * nanosecond.
+ */
+u64 svcGetSystemTick(void);
+
+/* There is no linear heap or DSP on the host. */
+void* linearAlloc(size_t size);
+void linearFree(void* mem);
+Result DSP_FlushDataCache(const void* address, u32 size);
+
+#endif
+
+/**
+ * Get the modification time of a file. On the 3DS, stat() leaves st_mtime
+ * of files on the SD card at 0, so it is read from the archive instead.
+ *
+ * \param	file	File location.
+ * \return			Modification time, or -1 on failure.
+ */
+int64_t getFileMtime(const char* file);
+
+#endif
@@ -1,5 +1,9 @@
 #include <stdbool.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file.h"
 
 #ifndef ctrmus_playback_h
 #define ctrmus_playback_h
@@ -7,26 +11,42 @@
 /* Channel to play music on */
 #define CHANNEL	0x08
 
+/* Default duration of samples to decode ahead of those playing. */
+#define DECODE_AHEAD_MS	1000
+
+/* Range and default number of wave buffers queued on the channel. */
+#define WAVEBUFS_MIN		2
+#define WAVEBUFS_MAX		8
+#define WAVEBUFS_DEFAULT	4
+
+struct stream_t;
+
 struct decoder_fn
 {
 	/**
-	 * Set decoder parameters.
-	 * \param	decoder Structure to store parameters.
+	 * Create a new decoder instance for an opened file. The instance is
+	 * stored in decoder->ctx, so several decoders may be open at the same
+	 * time.
+	 * \param	decoder Structure to store parameters and instance in.
+	 * \param	stream	Opened file. On success, the decoder closes it in
+	 *					exit(). On failure, the caller must close it.
 	 * \return	0 on success, else failure.
 	 */
-	int (* init)(const char* file);
+	int (* init)(struct decoder_fn* decoder, struct stream_t* stream);
 
 	/**
 	 * Get sampling rate of file.
+	 * \param	ctx	Decoder instance.
 	 * \return	Sampling rate.
 	 */
-	uint32_t (* rate)(void);
+	uint32_t (* rate)(void* ctx);
 
 	/**
 	 * Get number of channels of file.
+	 * \param	ctx	Decoder instance.
 	 * \return	Number of channels for opened file.
 	 */
-	uint8_t (* channels)(void);
+	uint8_t (* channels)(void* ctx);
 
 	/**
 	 * Size of output buffer used in decode().
@@ -35,21 +55,41 @@ struct decoder_fn
 
 	/**
 	 * Fill buffer with decoded samples.
+	 * \param ctx		Decoder instance.
 	 * \param buffer	Output buffer to fill.
 	 * \return		Samples read for each channel.
 	 */
-	uint64_t (* decode)(void*);
+	uint64_t (* decode)(void* ctx, void* buffer);
+
+	/**
+	 * Free codec resources and the decoder instance.
+	 * \param	ctx	Decoder instance.
+	 */
+	void (* exit)(void* ctx);
 
 	/**
-	 * Free codec resources.
+	 * Optional. Set to NULL if unavailable.
+	 * Get number of samples in audio file. Called again after each
+	 * decode(), for decoders that only estimate it at first.
+	 * \param	ctx	Decoder instance.
 	 */
-	void (* exit)(void);
+	size_t (* getFileSamples)(void* ctx);
 
 	/**
 	 * Optional. Set to NULL if unavailable.
-	 * Get number of samples in audio file.
+	 * Seek to a sample, so that the next call to decode() starts from it.
+	 * \param	ctx		Decoder instance.
+	 * \param	frame	Sample of each channel to seek to, counted from the
+	 *					start of the file.
+	 * \return	0 on success, else failure.
 	 */
-	size_t (* getFileSamples)(void);
+	int (* seek)(void* ctx, uint64_t frame);
+
+	/**
+	 * Opaque decoder instance. Set by init() and passed to every other
+	 * function. NULL if no file is open.
+	 */
+	void* ctx;
 };
 
 struct playbackInfo_t
@@ -61,8 +101,98 @@ struct playbackInfo_t
 	size_t samples_total;
 	size_t samples_played;
 	size_t samples_per_second;
+
+	/* Play the file set with queueNextFile() without a gap. */
+	volatile bool gapless;
+
+	/* Duration of samples to decode ahead of those playing. */
+	unsigned decodeAheadMs;
+
+	/* Wave buffers queued on the channel, from WAVEBUFS_MIN to WAVEBUFS_MAX.
+	 * More buffers give more headroom against decoding jitter. Read when
+	 * playback starts. */
+	unsigned waveBufs;
+
+	/* Times per second that the playback engine woke whilst playing. */
+	volatile unsigned wakeupsPerSec;
 };
 
+/*
+ * Buckets of the decode time histogram. Bucket 0 counts decode() calls under
+ * 1 ms, bucket i calls under 2^i ms, and the last bucket all slower calls.
+ */
+#define STATS_HIST_BUCKETS	10
+
+/* Playback health, accumulated since the playback engine started. */
+struct playbackStats_t
+{
+	uint32_t	decodeHist[STATS_HIST_BUCKETS];
+	uint32_t	decodeMaxUs;
+
+	/* Time from the DSP finishing a buffer to another being queued. */
+	uint32_t	refills;
+	uint32_t	refillMaxUs;
+	uint64_t	refillTotalUs;
+
+	/* Times that every queued buffer was played before more were queued. */
+	uint32_t	underruns;
+
+	/* Time from opening a file to queueing its first samples, for the last
+	 * file started with startPlayback() and the slowest. */
+	uint32_t	startUs;
+	uint32_t	startMaxUs;
+
+	/* Duration of audio decoded and time spent decoding, by file type. */
+	uint64_t	audioUs[FILE_TYPES];
+	uint64_t	decodeUs[FILE_TYPES];
+};
+
+/* Non-error values signalled through errInfo_t by the playback thread. */
+#define PLAYBACK_STOPPED		-1
+#define PLAYBACK_NEXT_TRACK		-2
+
+struct output_fn;
+
+/**
+ * Start the playback engine thread. Must be called before any other playback
+ * function.
+ *
+ * \param	info	Playback information, which must remain valid until
+ *					exitPlaybackEngine() is called.
+ * \param	output	Output backend to play to.
+ * \return			0 on success, or -1 on failure.
+ */
+int startPlaybackEngine(struct playbackInfo_t* info,
+		const struct output_fn* output);
+
+/**
+ * Stop playback and the playback engine thread.
+ */
+void exitPlaybackEngine(void);
+
+/**
+ * Stop the current file and play another.
+ *
+ * \param	stream	Opened file to play. On success, it is closed by the
+ *					playback engine.
+ * \param	next	File to play after it in gapless mode, or NULL.
+ * \return			0 on success, or -1 if a path is too long.
+ */
+int startPlayback(struct stream_t* stream, const char* next);
+
+/**
+ * Select and initialise a decoder for an opened file. Used by the library
+ * scanner to read the format and duration of files.
+ *
+ * \param	decoder	Decoder to initialise.
+ * \param	stream	Opened file. On success, it is closed by the decoder.
+ *					On failure, it is closed before returning.
+ * \param	type	Output type of file.
+ * \return			0 on success, else error number.
+ */
+int openDecoder(struct decoder_fn* decoder, struct stream_t* stream,
+		enum file_types* type);
+
 /**
  * Pause or play current file.
  *
@@ -71,22 +201,44 @@ struct playbackInfo_t
 bool togglePlayback(void);
 
 /**
- * Stops current playback. Playback thread should exit as a result.
+ * Stops current playback.
  */
 void stopPlayback(void);
 
+/**
+ * Skip to the file queued with queueNextFile(). PLAYBACK_NEXT_TRACK is
+ * signalled once it is playing.
+ */
+void skipPlayback(void);
+
+/**
+ * Move playback of the current file forwards or backwards. Offsets requested
+ * before the engine makes the seek are added together.
+ *
+ * \param	ms	Offset from the position playing, in milliseconds.
+ */
+void seekPlayback(int32_t ms);
+
 /**
  * Returns whether music is playing or paused.
  */
 bool isPlaying(void);
 
 /**
- * Should only be called from a new thread only, and have only one playback
- * thread at time. This function has not been written for more than one
- * playback thread in mind.
+ * Set the file to play after the current one in gapless mode, or when
+ * skipping with skipPlayback().
+ *
+ * \param	file	File to play next, or NULL to play nothing after the
+ *					current file.
+ * \return			0 on success, or -1 if the file path is too long.
+ */
+int queueNextFile(const char* file);
+
+/**
+ * Get playback health statistics.
  *
- * \param	infoIn	Playback information.
+ * \param	out		Output statistics.
  */
-void playFile(void* infoIn);
+void getPlaybackStats(struct playbackStats_t* out);
 
 #endif
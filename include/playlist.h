@@ -0,0 +1,75 @@
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ctrmus_playlist_h
+#define ctrmus_playlist_h
+
+/* Most entries read from a playlist, which bounds the memory it uses. */
+#define PLAYLIST_MAX_ENTRIES	(64 * 1024)
+
+enum playlist_type
+{
+	PLAYLIST_NONE = 0,
+	PLAYLIST_M3U,
+	PLAYLIST_M3U8,
+	PLAYLIST_PLS
+};
+
+/*
+ * Playlist. Paths are not copied into memory; each entry is the offset of
+ * its path in the playlist file, which is read again when the entry is about
+ * to be played. A playlist therefore takes four bytes per entry.
+ */
+struct playlist_t
+{
+	/* Path of the playlist file, and the length of its folder. */
+	char				file[PATH_MAX];
+	size_t				dirLen;
+	enum playlist_type	type;
+
+	uint32_t*			entries;
+	uint32_t			count;
+	uint32_t			cap;
+};
+
+/**
+ * Get the type of a playlist from its file name.
+ *
+ * \param	file	File name or path.
+ * \return			Type of playlist, or PLAYLIST_NONE if it is not one.
+ */
+enum playlist_type getPlaylistType(const char* file);
+
+/**
+ * Read the entries of a playlist, replacing those of any playlist read
+ * before. The file is read in blocks, and only the offset of each entry is
+ * kept.
+ *
+ * \param	playlist	Playlist, which must be zeroed before its first use.
+ * \param	file		Path of playlist file.
+ * \return				Number of entries, or -1 on failure with errno set.
+ */
+int openPlaylist(struct playlist_t* playlist, const char* file);
+
+/**
+ * Find the first entry of a playlist that may be played, starting from an
+ * entry and moving in either direction. Paths relative to the playlist are
+ * resolved, and each is checked to be a file, only as it is reached.
+ *
+ * \param	playlist	Playlist.
+ * \param	n			Entry to start from.
+ * \param	step		1 to search forwards, or -1 to search backwards.
+ * \param	path		Output path of the entry found.
+ * \param	len			Size of path.
+ * \return				Entry found, or -1 if there is none.
+ */
+int32_t findPlaylistEntry(const struct playlist_t* playlist, int32_t n,
+		int step, char* path, size_t len);
+
+/**
+ * Free memory used by a playlist.
+ */
+void freePlaylist(struct playlist_t* playlist);
+
+#endif
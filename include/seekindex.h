@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ctrmus_seekindex_h
+#define ctrmus_seekindex_h
+
+/* Most points of a seek index. Once an index being built is full, every
+ * other point is dropped, so a longer file has points further apart. */
+#define SEEK_INDEX_POINTS	2048
+
+struct stream_t;
+
+/* Position in a file that decoding may start from. */
+struct seekPoint_t
+{
+	/* First sample of each channel of the MP3 or FLAC frame, or granule
+	 * position of the Ogg page, which is that of its last sample. */
+	uint64_t	sample;
+
+	/* Offset of the frame or page in the file. */
+	uint64_t	offset;
+};
+
+/*
+ * Seek index of a file, so that seeking needs a single read of the file
+ * instead of a search over it. Indexes are built in the background the first
+ * time a file is played, and are kept in files keyed by the path, size and
+ * modification time of the file.
+ */
+struct seekIndex_t
+{
+	/* enum file_types of the file. */
+	uint32_t			type;
+
+	/* MPEG frames between points of an MP3 file. */
+	uint32_t			step;
+
+	/* Points in order of their samples, which are none where the file has
+	 * its own seek table. */
+	uint32_t			count;
+
+	/* Samples of each channel of an MP3 file, counted from the headers of
+	 * all of its frames, or 0. */
+	uint64_t			samples;
+
+	struct seekPoint_t	points[];
+};
+
+/**
+ * Start the thread that builds seek indexes.
+ *
+ * \param	dir	Folder to keep seek indexes in, which is created if needed.
+ * \return		0 on success, or -1 on failure.
+ */
+int startSeekIndex(const char* dir);
+
+/**
+ * Stop the thread that builds seek indexes.
+ */
+void exitSeekIndex(void);
+
+/**
+ * Build the seek index of a file being played in the background, unless it
+ * has one already.
+ *
+ * \param	stream	Opened file, which is passed over unless it is being
+ *					played.
+ */
+void queueSeekIndex(const struct stream_t* stream);
+
+/**
+ * Load the seek index of a file with a single read. An index that has not
+ * been built yet is built in the background.
+ *
+ * \param	stream	Opened file, which has no index unless it is being
+ *					played.
+ * \return			Index, to be freed with free(), or NULL if there is none
+ *					yet.
+ */
+struct seekIndex_t* loadSeekIndex(const struct stream_t* stream);
+
+/**
+ * Find the last point of an index at or before a sample. Points too far
+ * before the sample are not returned, such as past the end of the first
+ * stream of a chained Ogg file.
+ *
+ * \param	sample	Sample of each channel, or granule position.
+ * \return			Point, or NULL if decoding may not start from the index.
+ */
+const struct seekPoint_t* findSeekPoint(const struct seekIndex_t* index,
+		uint64_t sample);
+
+/**
+ * Number of seek indexes built, so that decoders waiting for the index of
+ * their file know when to load it again.
+ */
+unsigned getSeekIndexGen(void);
+
+#endif
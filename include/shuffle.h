@@ -0,0 +1,108 @@
+#include <stdint.h>
+
+#ifndef ctrmus_shuffle_h
+#define ctrmus_shuffle_h
+
+/* Rounds of the Feistel network that orders tracks. */
+#define SHUFFLE_ROUNDS	4
+
+enum shuffle_mode
+{
+	/* Files are played in order. */
+	SHUFFLE_OFF = 0,
+
+	/* Files of the folder, or entries of the playlist, are shuffled. */
+	SHUFFLE_FOLDER,
+
+	/* Files of the folder and every folder below it are shuffled. */
+	SHUFFLE_TREE,
+
+	SHUFFLE_MODES
+};
+
+/*
+ * Shuffled order of tracks 0 to count - 1. The order is a pseudo-random
+ * permutation computed from the seed one track at a time, so it is never
+ * stored and takes the same memory for any number of tracks. Each cycle
+ * plays every track once, starting from any track, after which the next
+ * cycle is played with another seed.
+ */
+struct shuffle_t
+{
+	uint32_t	count;
+	uint32_t	seed;
+
+	/* Position in the permutation of the first track of this cycle, and
+	 * the number of tracks after it played so far. */
+	uint32_t	start;
+	uint32_t	played;
+
+	/* Permutation, derived from the seed. Tracks are permuted within the
+	 * smallest domain of 2 * halfBits bits that holds count tracks. */
+	uint32_t	halfBits;
+	uint32_t	keys[SHUFFLE_ROUNDS];
+};
+
+/**
+ * Start shuffling tracks.
+ *
+ * \param	shuffle	Shuffle to start.
+ * \param	count	Number of tracks. Must not be 0.
+ * \param	seed	Seed of the order, so that the same seed gives the same
+ *					order.
+ * \param	first	Track to start from, or count or more to start from the
+ *					first track of the order.
+ */
+void initShuffle(struct shuffle_t* shuffle, uint32_t count, uint32_t seed,
+		uint32_t first);
+
+/**
+ * Get the track being played.
+ */
+uint32_t getShuffleTrack(const struct shuffle_t* shuffle);
+
+/**
+ * Move to the next track. Once every track has been played, a new order is
+ * started that does not begin with the track just played.
+ *
+ * \return	Next track.
+ */
+uint32_t nextShuffleTrack(struct shuffle_t* shuffle);
+
+/**
+ * Move back to the previous track of the cycle.
+ *
+ * \param	track	Output previous track.
+ * \return			0 on success, or -1 if at the first track of the cycle.
+ */
+int prevShuffleTrack(struct shuffle_t* shuffle, uint32_t* track);
+
+/**
+ * Get a seed for a new order.
+ */
+uint32_t newShuffleSeed(void);
+
+/**
+ * Read the shuffle mode and seed saved with saveShuffleSettings().
+ *
+ * \param	file	Settings file.
+ * \param	mode	Output mode.
+ * \param	seed	Output seed.
+ * \return			0 on success, or -1 if the file could not be read.
+ */
+int loadShuffleSettings(const char* file, enum shuffle_mode* mode,
+		uint32_t* seed);
+
+/**
+ * Save the shuffle mode and seed, so that the same order is played after a
+ * restart.
+ *
+ * \param	file	Settings file.
+ * \param	mode	Mode.
+ * \param	seed	Seed of the current order.
+ * \return			0 on success, or -1 on failure.
+ */
+int saveShuffleSettings(const char* file, enum shuffle_mode mode,
+		uint32_t seed);
+
+#endif
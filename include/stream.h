@@ -0,0 +1,188 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "file.h"
+
+#ifndef ctrmus_stream_h
+#define ctrmus_stream_h
+
+/* Size of each block read ahead. Blocks are read at offsets that are
+ * multiples of their size, so that reads cover whole SD card clusters. */
+#define STREAM_BLOCK_SIZE	(32 * 1024)
+
+/* Blocks held by each stream read ahead: the block being read, the block
+ * before it, and the blocks after it that are read ahead. */
+#define STREAM_BLOCKS		8
+
+/* Streams that may be read ahead at the same time. */
+#define PREFETCH_STREAMS	4
+
+/*
+ * Memory used to hold whole files, such as the track playing and the track
+ * queued after it. The application has 64MB with SYSTEM_MODE set in the
+ * Makefile, about half of which is the linear heap, so the cache takes a
+ * quarter. Files larger than TRACK_CACHE_MAX_FILE are read ahead instead,
+ * so that two tracks always fit.
+ */
+#define TRACK_CACHE_SIZE		(16 * 1024 * 1024)
+#define TRACK_CACHE_MAX_FILE	(TRACK_CACHE_SIZE / 2)
+#define TRACK_CACHE_FILES		8
+
+struct readAhead_t;
+struct cachedFile_t;
+
+/*
+ * File opened once for both detecting its type and decoding it. The start of
+ * the file is read to detect its type, and is then served from memory.
+ */
+struct stream_t
+{
+	char			file[PATH_MAX];
+	enum file_types	type;
+
+	/* System tick at which the file was opened. */
+	uint64_t		openTick;
+
+	FILE*			f;
+	int64_t			size;
+
+	/* Position of the next read, and position of f. */
+	int64_t			pos;
+	int64_t			filePos;
+
+	struct probe_t	probe;
+
+	/* Blocks read ahead by the prefetch thread, or NULL if the stream is
+	 * read directly. */
+	struct readAhead_t*	ra;
+
+	/* File in the track cache, read from memory as far as it is loaded, or
+	 * NULL. */
+	struct cachedFile_t*	cached;
+
+	/* Time that reads wait for the file is counted in streamStats_t. */
+	bool			timed;
+
+	/* File is opened to be played, so its seek index is built and loaded.
+	 * Files opened only to read their details, such as by the library
+	 * scan, are not indexed. */
+	bool			playing;
+};
+
+/* Reads from files by streams. */
+struct streamStats_t
+{
+	uint64_t	bytesRead;
+	uint32_t	reads;
+
+	/* Blocks read by the prefetch thread. */
+	uint32_t	prefetched;
+
+	/* Streams decoded from files already in the track cache. */
+	uint32_t	cacheHits;
+
+	/* Reads of streams being decoded that waited for the file, and the
+	 * time they waited. */
+	uint32_t	stalls;
+	uint32_t	stallMaxUs;
+	uint64_t	stallTotalUs;
+};
+
+/**
+ * Open a file, read its start and detect its type.
+ *
+ * \param	file	File location.
+ * \return			Stream, or NULL on failure with errno set. If the type of
+ *					the file isn't supported, type is FILE_TYPE_ERROR.
+ */
+struct stream_t* openStream(const char* file);
+
+/**
+ * Read from a stream.
+ *
+ * \param	buffer	Output.
+ * \param	size	Bytes to read.
+ * \return			Bytes read, which is less than size at the end of the
+ *					stream or on failure.
+ */
+size_t readStream(struct stream_t* stream, void* buffer, size_t size);
+
+/**
+ * Set position of a stream.
+ *
+ * \param	offset	Offset from whence.
+ * \param	whence	SEEK_SET, SEEK_CUR or SEEK_END.
+ * \return			0 on success, or -1 on failure.
+ */
+int seekStream(struct stream_t* stream, int64_t offset, int whence);
+
+/**
+ * Get position of a stream.
+ */
+int64_t tellStream(const struct stream_t* stream);
+
+/**
+ * Start the thread that reads streams ahead of their decoders.
+ *
+ * \param	prio	Priority of the thread, which should be higher than that of
+ *					the decoders, as it mostly waits for the SD card.
+ * \return			0 on success, or -1 on failure.
+ */
+int startPrefetch(int prio);
+
+/**
+ * Stop the prefetch thread and empty the track cache. Streams read ahead
+ * must be closed first.
+ */
+void exitPrefetch(void);
+
+/**
+ * Read a stream ahead of its reader in the prefetch thread, from now until
+ * it is closed. Files small enough are loaded whole into the track cache,
+ * from which they are read again if played later. Reads of the stream are
+ * counted as stalls where they wait for the file, whether or not it is read
+ * ahead.
+ *
+ * \return	0 on success, or -1 if the stream is read directly, such as when
+ *			the prefetch thread is not running or read-ahead is disabled.
+ */
+int startReadAhead(struct stream_t* stream);
+
+/**
+ * Load a file into the track cache in the prefetch thread, once streams
+ * being read have been read ahead, so that it may later be played from
+ * memory. Only the file most recently requested is loaded.
+ *
+ * \param	file	File to load, or NULL.
+ */
+void preloadFile(const char* file);
+
+/**
+ * Enable or disable read-ahead of streams started after this call. Enabled
+ * by default.
+ */
+void setReadAhead(bool enable);
+
+/**
+ * Delay every read of a file, so that slow storage such as the SD card of
+ * the 3DS may be simulated on the host.
+ *
+ * \param	us	Delay in microseconds, or 0 for none.
+ */
+void setStreamLatency(uint32_t us);
+
+/**
+ * Get statistics of reads from files since the program started.
+ *
+ * \param	out		Output statistics.
+ */
+void getStreamStats(struct streamStats_t* out);
+
+/**
+ * Close a stream. Does nothing if stream is NULL.
+ */
+void closeStream(struct stream_t* stream);
+
+#endif
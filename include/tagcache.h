@@ -0,0 +1,35 @@
+#include "tags.h"
+
+#ifndef ctrmus_tagcache_h
+#define ctrmus_tagcache_h
+
+/**
+ * Start the tag reader thread.
+ *
+ * \return	0 on success, or -1 on failure.
+ */
+int startTagCache(void);
+
+/**
+ * Stop the tag reader thread.
+ */
+void exitTagCache(void);
+
+/**
+ * Get the tags of a file. Tags that have not been read yet are read in the
+ * background, so this is called only for files that are shown.
+ *
+ * \param	file	Full path of file.
+ * \param	tags	Output tags.
+ * \return			1 if the file has tags, 0 if it has none, or -1 if they
+ *					have not been read yet.
+ */
+int getTags(const char* file, struct tags_t* tags);
+
+/**
+ * Number of files whose tags have been read, so that the files shown may be
+ * redrawn with their tags.
+ */
+unsigned getTagCacheGen(void);
+
+#endif
@@ -0,0 +1,50 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ctrmus_tags_h
+#define ctrmus_tags_h
+
+/* Size of each tag string, including the terminating null character. */
+#define TAG_LEN		64
+
+/* Tags of a file. Strings are UTF-8, and empty if absent. */
+struct tags_t
+{
+	char		title[TAG_LEN];
+	char		artist[TAG_LEN];
+	char		album[TAG_LEN];
+
+	/* Track number, or 0 if absent. */
+	uint16_t	track;
+};
+
+struct stream_t;
+
+/**
+ * Read the tags of a file from its headers, without initialising a decoder.
+ * Reads ID3v2 tags of MP3 files, VORBIS_COMMENT blocks of FLAC files,
+ * comment headers of Opus and Vorbis files, and PSID headers of SID files.
+ *
+ * \param	stream	Opened file, positioned at its start. Its position is
+ *					undefined afterwards.
+ * \param	tags	Output tags, which are emptied first.
+ * \return			0 if any tag was read, or -1 if not.
+ */
+int readTags(struct stream_t* stream, struct tags_t* tags);
+
+/**
+ * Store a Vorbis comment, of the form "FIELD=value", if it is a tag of
+ * interest.
+ *
+ * \param	tags	Tags to store comment in.
+ * \param	comment	Comment, which need not be null terminated.
+ * \param	len		Length of comment.
+ */
+void addVorbisComment(struct tags_t* tags, const char* comment, size_t len);
+
+/**
+ * Whether any tag is present.
+ */
+int hasTags(const struct tags_t* tags);
+
+#endif
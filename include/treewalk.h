@@ -0,0 +1,69 @@
+#include <limits.h>
+#include <stddef.h>
+
+#include "dir.h"
+
+#ifndef ctrmus_treewalk_h
+#define ctrmus_treewalk_h
+
+/* Deepest folder entered below the root folder of a walk. */
+#define TREE_MAX_DEPTH	32
+
+/* Cursor within a folder of a walk. */
+struct treeLevel_t
+{
+	struct dirList_t	list;
+
+	/* Entry visited, which is -1 before the first entry and the number of
+	 * entries after the last. */
+	int					pos;
+
+	/* Length of the path of the folder. */
+	size_t				pathLen;
+};
+
+/*
+ * Depth-first walk over the files of a folder and of every folder below it,
+ * in the order of the file browser. Only the folders from the root folder
+ * to the file visited are listed, each with a cursor, so the memory used
+ * depends on the depth of the tree and not on the number of files in it.
+ */
+struct treeWalk_t
+{
+	/* Path of the deepest folder entered. */
+	char				path[PATH_MAX];
+
+	struct treeLevel_t	levels[TREE_MAX_DEPTH + 1];
+	int					depth;
+};
+
+/**
+ * Start a walk over a folder tree.
+ *
+ * \param	walk	Walk, which must be zeroed before its first use.
+ * \param	root	Root folder.
+ * \param	file	File below the root folder to start from, or NULL to
+ *					start before the first file.
+ * \return			0 on success, or -1 if the root folder, or the folder of
+ *					file, could not be read.
+ */
+int startTreeWalk(struct treeWalk_t* walk, const char* root,
+		const char* file);
+
+/**
+ * Move to the next or previous file of the walk.
+ *
+ * \param	step	1 for the next file, or -1 for the previous file.
+ * \param	file	Output path of the file.
+ * \param	len		Size of file.
+ * \return			0 on success, or -1 once past the first or last file, after
+ *					which the walk may be moved back in the other direction.
+ */
+int stepTreeWalk(struct treeWalk_t* walk, int step, char* file, size_t len);
+
+/**
+ * Free memory used by a walk.
+ */
+void freeTreeWalk(struct treeWalk_t* walk);
+
+#endif
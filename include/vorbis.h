@@ -3,4 +3,14 @@
 #include "playback.h"
 
 void setVorbis(struct decoder_fn* decoder);
-int isVorbis(const char* in);
+
+struct tags_t;
+
+/**
+ * Read the tags of a Vorbis file from its comment header.
+ *
+ * \param	stream	Opened Vorbis file, positioned at its start.
+ * \param	tags	Tags to store comments in.
+ * \return			0 on success, or -1 if the headers could not be read.
+ */
+int readVorbisTags(struct stream_t* stream, struct tags_t* tags);
@@ -0,0 +1,310 @@
+#if defined __gnu_linux__
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "error.h"
+#include "file.h"
+#include "flac.h"
+#include "mp3.h"
+#include "opus.h"
+#include "playback.h"
+#include "sid.h"
+#include "stream.h"
+#include "vorbis.h"
+#include "wav.h"
+
+/* Seconds to decode of files that have no end, such as SID tunes. */
+#define ENDLESS_SECONDS	60
+
+/* Times of each call to decode(), in nanoseconds. */
+struct timings_t
+{
+	uint64_t*	ns;
+	size_t		len;
+	size_t		cap;
+};
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmpNs(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static int addTiming(struct timings_t* t, uint64_t ns)
+{
+	if(t->len == t->cap)
+	{
+		size_t cap = t->cap == 0 ? 1024 : t->cap * 2;
+		uint64_t* p = realloc(t->ns, cap * sizeof(uint64_t));
+
+		if(p == NULL)
+			return -1;
+
+		t->ns = p;
+		t->cap = cap;
+	}
+
+	t->ns[t->len++] = ns;
+	return 0;
+}
+
+/**
+ * Get percentile of sorted timings.
+ */
+static uint64_t percentile(const struct timings_t* t, unsigned pc)
+{
+	if(t->len == 0)
+		return 0;
+
+	return t->ns[(t->len - 1) * pc / 100];
+}
+
+/**
+ * Name of the container and codec of a file, distinguishing the formats that
+ * share a decoder.
+ */
+static const char* formatName(const struct stream_t* stream)
+{
+	const struct probe_t* probe = &stream->probe;
+
+	if(stream->type == FILE_TYPE_WAV && probe->len >= 4 &&
+			memcmp(probe->data, "FORM", 4) == 0)
+		return "AIFF";
+
+	if(stream->type == FILE_TYPE_FLAC && probe->len >= 4 &&
+			memcmp(probe->data, "OggS", 4) == 0)
+		return "OGG-FLAC";
+
+	return fileToStr(stream->type);
+}
+
+/**
+ * Decode a file, and print its results as a JSON object.
+ *
+ * \param	file	File to decode.
+ * \param	first	File is the first to be printed.
+ * \return			0 on success, or -1 on failure.
+ */
+static int benchFile(const char* file, int first)
+{
+	struct decoder_fn	decoder;
+	struct timings_t	t = { 0 };
+	struct rusage		usage;
+	struct stream_t*	stream;
+	const char*			format;
+	int16_t*			buffer = NULL;
+	uint64_t			start, initNs, decodeNs = 0;
+	uint64_t			samples = 0, limit = 0;
+	uint32_t			rate;
+	uint8_t				channels;
+	double				audioSec;
+	int					ret = -1;
+
+	/* Opening and probing the file is part of initialisation. */
+	start = nowNs();
+	if((stream = openStream(file)) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	format = formatName(stream);
+	switch(stream->type)
+	{
+		case FILE_TYPE_WAV:
+			setWav(&decoder);
+			break;
+
+		case FILE_TYPE_FLAC:
+			setFlac(&decoder);
+			break;
+
+		case FILE_TYPE_OPUS:
+			setOpus(&decoder);
+			break;
+
+		case FILE_TYPE_MP3:
+			setMp3(&decoder);
+			break;
+
+		case FILE_TYPE_VORBIS:
+			setVorbis(&decoder);
+			break;
+
+		case FILE_TYPE_SID:
+			setSid(&decoder);
+			break;
+
+		default:
+			fprintf(stderr, "%s: unsupported file.\n", file);
+			closeStream(stream);
+			return -1;
+	}
+
+	if((*decoder.init)(&decoder, stream) != 0)
+	{
+		fprintf(stderr, "%s: unable to initialise decoder.\n", file);
+		closeStream(stream);
+		return -1;
+	}
+	initNs = nowNs() - start;
+
+	rate = (*decoder.rate)(decoder.ctx);
+	channels = (*decoder.channels)(decoder.ctx);
+
+	if(decoder.getFileSamples == NULL)
+		limit = (uint64_t)ENDLESS_SECONDS * rate * channels;
+
+	if((buffer = malloc(decoder.buffSize * sizeof(int16_t))) == NULL)
+		goto out;
+
+	while(limit == 0 || samples < limit)
+	{
+		uint64_t read;
+
+		start = nowNs();
+		read = (*decoder.decode)(decoder.ctx, buffer);
+		start = nowNs() - start;
+
+		if(read == 0)
+			break;
+
+		decodeNs += start;
+		samples += read;
+
+		if(addTiming(&t, start) != 0)
+			goto out;
+	}
+
+	qsort(t.ns, t.len, sizeof(uint64_t), cmpNs);
+	getrusage(RUSAGE_SELF, &usage);
+	audioSec = (double)samples / (rate * channels);
+
+	printf("%s\n\t{\"file\": \"", first ? "" : ",");
+	for(const char* c = file; *c != '\0'; c++)
+	{
+		if(*c == '"' || *c == '\\')
+			putchar('\\');
+
+		putchar(*c);
+	}
+
+	printf("\", \"format\": \"%s\", \"rate\": %u, \"channels\": %u, "
+			"\"samples\": %llu, \"audio_sec\": %.3f, "
+			"\"samples_per_sec\": %.0f, \"realtime_factor\": %.2f, "
+			"\"init_us\": %.1f, \"decode_calls\": %zu, "
+			"\"decode_us\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+			"\"peak_rss_kb\": %ld}",
+			format, rate, channels,
+			(unsigned long long)samples, audioSec,
+			decodeNs ? samples * 1e9 / decodeNs : 0.0,
+			decodeNs ? audioSec * 1e9 / decodeNs : 0.0,
+			initNs / 1e3, t.len,
+			percentile(&t, 50) / 1e3, percentile(&t, 99) / 1e3,
+			t.len ? t.ns[t.len - 1] / 1e3 : 0.0,
+			usage.ru_maxrss);
+
+	ret = 0;
+
+out:
+	(*decoder.exit)(decoder.ctx);
+	free(buffer);
+	free(t.ns);
+	return ret;
+}
+
+/**
+ * Benchmark a file, or every file in a directory tree.
+ *
+ * \param	path	File or directory.
+ * \param	count	Number of files printed so far.
+ */
+static void benchPath(const char* path, unsigned* count)
+{
+	struct stat		st;
+	DIR*			dp;
+	struct dirent*	ep;
+
+	if(stat(path, &st) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	if(S_ISDIR(st.st_mode) == 0)
+	{
+		if(benchFile(path, *count == 0) == 0)
+			(*count)++;
+
+		return;
+	}
+
+	if((dp = opendir(path)) == NULL)
+		return;
+
+	while((ep = readdir(dp)) != NULL)
+	{
+		char file[PATH_MAX];
+
+		if(ep->d_name[0] == '.')
+			continue;
+
+		snprintf(file, sizeof(file), "%s/%s", path, ep->d_name);
+		benchPath(file, count);
+	}
+
+	closedir(dp);
+}
+
+/**
+ * Measure decoder performance over a corpus of files, printing results as a
+ * JSON array.
+ */
+int main(int argc, char *argv[])
+{
+	unsigned count = 0;
+
+	if(argc < 2)
+	{
+		puts("FILE or DIRECTORY is required.");
+		printf("%s FILE|DIRECTORY...\n", argv[0]);
+		return 0;
+	}
+
+	if(initMp3Library() != 0)
+	{
+		fputs("Unable to initialise MP3 library.\n", stderr);
+		return -1;
+	}
+
+	printf("[");
+	for(int i = 1; i < argc; i++)
+		benchPath(argv[i], &count);
+
+	printf("\n]\n");
+
+	exitMp3Library();
+	return count == 0 ? -1 : 0;
+}
+
+#else
+#pragma message ( "Benchmark ignored for 3DS build." )
+#endif
@@ -0,0 +1,275 @@
+/* For the GNU argument order of qsort_r(), in both glibc and newlib. */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "dir.h"
+
+/* Initial sizes of the string arena and entry array. */
+#define NAMES_INITIAL	4096
+#define ENTRIES_INITIAL	256
+
+/**
+ * Ensure an array has room for at least the given number of elements,
+ * doubling its capacity as required.
+ *
+ * \param	array	Array to grow.
+ * \param	cap		Capacity of array in elements.
+ * \param	need	Number of elements required.
+ * \param	size	Size of an element.
+ * \param	initial	Capacity of a new array.
+ * \return			0 on success, or -1 if out of memory.
+ */
+static int reserve(void** array, size_t* cap, size_t need, size_t size,
+		size_t initial)
+{
+	size_t	newCap = *cap == 0 ? initial : *cap;
+	void*	p;
+
+	if(need <= *cap)
+		return 0;
+
+	while(newCap < need)
+		newCap *= 2;
+
+	if((p = realloc(*array, newCap * size)) == NULL)
+		return -1;
+
+	*array = p;
+	*cap = newCap;
+	return 0;
+}
+
+/**
+ * Copy a string to the end of the arena.
+ *
+ * \return	Offset of the string in the arena, or -1 if out of memory.
+ */
+static int64_t addName(struct dirList_t* dirList, const char* name, size_t len)
+{
+	size_t off = dirList->namesLen;
+
+	if(reserve((void**)&dirList->names, &dirList->namesCap, off + len + 1,
+				sizeof(char), NAMES_INITIAL) != 0)
+		return -1;
+
+	memcpy(dirList->names + off, name, len);
+	dirList->names[off + len] = '\0';
+	dirList->namesLen += len + 1;
+	return off;
+}
+
+/**
+ * Order folders before files, and then by name ignoring case.
+ */
+static int cmpEntry(const void* p1, const void* p2, void* names)
+{
+	const struct dirEntry_t* a = p1;
+	const struct dirEntry_t* b = p2;
+
+	if(a->isDir != b->isDir)
+		return b->isDir - a->isDir;
+
+	return strcasecmp((const char*)names + a->name,
+			(const char*)names + b->name);
+}
+
+/**
+ * Start a new listing, replacing the previous one. Entries are then added
+ * with addDirEntry() and the listing completed with endDirList().
+ *
+ * \param	dirList	Listing, which must be zeroed before its first use.
+ * \param	path	Path of the listed directory.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int beginDirList(struct dirList_t* dirList, const char* path)
+{
+	/* Free the previous listing. The path is always first in the arena. */
+	dirList->namesLen = 0;
+	dirList->dirNum = dirList->fileNum = 0;
+	dirList->currentDir = "";
+
+	return addName(dirList, path, strlen(path)) < 0 ? -1 : 0;
+}
+
+/**
+ * Add an entry to a listing started with beginDirList().
+ *
+ * \param	name	Name of entry.
+ * \param	len		Length of name.
+ * \param	isDir	Entry is a folder.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int addDirEntry(struct dirList_t* dirList, const char* name, size_t len,
+		int isDir)
+{
+	size_t				n = dirList->dirNum + dirList->fileNum;
+	struct dirEntry_t*	entry;
+	int64_t				off;
+
+	if(reserve((void**)&dirList->entries, &dirList->entriesCap, n + 1,
+				sizeof(struct dirEntry_t), ENTRIES_INITIAL) != 0 ||
+			(off = addName(dirList, name, len)) < 0)
+		return -1;
+
+	entry = &dirList->entries[n];
+	entry->name = off;
+	entry->len = len;
+	entry->isDir = isDir != 0;
+
+	if(isDir)
+		dirList->dirNum++;
+	else
+		dirList->fileNum++;
+
+	return 0;
+}
+
+/**
+ * Complete a listing started with beginDirList().
+ *
+ * \param	sort	Sort entries, which is not needed if they were added in
+ *					order.
+ */
+void endDirList(struct dirList_t* dirList, int sort)
+{
+	if(sort)
+		qsort_r(dirList->entries, dirList->dirNum + dirList->fileNum,
+				sizeof(struct dirEntry_t), cmpEntry, dirList->names);
+
+	dirList->currentDir = dirList->namesLen != 0 ? dirList->names : "";
+}
+
+/**
+ * Read a directory, replacing the previous listing. Hidden entries, with
+ * names starting with '.', are skipped.
+ *
+ * \param	dirList	Listing to store entries in, which must be zeroed before
+ *					its first use.
+ * \param	path	Directory to read, or NULL for the current working
+ *					directory.
+ * \return			Number of entries, or -1 on failure with errno set.
+ */
+int readDirList(struct dirList_t* dirList, const char* path)
+{
+	DIR*			dp;
+	struct dirent*	ep;
+	char*			cwd = NULL;
+	int				ret;
+
+	if(path == NULL && (path = cwd = getcwd(NULL, 0)) == NULL)
+		path = "";
+
+	ret = beginDirList(dirList, path);
+	free(cwd);
+
+	if(ret != 0 || dirList->names[0] == '\0' ||
+			(dp = opendir(dirList->names)) == NULL)
+	{
+		endDirList(dirList, 0);
+		return -1;
+	}
+
+	while((ep = readdir(dp)) != NULL)
+	{
+		/* Skip hidden entries (names starting with '.') */
+		if(ep->d_name[0] == '.')
+			continue;
+
+		if((ret = addDirEntry(dirList, ep->d_name, strlen(ep->d_name),
+						ep->d_type == DT_DIR)) != 0)
+			break;
+	}
+
+	closedir(dp);
+	endDirList(dirList, 1);
+
+	return ret != 0 ? -1 : dirList->dirNum + dirList->fileNum;
+}
+
+/**
+ * Merge a sorted listing into another, keeping it sorted. Used to add
+ * entries read in the background as they arrive.
+ *
+ * \param	dirList	Sorted listing to add entries to.
+ * \param	add		Sorted listing of entries to add. Its path is not copied.
+ * \param	keep	Index of an entry of dirList, updated to the index of the
+ *					same entry once merged, or NULL.
+ * \return			0 on success, or -1 if out of memory.
+ */
+int mergeDirList(struct dirList_t* dirList, const struct dirList_t* add,
+		int* keep)
+{
+	size_t	i = dirList->dirNum + dirList->fileNum;
+	size_t	j = add->dirNum + add->fileNum;
+	size_t	k = i + j;
+	size_t	pathLen, base;
+	int		newKeep = keep != NULL ? *keep : -1;
+
+	if(j == 0)
+		return 0;
+
+	/* Names are appended after the path, which is first in the arena. */
+	pathLen = strlen(add->names) + 1;
+	if(reserve((void**)&dirList->entries, &dirList->entriesCap, k,
+				sizeof(struct dirEntry_t), ENTRIES_INITIAL) != 0 ||
+			reserve((void**)&dirList->names, &dirList->namesCap,
+				dirList->namesLen + add->namesLen - pathLen, sizeof(char),
+				NAMES_INITIAL) != 0)
+		return -1;
+
+	base = dirList->namesLen - pathLen;
+	memcpy(dirList->names + dirList->namesLen, add->names + pathLen,
+			add->namesLen - pathLen);
+	dirList->namesLen += add->namesLen - pathLen;
+
+	/* Merge from the end, so that entries are moved at most once. */
+	while(j > 0)
+	{
+		struct dirEntry_t e = add->entries[j - 1];
+
+		e.name += base;
+		if(i > 0 && cmpEntry(&dirList->entries[i - 1], &e,
+					dirList->names) > 0)
+		{
+			if((int)--i == newKeep && keep != NULL)
+				*keep = k - 1;
+
+			dirList->entries[--k] = dirList->entries[i];
+			continue;
+		}
+
+		dirList->entries[--k] = e;
+		j--;
+	}
+
+	dirList->dirNum += add->dirNum;
+	dirList->fileNum += add->fileNum;
+	dirList->currentDir = dirList->names;
+	return 0;
+}
+
+/**
+ * Get the name of an entry.
+ *
+ * \param	n	Entry, from 0 to dirNum + fileNum - 1. Folders come first.
+ * \return		Name of entry.
+ */
+const char* getDirEntryName(const struct dirList_t* dirList, int n)
+{
+	return dirList->names + dirList->entries[n].name;
+}
+
+/**
+ * Free memory used by a listing.
+ */
+void freeDirList(struct dirList_t* dirList)
+{
+	free(dirList->names);
+	free(dirList->entries);
+	memset(dirList, 0, sizeof(struct dirList_t));
+}
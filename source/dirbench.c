@@ -0,0 +1,206 @@
+#if defined __gnu_linux__
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir.h"
+
+/* Times each directory is read. The fastest time is reported. */
+#define RUNS	5
+
+/* One in this many entries is a folder. */
+#define DIR_EVERY	20
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmpstringp(const void *p1, const void *p2)
+{
+	return strcasecmp(* (char * const *) p1, * (char * const *) p2);
+}
+
+/**
+ * Read the current directory as ctrmus did before readDirList(): a realloc()
+ * and strdup() per entry, then another pass to count the entries.
+ *
+ * \return	Number of entries.
+ */
+static int readDirLegacy(void)
+{
+	DIR*			dp;
+	struct dirent*	ep;
+	char**			files = NULL;
+	char**			dirs = NULL;
+	int				fileNum = 0, dirNum = 0, count = 0;
+
+	if((dp = opendir(".")) == NULL)
+		return -1;
+
+	while((ep = readdir(dp)) != NULL)
+	{
+		if(ep->d_name[0] == '.')
+			continue;
+
+		if(ep->d_type == DT_DIR)
+		{
+			dirs = realloc(dirs, (dirNum + 1) * sizeof(char*));
+			dirs[dirNum++] = strdup(ep->d_name);
+			continue;
+		}
+
+		files = realloc(files, (fileNum + 1) * sizeof(char*));
+		files[fileNum++] = strdup(ep->d_name);
+	}
+
+	closedir(dp);
+	qsort(files, fileNum, sizeof(char*), cmpstringp);
+	qsort(dirs, dirNum, sizeof(char*), cmpstringp);
+
+	if((dp = opendir(".")) != NULL)
+	{
+		while((ep = readdir(dp)) != NULL)
+			count += ep->d_name[0] != '.';
+
+		closedir(dp);
+	}
+
+	for(int i = 0; i < fileNum; i++)
+		free(files[i]);
+
+	for(int i = 0; i < dirNum; i++)
+		free(dirs[i]);
+
+	free(files);
+	free(dirs);
+	return count;
+}
+
+/**
+ * Create a directory of synthetic entries, unless it already exists.
+ *
+ * \param	path	Directory to create.
+ * \param	entries	Number of entries.
+ * \return			0 on success, or -1 on failure.
+ */
+static int makeDir(const char* path, unsigned entries)
+{
+	char name[PATH_MAX];
+
+	if(mkdir(path, 0755) != 0)
+		return errno == EEXIST ? 0 : -1;
+
+	for(unsigned i = 0; i < entries; i++)
+	{
+		int fd;
+
+		if(i % DIR_EVERY == 0)
+		{
+			snprintf(name, sizeof(name), "%s/Album %06u", path, i);
+			if(mkdir(name, 0755) != 0)
+				return -1;
+
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "%s/%02u - Track number %06u.mp3",
+				path, i % 97, i);
+		if((fd = open(name, O_CREAT | O_WRONLY, 0644)) < 0)
+			return -1;
+
+		close(fd);
+	}
+
+	return 0;
+}
+
+/**
+ * Time reading a directory with both implementations, and print the results
+ * as a JSON object.
+ */
+static int benchDir(const char* path, unsigned entries, int first)
+{
+	struct dirList_t	dirList = { 0 };
+	uint64_t			arenaNs = UINT64_MAX, legacyNs = UINT64_MAX;
+	int					n = 0;
+
+	if(makeDir(path, entries) != 0 || chdir(path) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	for(int run = 0; run < RUNS; run++)
+	{
+		uint64_t start = nowNs();
+
+		if((n = readDirList(&dirList, NULL)) < 0)
+			break;
+
+		if((start = nowNs() - start) < arenaNs)
+			arenaNs = start;
+
+		start = nowNs();
+		readDirLegacy();
+		if((start = nowNs() - start) < legacyNs)
+			legacyNs = start;
+	}
+
+	printf("%s\n\t{\"entries\": %d, \"folders\": %d, \"arena_ms\": %.2f, "
+			"\"legacy_ms\": %.2f, \"speedup\": %.2f, \"arena_bytes\": %zu}",
+			first ? "" : ",", n, dirList.dirNum, arenaNs / 1e6,
+			legacyNs / 1e6, (double)legacyNs / arenaNs,
+			dirList.namesCap +
+			dirList.entriesCap * sizeof(struct dirEntry_t));
+
+	freeDirList(&dirList);
+	return chdir("..") != 0 || n < 0 ? -1 : 0;
+}
+
+/**
+ * Measure directory listing over synthetic directories of 10,000 and 100,000
+ * entries, printing results as a JSON array. The directories are created
+ * in the given folder and kept for later runs.
+ */
+int main(int argc, char *argv[])
+{
+	const unsigned	sizes[] = { 10000, 100000 };
+	const char*		root = argc > 1 ? argv[1] : "dirbench.tmp";
+	int				ret = 0;
+
+	if((mkdir(root, 0755) != 0 && errno != EEXIST) || chdir(root) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", root, strerror(errno));
+		return -1;
+	}
+
+	printf("[");
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		char path[16];
+
+		snprintf(path, sizeof(path), "%u", sizes[i]);
+		if(benchDir(path, sizes[i], i == 0) != 0)
+			ret = -1;
+	}
+
+	printf("\n]\n");
+	return ret;
+}
+
+#else
+#pragma message ( "Directory benchmark ignored for 3DS build." )
+#endif
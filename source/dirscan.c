@@ -0,0 +1,304 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dirscan.h"
+#include "platform.h"
+
+/* Entries read before the first are shown, which fills the screen. */
+#define CHUNK_MIN	32
+
+/* Time to wait for the UI to take the last chunk of a folder, in ns. */
+#define HANDOFF_WAIT_NS	(16 * 1000 * 1000)
+
+/*
+ * Scanner state. The scanner thread reads entries into fill. Once enough
+ * entries have been read, fill is sorted and swapped with ready, from which
+ * the UI thread merges them into its listing. As the merge is linear in the
+ * size of the listing, each chunk is at least half as large as the entries
+ * already handed over, so that the total time spent merging stays linear.
+ */
+static struct
+{
+	Thread				thread;
+	LightLock			lock;
+	LightEvent			event;
+	volatile bool		quit;
+
+	/* Set when the folder being read is no longer wanted. */
+	volatile bool		cancel;
+
+	/* Requested folder, and its identifier. Guarded by lock. */
+	char				path[PATH_MAX];
+	unsigned			id;
+	bool				pending;
+	volatile bool		scanning;
+
+	/* Chunk handed over to the UI thread. Guarded by lock. */
+	struct dirList_t	ready;
+	volatile bool		readyFull;
+	bool				readyDone;
+	int					readyErr;
+
+	/* Chunk being read. Only used by the scanner thread. */
+	struct dirList_t	fill;
+} scanner;
+
+/**
+ * Hand the entries read so far to the UI thread, unless it has not yet taken
+ * the previous chunk.
+ *
+ * \param	id		Identifier of folder being read.
+ * \param	done	All entries have been read.
+ * \param	err		Error number, or 0.
+ * \return			true if the entries were handed over, or are no longer
+ *					wanted.
+ */
+static bool handOff(unsigned id, bool done, int err)
+{
+	bool ret = true;
+
+	/* Sort before taking the lock, so the UI is only held up by the
+	 * swap. */
+	endDirList(&scanner.fill, 1);
+
+	LightLock_Lock(&scanner.lock);
+	if(id == scanner.id && scanner.readyFull == false)
+	{
+		struct dirList_t tmp = scanner.ready;
+
+		scanner.ready = scanner.fill;
+		scanner.fill = tmp;
+		scanner.readyFull = true;
+		scanner.readyDone = done;
+		scanner.readyErr = err;
+	}
+	else if(id == scanner.id)
+		ret = false;
+	LightLock_Unlock(&scanner.lock);
+
+	return ret;
+}
+
+/**
+ * Read a folder, handing entries to the UI thread in chunks.
+ *
+ * \param	path	Folder to read.
+ * \param	id		Identifier of request.
+ */
+static void scanDir(const char* path, unsigned id)
+{
+	DIR*			dp = NULL;
+	struct dirent*	ep;
+	int				handed = 0;
+	int				err = 0;
+
+	if(beginDirList(&scanner.fill, path) != 0)
+		err = ENOMEM;
+	else if((dp = opendir(path)) == NULL)
+		err = errno;
+
+	while(err == 0 && scanner.cancel == false && (ep = readdir(dp)) != NULL)
+	{
+		int n;
+
+		/* Skip hidden entries (names starting with '.') */
+		if(ep->d_name[0] == '.')
+			continue;
+
+		if(addDirEntry(&scanner.fill, ep->d_name, strlen(ep->d_name),
+					ep->d_type == DT_DIR) != 0)
+		{
+			err = ENOMEM;
+			break;
+		}
+
+		n = scanner.fill.dirNum + scanner.fill.fileNum;
+		if(n < CHUNK_MIN || n < handed / 2 || !handOff(id, false, 0))
+			continue;
+
+		handed += n;
+		beginDirList(&scanner.fill, path);
+	}
+
+	if(dp != NULL)
+		closedir(dp);
+
+	/* The last chunk is always handed over, so that the UI knows the folder
+	 * has been read. */
+	while(scanner.cancel == false && !handOff(id, true, err))
+		svcSleepThread(HANDOFF_WAIT_NS);
+}
+
+/**
+ * Scanner thread. Reads each requested folder.
+ */
+static void dirScanThread(void* arg)
+{
+	char		path[PATH_MAX];
+	unsigned	id;
+
+	(void)arg;
+
+	while(scanner.quit == false)
+	{
+		LightEvent_Wait(&scanner.event);
+
+		LightLock_Lock(&scanner.lock);
+		if(scanner.pending == false)
+		{
+			LightLock_Unlock(&scanner.lock);
+			continue;
+		}
+
+		memcpy(path, scanner.path, sizeof(path));
+		id = scanner.id;
+		scanner.pending = false;
+		scanner.cancel = false;
+		LightLock_Unlock(&scanner.lock);
+
+		scanDir(path, id);
+	}
+}
+
+/**
+ * Start the directory scanner thread, which reads folders in the background
+ * so that the UI is not blocked by large folders.
+ *
+ * \return	0 on success, or -1 on failure.
+ */
+int startDirScanner(void)
+{
+	s32 prio;
+
+	LightLock_Init(&scanner.lock);
+	LightEvent_Init(&scanner.event, RESET_ONESHOT);
+	scanner.quit = false;
+
+	/* Run below the UI, so that only its idle time is used. */
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	scanner.thread = threadCreate(dirScanThread, NULL, 16 * 1024, prio + 1,
+			-2, false);
+
+	return scanner.thread == NULL ? -1 : 0;
+}
+
+/**
+ * Stop the directory scanner thread.
+ */
+void exitDirScanner(void)
+{
+	if(scanner.thread == NULL)
+		return;
+
+	scanner.quit = true;
+	scanner.cancel = true;
+	LightEvent_Signal(&scanner.event);
+	threadJoin(scanner.thread, U64_MAX);
+	threadFree(scanner.thread);
+	scanner.thread = NULL;
+
+	freeDirList(&scanner.fill);
+	freeDirList(&scanner.ready);
+}
+
+/**
+ * Start reading a folder in the background, cancelling any folder being
+ * read. The listing is emptied, and entries are added to it by
+ * updateDirScan() as they are read.
+ *
+ * \param	dirList	Listing to add entries to.
+ * \param	path	Folder to read.
+ * \return			0 on success, or -1 if the scanner is not running.
+ */
+int requestDirScan(struct dirList_t* dirList, const char* path)
+{
+	if(scanner.thread == NULL ||
+			strlen(path) >= sizeof(scanner.path) ||
+			beginDirList(dirList, path) != 0)
+		return -1;
+
+	endDirList(dirList, 0);
+
+	LightLock_Lock(&scanner.lock);
+	strcpy(scanner.path, path);
+	scanner.id++;
+	scanner.pending = true;
+	scanner.scanning = true;
+	scanner.readyFull = false;
+	scanner.cancel = true;
+	LightLock_Unlock(&scanner.lock);
+
+	LightEvent_Signal(&scanner.event);
+	return 0;
+}
+
+/**
+ * Cancel reading a folder, such as when the user leaves it.
+ */
+void cancelDirScan(void)
+{
+	if(scanner.thread == NULL)
+		return;
+
+	LightLock_Lock(&scanner.lock);
+	scanner.id++;
+	scanner.pending = false;
+	scanner.scanning = false;
+	scanner.readyFull = false;
+	scanner.cancel = true;
+	LightLock_Unlock(&scanner.lock);
+}
+
+/**
+ * Add entries read since the last call to the listing passed to
+ * requestDirScan(), keeping it sorted.
+ *
+ * \param	dirList	Listing passed to requestDirScan().
+ * \param	keep	Index of an entry, such as the selected entry, updated to
+ *					the index of the same entry once entries are added. May
+ *					be NULL.
+ * \return			1 if entries were added, 0 if not, or -1 if the folder
+ *					could not be read.
+ */
+int updateDirScan(struct dirList_t* dirList, int* keep)
+{
+	int ret = 0;
+
+	if(scanner.thread == NULL || scanner.readyFull == false)
+		return 0;
+
+	LightLock_Lock(&scanner.lock);
+	if(scanner.readyFull == true)
+	{
+		ret = 1;
+		if(mergeDirList(dirList, &scanner.ready, keep) != 0)
+		{
+			errno = ENOMEM;
+			ret = -1;
+		}
+		else if(scanner.readyErr != 0)
+		{
+			errno = scanner.readyErr;
+			ret = -1;
+		}
+
+		if(scanner.readyDone == true)
+			scanner.scanning = false;
+
+		scanner.readyFull = false;
+	}
+	LightLock_Unlock(&scanner.lock);
+
+	return ret;
+}
+
+/**
+ * Whether a folder is still being read.
+ */
+bool isDirScanning(void)
+{
+	return scanner.scanning;
+}
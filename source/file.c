@@ -1,15 +1,15 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 
 #include "error.h"
 #include "file.h"
-#include "flac.h"
-#include "mp3.h"
-#include "opus.h"
-#include "vorbis.h"
-#include "wav.h"
-#include "sid.h"
+#include "mpeg.h"
+
+/* Consecutive MPEG audio frames that must be found for a file to be MP3. */
+#define MP3_SNIFF_FRAMES	3
 
 /**
  * Obtain file type string from file_types enum.
@@ -32,6 +32,209 @@ const char* fileToStr(enum file_types ft)
 	return file_types_str[ft];
 }
 
+/* Detector of a file type. Returns how certain it is that the start of a file
+ * is of its type, from 0 (not at all) to 100. */
+struct detector_t
+{
+	enum file_types	type;
+	int				(*score)(const struct probe_t* probe);
+};
+
+static int hasMagic(const struct probe_t* probe, size_t offset,
+		const char* magic)
+{
+	size_t len = strlen(magic);
+
+	return probe->len >= offset + len &&
+		memcmp(probe->data + offset, magic, len) == 0;
+}
+
+/**
+ * Check whether the first packet of an Ogg stream starts with a string.
+ */
+static int hasOggMagic(const struct probe_t* probe, const char* magic)
+{
+	size_t segments;
+
+	/* Ogg page header is 27 bytes, followed by the segment table. */
+	if(hasMagic(probe, 0, "OggS") == 0 || probe->len < 27)
+		return 0;
+
+	segments = probe->data[26];
+	return hasMagic(probe, 27 + segments, magic);
+}
+
+static int scoreWav(const struct probe_t* probe)
+{
+	if((hasMagic(probe, 0, "RIFF") || hasMagic(probe, 0, "RIFX") ||
+				hasMagic(probe, 0, "RF64")) && hasMagic(probe, 8, "WAVE"))
+		return 100;
+
+	/* Wave64 */
+	if(hasMagic(probe, 0, "riff"))
+		return 100;
+
+	if(hasMagic(probe, 0, "FORM") &&
+			(hasMagic(probe, 8, "AIFF") || hasMagic(probe, 8, "AIFC")))
+		return 100;
+
+	return 0;
+}
+
+static int scoreFlac(const struct probe_t* probe)
+{
+	if(hasMagic(probe, 0, "fLaC") || hasOggMagic(probe, "\x7F" "FLAC"))
+		return 100;
+
+	return 0;
+}
+
+static int scoreOpus(const struct probe_t* probe)
+{
+	return hasOggMagic(probe, "OpusHead") ? 100 : 0;
+}
+
+static int scoreVorbis(const struct probe_t* probe)
+{
+	return hasOggMagic(probe, "\x01" "vorbis") ? 100 : 0;
+}
+
+static int scoreSid(const struct probe_t* probe)
+{
+	if(hasMagic(probe, 0, "PSID") || hasMagic(probe, 0, "RSID"))
+		return 100;
+
+	return 0;
+}
+
+static int scoreMp3(const struct probe_t* probe)
+{
+	const uint8_t*	data = probe->data;
+	size_t			len = probe->len;
+	uint64_t		tag = getId3v2Size(data, len);
+
+	/* The block after a large ID3v2 tag was read separately. */
+	if(probe->framesLen > 0)
+	{
+		data = probe->frames;
+		len = probe->framesLen;
+		tag = 0;
+	}
+
+	/* Frames follow the ID3v2 tag, or padding or junk before them. */
+	for(uint64_t i = tag; i + 4 <= len; i++)
+	{
+		if(data[i] == 0xFF && checkMpegFrames(data + i, len - i,
+					MP3_SNIFF_FRAMES))
+			return 75;
+	}
+
+	return 0;
+}
+
+static const struct detector_t detectors[] = {
+	{ FILE_TYPE_WAV,	scoreWav },
+	{ FILE_TYPE_FLAC,	scoreFlac },
+	{ FILE_TYPE_OPUS,	scoreOpus },
+	{ FILE_TYPE_VORBIS,	scoreVorbis },
+	{ FILE_TYPE_SID,	scoreSid },
+	{ FILE_TYPE_MP3,	scoreMp3 }
+};
+
+/**
+ * Read the start of an opened file, and the block after its ID3v2 tag where
+ * the tag ends too late to check the MP3 frames after it.
+ *
+ * \param	f		File, positioned at its start. Its position is unknown
+ *					afterwards.
+ * \param	probe	Output start of file.
+ */
+void readProbe(FILE* f, struct probe_t* probe)
+{
+	uint64_t tag;
+
+	probe->len = fread(probe->data, 1, sizeof(probe->data), f);
+	probe->framesLen = 0;
+
+	tag = getId3v2Size(probe->data, probe->len);
+	if(tag > 0 && tag + MPEG_MAX_FRAME + 4 > probe->len &&
+			fseek(f, tag, SEEK_SET) == 0)
+		probe->framesLen = fread(probe->frames, 1, sizeof(probe->frames), f);
+}
+
+/**
+ * Read the start of a file.
+ *
+ * \param	file	File location.
+ * \param	probe	Output start of file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int probeFile(const char* file, struct probe_t* probe)
+{
+	FILE* f;
+
+	if((f = fopen(file, "rb")) == NULL)
+		return -1;
+
+	readProbe(f, probe);
+	fclose(f);
+
+	return 0;
+}
+
+/**
+ * Detect the type of a file from its start.
+ *
+ * \param	probe	Start of file.
+ * \return			file_types enum, or 0 if not supported.
+ */
+enum file_types probeType(const struct probe_t* probe)
+{
+	enum file_types	type = FILE_TYPE_ERROR;
+	int				best = 0;
+
+	for(size_t i = 0; i < sizeof(detectors) / sizeof(detectors[0]); i++)
+	{
+		int score = detectors[i].score(probe);
+
+		if(score > best)
+		{
+			best = score;
+			type = detectors[i].type;
+		}
+	}
+
+	return type;
+}
+
+/**
+ * Whether a file has the extension of files that commonly sit alongside
+ * music, such as cover art and rip logs, so that it may be passed over
+ * without being read. Other files are detected by their start as usual.
+ *
+ * \param	file	File location.
+ * \return			true if the file is not an audio file.
+ */
+bool hasOtherExtension(const char* file)
+{
+	static const char* const exts[] = {
+		".jpg", ".jpeg", ".png", ".gif", ".bmp", ".txt", ".nfo", ".log",
+		".cue", ".pdf", ".ini", ".db", ".lrc", ".sfv", ".md5", ".accurip"
+	};
+	const char* ext = strrchr(file, '.');
+
+	if(ext == NULL)
+		return false;
+
+	for(size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+	{
+		if(strcasecmp(ext, exts[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 /**
  * Obtains file type.
  *
@@ -40,75 +243,15 @@ const char* fileToStr(enum file_types ft)
  */
 enum file_types getFileType(const char *file)
 {
-	FILE* ftest = fopen(file, "rb");
-	uint32_t fileSig;
-	enum file_types file_type = FILE_TYPE_ERROR;
+	struct probe_t		probe;
+	enum file_types		file_type;
 
 	/* Failure opening file */
-	if(ftest == NULL)
+	if(probeFile(file, &probe) != 0)
 		return FILE_TYPE_ERROR;
 
-	if(fread(&fileSig, 4, 1, ftest) == 0)
-		goto err;
+	if((file_type = probeType(&probe)) == FILE_TYPE_ERROR)
+		errno = FILE_NOT_SUPPORTED;
 
-	switch(fileSig)
-	{
-		// "RIFF"
-		case 0x46464952:
-		// "riff"
-		case 0x66666972:
-		// "RIFX"
-		case 0x58464952:
-		// "RF64"
-		case 0x34364652:
-		// "FORM"
-		case 0x4D524F46:
-			file_type = FILE_TYPE_WAV;
-			break;
-
-		// "fLaC"
-		case 0x43614c66:
-			file_type = FILE_TYPE_FLAC;
-			break;
-
-		// "OggS"
-		case 0x5367674F:
-			if(isOpus(file) == 0)
-				file_type = FILE_TYPE_OPUS;
-			else if(isFlac(file) == 0)
-				file_type = FILE_TYPE_FLAC;
-			else if(isVorbis(file) == 0)
-				file_type = FILE_TYPE_VORBIS;
-			else
-				errno = FILE_NOT_SUPPORTED;
-
-			break;
-		
-		// "PSID" or "RSID"
-		case 0x44495350:
-		case 0x44495352:
-			file_type = FILE_TYPE_SID;
-			break;
-
-		default:
-			/*
-			 * MP3 without ID3 tag, ID3v1 tag is at the end of file, or MP3
-			 * with ID3 tag at the beginning  of the file.
-			 */
-			if(isMp3(file) == 0)
-			{
-				file_type = FILE_TYPE_MP3;
-				break;
-			}
-
-			/* TODO: Add this again at some point */
-			//printf("Unknown magic number: %#010x\n.", fileSig);
-			errno = FILE_NOT_SUPPORTED;
-			break;
-	}
-
-err:
-	fclose(ftest);
 	return file_type;
 }
-
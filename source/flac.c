@@ -1,18 +1,32 @@
+#include <stdlib.h>
+
 #define DR_FLAC_IMPLEMENTATION
 #include <dr_libs/dr_flac.h>
 
 #include "flac.h"
 #include "playback.h"
+#include "seekindex.h"
+#include "stream.h"
+
+struct flac_t
+{
+	drflac*				pFlac;
+	struct stream_t*	stream;
+
+	/* Seek index once loaded, and the seek table made from it. */
+	struct seekIndex_t*	index;
+	drflac_seekpoint*	seekpoints;
+};
 
-static drflac*		pFlac;
 static const size_t	buffSize = 16 * 1024;
 
-static int initFlac(const char* file);
-static uint32_t rateFlac(void);
-static uint8_t channelFlac(void);
-static uint64_t decodeFlac(void* buffer);
-static void exitFlac(void);
-static size_t getFileSamplesFlac(void);
+static int initFlac(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateFlac(void* ctx);
+static uint8_t channelFlac(void* ctx);
+static uint64_t decodeFlac(void* ctx, void* buffer);
+static void exitFlac(void* ctx);
+static size_t getFileSamplesFlac(void* ctx);
+static int seekFlac(void* ctx, uint64_t frame);
 
 /**
  * Set decoder parameters for flac.
@@ -28,34 +42,128 @@ void setFlac(struct decoder_fn* decoder)
 	decoder->decode = &decodeFlac;
 	decoder->exit = &exitFlac;
 	decoder->getFileSamples = &getFileSamplesFlac;
+	decoder->seek = &seekFlac;
+	decoder->ctx = NULL;
+}
+
+static size_t onReadFlac(void* pUserData, void* pBufferOut,
+		size_t bytesToRead)
+{
+	return readStream(pUserData, pBufferOut, bytesToRead);
+}
+
+static drflac_bool32 onSeekFlac(void* pUserData, int offset,
+		drflac_seek_origin origin)
+{
+#if DR_FLAC_VERSION_MINOR >= 13
+	int whence = origin == DRFLAC_SEEK_SET ? SEEK_SET :
+		origin == DRFLAC_SEEK_END ? SEEK_END : SEEK_CUR;
+#else
+	int whence = origin == drflac_seek_origin_start ? SEEK_SET : SEEK_CUR;
+#endif
+
+	return seekStream(pUserData, offset, whence) == 0;
 }
 
+#if DR_FLAC_VERSION_MINOR >= 13
+static drflac_bool32 onTellFlac(void* pUserData, drflac_int64* pCursor)
+{
+	*pCursor = tellStream(pUserData);
+	return DRFLAC_TRUE;
+}
+#endif
+
 /**
  * Initialise Flac decoder.
  *
- * \param	file	Location of flac file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened flac file, which is closed by exitFlac().
  * \return			0 on success, else failure.
  */
-static int initFlac(const char* file)
+static int initFlac(struct decoder_fn* decoder, struct stream_t* stream)
 {
-	pFlac = drflac_open_file(file, NULL);
+	struct flac_t* flac = calloc(1, sizeof(struct flac_t));
+
+	if(flac == NULL)
+		return -1;
+
+#if DR_FLAC_VERSION_MINOR >= 13
+	flac->pFlac = drflac_open(onReadFlac, onSeekFlac, onTellFlac, stream, NULL);
+#else
+	flac->pFlac = drflac_open(onReadFlac, onSeekFlac, stream, NULL);
+#endif
+	if(flac->pFlac == NULL)
+	{
+		free(flac);
+		return -1;
+	}
 
-	return pFlac == NULL ? -1 : 0;
+	flac->stream = stream;
+	decoder->ctx = flac;
+
+	/* Without a seek table, dr_flac searches the file to seek. */
+	if(flac->pFlac->seekpointCount == 0)
+		queueSeekIndex(stream);
+
+	return 0;
 }
 
-static size_t getFileSamplesFlac(void)
+static size_t getFileSamplesFlac(void* ctx)
 {
+	drflac* pFlac = ((struct flac_t*)ctx)->pFlac;
 	return pFlac->totalPCMFrameCount * (size_t)pFlac->channels;
 }
 
+/**
+ * Give dr_flac a seek table made from the seek index of a file that has none.
+ */
+static void setSeekTable(struct flac_t* flac)
+{
+	drflac*						pFlac = flac->pFlac;
+	const struct seekIndex_t*	index = flac->index;
+
+	if(index->count == 0 || (flac->seekpoints =
+				malloc(index->count * sizeof(drflac_seekpoint))) == NULL)
+		return;
+
+	/* dr_flac only checks that the samples in each frame are plausible. */
+	for(uint32_t i = 0; i < index->count; i++)
+	{
+		flac->seekpoints[i].firstPCMFrame = index->points[i].sample;
+		flac->seekpoints[i].flacFrameOffset = index->points[i].offset -
+			pFlac->firstFLACFramePosInBytes;
+		flac->seekpoints[i].pcmFrameCount = pFlac->maxBlockSizeInPCMFrames;
+	}
+
+	pFlac->pSeekpoints = flac->seekpoints;
+	pFlac->seekpointCount = index->count;
+}
+
+/**
+ * Seek to a sample of Flac file.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, else failure.
+ */
+static int seekFlac(void* ctx, uint64_t frame)
+{
+	struct flac_t* flac = ctx;
+
+	if(flac->index == NULL && flac->pFlac->seekpointCount == 0 &&
+			(flac->index = loadSeekIndex(flac->stream)) != NULL)
+		setSeekTable(flac);
+
+	return drflac_seek_to_pcm_frame(flac->pFlac, frame) ? 0 : -1;
+}
+
 /**
  * Get sampling rate of Flac file.
  *
  * \return	Sampling rate.
  */
-static uint32_t rateFlac(void)
+static uint32_t rateFlac(void* ctx)
 {
-	return pFlac->sampleRate;
+	return ((struct flac_t*)ctx)->pFlac->sampleRate;
 }
 
 /**
@@ -63,9 +171,9 @@ static uint32_t rateFlac(void)
  *
  * \return	Number of channels for opened file.
  */
-static uint8_t channelFlac(void)
+static uint8_t channelFlac(void* ctx)
 {
-	return pFlac->channels;
+	return ((struct flac_t*)ctx)->pFlac->channels;
 }
 
 /**
@@ -74,8 +182,9 @@ static uint8_t channelFlac(void)
  * \param buffer	Decoded output.
  * \return			Samples read for each channel.
  */
-static uint64_t decodeFlac(void* buffer)
+static uint64_t decodeFlac(void* ctx, void* buffer)
 {
+	drflac* pFlac = ((struct flac_t*)ctx)->pFlac;
 	size_t buffSizeFrames;
 	uint64_t samplesRead;
 
@@ -88,25 +197,13 @@ static uint64_t decodeFlac(void* buffer)
 /**
  * Free Flac decoder.
  */
-static void exitFlac(void)
-{
-	drflac_close(pFlac);
-}
-
-/**
- * Checks if the input file is Flac
- *
- * \param in	Input file.
- * \return		0 if Flac file, else not or failure.
- */
-int isFlac(const char* in)
+static void exitFlac(void* ctx)
 {
-	int err = -1;
-	drflac* pFlac = drflac_open_file(in, NULL);
-
-	if(pFlac != NULL)
-		err = 0;
+	struct flac_t* flac = ctx;
 
-	drflac_close(pFlac);
-	return err;
+	drflac_close(flac->pFlac);
+	closeStream(flac->stream);
+	free(flac->seekpoints);
+	free(flac->index);
+	free(flac);
 }
@@ -0,0 +1,995 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "library.h"
+#include "platform.h"
+#include "playback.h"
+#include "stream.h"
+#include "tags.h"
+
+/* Identifies an index file. */
+#define LIBRARY_MAGIC		"CTML"
+
+/* Deepest folder that is indexed below the root folder. */
+#define LIBRARY_MAX_DEPTH	32
+
+/* Initial sizes of the entries and strings of a library being scanned. */
+#define ENTRIES_INITIAL		1024
+#define STRINGS_INITIAL		(32 * 1024)
+
+/* Header of an index file, followed by the entries and then the strings. */
+struct libHeader_t
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	entrySize;
+	uint32_t	count;
+	uint32_t	stringsLen;
+	uint32_t	reserved;
+};
+
+/* State of a scan. */
+struct scan_t
+{
+	struct library_t*		lib;
+	const struct library_t*	old;
+	volatile bool*			abort;
+
+	/* Path of the folder being scanned. */
+	char					path[PATH_MAX];
+	size_t					pathLen;
+
+	/* Listing of the folder being scanned, reused for every folder. */
+	struct dirList_t		dirList;
+};
+
+/* Library shared with the UI, updated by the scan thread. */
+static struct
+{
+	Thread				thread;
+	LightLock			lock;
+	struct library_t	lib;
+	volatile unsigned	gen;
+	volatile bool		abort;
+
+	char				root[PATH_MAX];
+	char				file[PATH_MAX];
+} shared;
+
+/**
+ * Ensure an array has room for at least the given number of elements,
+ * doubling its capacity as required.
+ *
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int reserve(void** array, uint32_t* cap, size_t need, size_t size,
+		uint32_t initial)
+{
+	size_t	newCap = *cap == 0 ? initial : *cap;
+	void*	p;
+
+	if(need <= *cap)
+		return 0;
+
+	while(newCap < need)
+		newCap *= 2;
+
+	if(newCap >= LIBRARY_NONE || (p = realloc(*array, newCap * size)) == NULL)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	*array = p;
+	*cap = newCap;
+	return 0;
+}
+
+/**
+ * Copy a string to the end of the strings of a library.
+ *
+ * \return	Offset of string, or LIBRARY_NONE if out of memory.
+ */
+static uint32_t addString(struct library_t* lib, const char* str)
+{
+	size_t		len = strlen(str) + 1;
+	uint32_t	off = lib->stringsLen;
+
+	if(reserve((void**)&lib->strings, &lib->stringsCap,
+				(size_t)off + len, sizeof(char), STRINGS_INITIAL) != 0)
+		return LIBRARY_NONE;
+
+	memcpy(lib->strings + off, str, len);
+	lib->stringsLen += len;
+	return off;
+}
+
+/**
+ * Copy a string from another library.
+ *
+ * \return	Offset of string, or LIBRARY_NONE if off is LIBRARY_NONE.
+ */
+static uint32_t copyString(struct library_t* lib,
+		const struct library_t* from, uint32_t off)
+{
+	if(off == LIBRARY_NONE)
+		return LIBRARY_NONE;
+
+	return addString(lib, from->strings + off);
+}
+
+/**
+ * Get a name or tag.
+ *
+ * \param	off	Offset of string.
+ * \return		String, or NULL if off is LIBRARY_NONE.
+ */
+const char* getLibraryString(const struct library_t* lib, uint32_t off)
+{
+	return off == LIBRARY_NONE ? NULL : lib->strings + off;
+}
+
+/**
+ * Check that the offsets and indexes of a loaded index are in range, so
+ * that a corrupt file can't cause reads outside of it.
+ */
+static int checkLibrary(const struct library_t* lib)
+{
+	if(lib->count == 0 || lib->stringsLen == 0 ||
+			lib->strings[lib->stringsLen - 1] != '\0')
+		return -1;
+
+	for(uint32_t i = 0; i < lib->count; i++)
+	{
+		const struct libEntry_t* e = &lib->entries[i];
+		const uint32_t tags[] = { e->title, e->artist, e->album };
+
+		if(e->name >= lib->stringsLen ||
+				(i == 0) != (e->parent == LIBRARY_NONE) ||
+				(i != 0 && e->parent >= i))
+			return -1;
+
+		for(int t = 0; t < 3; t++)
+		{
+			if(tags[t] != LIBRARY_NONE && tags[t] >= lib->stringsLen)
+				return -1;
+		}
+
+		/* Children always follow their folder. */
+		if(e->type == LIBRARY_TYPE_DIR && e->count != 0 &&
+				(e->first <= i || e->first > lib->count ||
+				 e->count > lib->count - e->first))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Load an index file with a single read.
+ *
+ * \param	lib		Output library.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int loadLibrary(struct library_t* lib, const char* file)
+{
+	struct libHeader_t*	header;
+	struct stat			st;
+	FILE*				f;
+	size_t				size;
+	size_t				read;
+
+	memset(lib, 0, sizeof(struct library_t));
+
+	if((f = fopen(file, "rb")) == NULL)
+		return -1;
+
+	if(fstat(fileno(f), &st) != 0 ||
+			st.st_size < (off_t)sizeof(struct libHeader_t) ||
+			(lib->block = malloc(size = st.st_size)) == NULL)
+	{
+		fclose(f);
+		return -1;
+	}
+
+	read = fread(lib->block, 1, size, f);
+	fclose(f);
+
+	header = lib->block;
+	if(read != size ||
+			memcmp(header->magic, LIBRARY_MAGIC, 4) != 0 ||
+			header->version != LIBRARY_VERSION ||
+			header->entrySize != sizeof(struct libEntry_t) ||
+			header->count > (size - sizeof(struct libHeader_t)) /
+				sizeof(struct libEntry_t) ||
+			size != sizeof(struct libHeader_t) +
+				header->count * sizeof(struct libEntry_t) +
+				header->stringsLen)
+		goto err;
+
+	lib->entries = (struct libEntry_t*)(header + 1);
+	lib->count = header->count;
+	lib->strings = (char*)(lib->entries + lib->count);
+	lib->stringsLen = header->stringsLen;
+
+	if(checkLibrary(lib) != 0)
+		goto err;
+
+	return 0;
+
+err:
+	free(lib->block);
+	memset(lib, 0, sizeof(struct library_t));
+	errno = EILSEQ;
+	return -1;
+}
+
+/**
+ * Write an index file. The previous file is only replaced once the new one
+ * has been written.
+ *
+ * \param	lib		Library to write.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure with errno set.
+ */
+int saveLibrary(const struct library_t* lib, const char* file)
+{
+	struct libHeader_t	header = { LIBRARY_MAGIC, LIBRARY_VERSION,
+		sizeof(struct libEntry_t), lib->count, lib->stringsLen, 0 };
+	char				tmp[PATH_MAX];
+	FILE*				f;
+	int					err;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if((f = fopen(tmp, "wb")) == NULL)
+		return -1;
+
+	err = fwrite(&header, sizeof(header), 1, f) != 1 ||
+		fwrite(lib->entries, sizeof(struct libEntry_t), lib->count, f) !=
+			lib->count ||
+		fwrite(lib->strings, 1, lib->stringsLen, f) != lib->stringsLen;
+
+	if(fclose(f) != 0 || err)
+	{
+		remove(tmp);
+		return -1;
+	}
+
+	/* Renaming over an existing file fails on FAT. */
+	remove(file);
+	return rename(tmp, file);
+}
+
+/**
+ * Free a library.
+ */
+void freeLibrary(struct library_t* lib)
+{
+	if(lib->block != NULL)
+		free(lib->block);
+	else
+	{
+		free(lib->entries);
+		free(lib->strings);
+	}
+
+	memset(lib, 0, sizeof(struct library_t));
+}
+
+/**
+ * Compare an entry with a name in the order of dirList_t.
+ */
+static int cmpEntry(const struct library_t* lib, uint32_t i, bool isDir,
+		const char* name)
+{
+	bool entryIsDir = lib->entries[i].type == LIBRARY_TYPE_DIR;
+
+	if(entryIsDir != isDir)
+		return isDir - entryIsDir;
+
+	return strcasecmp(lib->strings + lib->entries[i].name, name);
+}
+
+/**
+ * Find a child of a folder.
+ *
+ * \param	dir		Index of folder, or LIBRARY_NONE.
+ * \param	isDir	Child is a folder.
+ * \param	name	Name of child.
+ * \return			Index of child, or LIBRARY_NONE if not found.
+ */
+static uint32_t findChild(const struct library_t* lib, uint32_t dir,
+		bool isDir, const char* name)
+{
+	uint32_t lo, hi;
+
+	if(lib == NULL || dir == LIBRARY_NONE)
+		return LIBRARY_NONE;
+
+	lo = lib->entries[dir].first;
+	hi = lo + lib->entries[dir].count;
+
+	while(lo < hi)
+	{
+		uint32_t	mid = lo + (hi - lo) / 2;
+		int			cmp = cmpEntry(lib, mid, isDir, name);
+
+		if(cmp == 0)
+		{
+			/* Names that only differ by case are distinct on some file
+			 * systems. */
+			return strcmp(lib->strings + lib->entries[mid].name, name) == 0 ?
+				mid : LIBRARY_NONE;
+		}
+
+		if(cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return LIBRARY_NONE;
+}
+
+/**
+ * Find the entry of a folder.
+ *
+ * \param	path	Full path of folder.
+ * \return			Index of entry, or LIBRARY_NONE if the folder is not in the
+ *					library.
+ */
+uint32_t findLibraryDir(const struct library_t* lib, const char* path)
+{
+	const char*	root;
+	size_t		len;
+	uint32_t	dir = 0;
+
+	if(lib->count == 0)
+		return LIBRARY_NONE;
+
+	root = lib->strings + lib->entries[0].name;
+	len = strlen(root);
+
+	/* Trailing separators are ignored. */
+	while(len > 1 && root[len - 1] == '/' && root[len - 2] != ':')
+		len--;
+
+	if(strncmp(path, root, len) != 0 ||
+			(path[len] != '/' && path[len] != '\0' && root[len - 1] != '/'))
+		return LIBRARY_NONE;
+
+	path += len;
+	while(dir != LIBRARY_NONE && *path != '\0')
+	{
+		char	name[NAME_MAX + 1];
+		size_t	n;
+
+		while(*path == '/')
+			path++;
+
+		if((n = strcspn(path, "/")) == 0)
+			break;
+
+		if(n >= sizeof(name))
+			return LIBRARY_NONE;
+
+		memcpy(name, path, n);
+		name[n] = '\0';
+		path += n;
+
+		dir = findChild(lib, dir, true, name);
+	}
+
+	return dir;
+}
+
+/**
+ * Store a tag in the strings of a library.
+ *
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int addTag(struct library_t* lib, uint32_t* off, const char* tag)
+{
+	if(tag[0] == '\0')
+		return 0;
+
+	return (*off = addString(lib, tag)) == LIBRARY_NONE ? -1 : 0;
+}
+
+/**
+ * Detect the type, tags, duration and format of a file.
+ *
+ * \param	lib		Library to store tags in.
+ * \param	e		Entry to store information in.
+ * \param	path	File.
+ * \return			0 on success, or -1 if out of memory.
+ */
+static int probeEntry(struct library_t* lib, struct libEntry_t* e,
+		const char* path)
+{
+	struct decoder_fn	decoder;
+	struct stream_t*	stream;
+	struct tags_t		tags;
+	enum file_types		type;
+
+	if((stream = openStream(path)) == NULL)
+		return 0;
+
+	e->type = stream->type;
+
+	if(readTags(stream, &tags) == 0)
+	{
+		e->track = tags.track;
+		if(addTag(lib, &e->title, tags.title) != 0 ||
+				addTag(lib, &e->artist, tags.artist) != 0 ||
+				addTag(lib, &e->album, tags.album) != 0)
+		{
+			closeStream(stream);
+			return -1;
+		}
+	}
+
+	/* Only one SID tune may be open, which may be playing. */
+	if(stream->type == FILE_TYPE_ERROR || stream->type == FILE_TYPE_SID ||
+			seekStream(stream, 0, SEEK_SET) != 0)
+	{
+		closeStream(stream);
+		return 0;
+	}
+
+	if(openDecoder(&decoder, stream, &type) != 0)
+		return 0;
+
+	e->rate = (*decoder.rate)(decoder.ctx);
+	e->channels = (*decoder.channels)(decoder.ctx);
+
+	if(decoder.getFileSamples != NULL && e->rate != 0)
+		e->durationMs = (uint64_t)(*decoder.getFileSamples)(decoder.ctx) *
+			1000 / e->rate / e->channels;
+
+	(*decoder.exit)(decoder.ctx);
+	return 0;
+}
+
+/**
+ * Index the children of a folder, and then each of its subfolders.
+ *
+ * \param	dir		Index of folder, whose path is scan->path.
+ * \param	oldDir	Index of the folder in the previous index, or LIBRARY_NONE.
+ * \param	depth	Depth of folder below the root folder.
+ * \return			0 on success, or -1 on failure or if aborted.
+ */
+static int scanDir(struct scan_t* scan, uint32_t dir, uint32_t oldDir,
+		unsigned depth)
+{
+	struct library_t*	lib = scan->lib;
+	size_t				pathLen = scan->pathLen;
+	const char*			sep = "/";
+	uint32_t			first = lib->count;
+	uint32_t			n;
+
+	if(pathLen > 0 && scan->path[pathLen - 1] == '/')
+		sep = "";
+
+	/* A folder that can't be read is indexed as empty. */
+	if(readDirList(&scan->dirList, scan->path) < 0)
+		return 0;
+
+	n = scan->dirList.dirNum + scan->dirList.fileNum;
+	if(reserve((void**)&lib->entries, &lib->cap, (size_t)first + n,
+				sizeof(struct libEntry_t), ENTRIES_INITIAL) != 0)
+		return -1;
+
+	lib->entries[dir].first = first;
+	lib->entries[dir].count = n;
+
+	for(uint32_t i = 0; i < n; i++)
+	{
+		const char*			name = getDirEntryName(&scan->dirList, i);
+		bool				isDir = scan->dirList.entries[i].isDir;
+		struct libEntry_t*	e = &lib->entries[first + i];
+		uint32_t			old;
+		struct stat			st;
+
+		if(scan->abort != NULL && *scan->abort == true)
+			return -1;
+
+		memset(e, 0, sizeof(struct libEntry_t));
+		e->parent = dir;
+		e->type = isDir ? LIBRARY_TYPE_DIR : FILE_TYPE_ERROR;
+		e->title = e->artist = e->album = LIBRARY_NONE;
+		lib->count++;
+
+		if((e->name = addString(lib, name)) == LIBRARY_NONE)
+			return -1;
+
+		if(isDir)
+			continue;
+
+		if(snprintf(scan->path + pathLen, sizeof(scan->path) - pathLen,
+					"%s%s", sep, name) >= (int)(sizeof(scan->path) - pathLen)
+				|| stat(scan->path, &st) != 0)
+			continue;
+
+		e->size = st.st_size;
+		e->mtime = getFileMtime(scan->path);
+
+		/* Files that haven't changed are not opened again. */
+		old = findChild(scan->old, oldDir, false, name);
+		if(old != LIBRARY_NONE && scan->old->entries[old].size == e->size &&
+				scan->old->entries[old].mtime == e->mtime)
+		{
+			const struct libEntry_t* o = &scan->old->entries[old];
+
+			e->type = o->type;
+			e->durationMs = o->durationMs;
+			e->rate = o->rate;
+			e->channels = o->channels;
+			e->track = o->track;
+
+			/* Strings may be moved as they are added. */
+			if((e->title = copyString(lib, scan->old, o->title)) ==
+						LIBRARY_NONE && o->title != LIBRARY_NONE)
+				return -1;
+
+			e = &lib->entries[first + i];
+			if((e->artist = copyString(lib, scan->old, o->artist)) ==
+						LIBRARY_NONE && o->artist != LIBRARY_NONE)
+				return -1;
+
+			e = &lib->entries[first + i];
+			if((e->album = copyString(lib, scan->old, o->album)) ==
+						LIBRARY_NONE && o->album != LIBRARY_NONE)
+				return -1;
+
+			continue;
+		}
+
+		if(probeEntry(lib, e, scan->path) != 0)
+			return -1;
+	}
+
+	if(depth == LIBRARY_MAX_DEPTH)
+		return 0;
+
+	/* The listing is reused, so subfolders are found from the index. */
+	for(uint32_t i = first; i < first + n; i++)
+	{
+		const char* name;
+		int ret;
+
+		if(lib->entries[i].type != LIBRARY_TYPE_DIR)
+			break;
+
+		name = lib->strings + lib->entries[i].name;
+		if(snprintf(scan->path + pathLen, sizeof(scan->path) - pathLen,
+					"%s%s", sep, name) >= (int)(sizeof(scan->path) - pathLen))
+			continue;
+
+		scan->pathLen = pathLen + strlen(scan->path + pathLen);
+		ret = scanDir(scan, i, findChild(scan->old, oldDir, true, name),
+				depth + 1);
+		scan->pathLen = pathLen;
+		scan->path[pathLen] = '\0';
+
+		if(ret != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Index every folder and file below a root folder. Files that have the same
+ * size and modification time as in a previous index keep their information
+ * from it. Other files are opened to detect their type and duration.
+ *
+ * \param	lib		Output library, which must be zeroed.
+ * \param	old		Previous index of the same root folder, or NULL.
+ * \param	root	Root folder.
+ * \param	abort	Stop scanning once this is true, or NULL.
+ * \return			0 on success, or -1 on failure or if aborted.
+ */
+int scanLibrary(struct library_t* lib, const struct library_t* old,
+		const char* root, volatile bool* abort)
+{
+	struct scan_t*		scan;
+	struct libEntry_t*	e;
+	int					ret = -1;
+
+	if((scan = calloc(1, sizeof(struct scan_t))) == NULL)
+		return -1;
+
+	if(old != NULL && (old->count == 0 ||
+				strcmp(old->strings + old->entries[0].name, root) != 0))
+		old = NULL;
+
+	scan->lib = lib;
+	scan->old = old;
+	scan->abort = abort;
+	scan->pathLen = snprintf(scan->path, sizeof(scan->path), "%s", root);
+
+	if(scan->pathLen >= sizeof(scan->path) ||
+			reserve((void**)&lib->entries, &lib->cap, 1,
+				sizeof(struct libEntry_t), ENTRIES_INITIAL) != 0)
+		goto out;
+
+	e = &lib->entries[0];
+	memset(e, 0, sizeof(struct libEntry_t));
+	e->parent = LIBRARY_NONE;
+	e->type = LIBRARY_TYPE_DIR;
+	e->title = e->artist = e->album = LIBRARY_NONE;
+	lib->count = 1;
+
+	if((e->name = addString(lib, root)) == LIBRARY_NONE)
+		goto out;
+
+	ret = scanDir(scan, 0, old != NULL ? 0 : LIBRARY_NONE, 0);
+
+out:
+	freeDirList(&scan->dirList);
+	free(scan);
+
+	if(ret != 0)
+		freeLibrary(lib);
+
+	return ret;
+}
+
+/**
+ * Scan thread. Replaces the shared library once the scan completes.
+ */
+static void libraryThread(void* arg)
+{
+	struct library_t lib = { 0 };
+
+	(void)arg;
+
+	if(scanLibrary(&lib, &shared.lib, shared.root, &shared.abort) != 0)
+		return;
+
+	saveLibrary(&lib, shared.file);
+
+	LightLock_Lock(&shared.lock);
+	freeLibrary(&shared.lib);
+	shared.lib = lib;
+	shared.gen++;
+	LightLock_Unlock(&shared.lock);
+}
+
+/**
+ * Load the index of a root folder and update it on a background thread.
+ * The updated index is written back to the index file.
+ *
+ * \param	root	Root folder.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure.
+ */
+int startLibrary(const char* root, const char* file)
+{
+	LightLock_Init(&shared.lock);
+
+	if(snprintf(shared.root, sizeof(shared.root), "%s", root) >=
+				(int)sizeof(shared.root) ||
+			snprintf(shared.file, sizeof(shared.file), "%s", file) >=
+				(int)sizeof(shared.file))
+		return -1;
+
+	shared.abort = false;
+	shared.gen = 0;
+
+	/* An index of another root folder is of no use. */
+	if(loadLibrary(&shared.lib, file) == 0 &&
+			strcmp(shared.lib.strings + shared.lib.entries[0].name,
+				root) != 0)
+		freeLibrary(&shared.lib);
+
+	/* Scan at the lowest priority, so as not to delay the UI or playback. */
+	shared.thread = threadCreate(libraryThread, NULL, 64 * 1024, 0x3F, -2,
+			false);
+
+	return shared.thread == NULL ? -1 : 0;
+}
+
+/**
+ * List a folder from the index.
+ *
+ * \param	path	Full path of folder.
+ * \param	dirList	Output listing.
+ * \return			Number of entries, or -1 if the folder is not indexed.
+ */
+int getLibraryDirList(const char* path, struct dirList_t* dirList)
+{
+	const struct library_t*	lib = &shared.lib;
+	uint32_t				dir;
+	int						ret = -1;
+
+	/* The library may not have been started. */
+	if(shared.file[0] == '\0')
+		return -1;
+
+	LightLock_Lock(&shared.lock);
+	if((dir = findLibraryDir(lib, path)) == LIBRARY_NONE ||
+			beginDirList(dirList, path) != 0)
+		goto out;
+
+	for(uint32_t i = lib->entries[dir].first;
+			i < lib->entries[dir].first + lib->entries[dir].count; i++)
+	{
+		const char* name = lib->strings + lib->entries[i].name;
+
+		if(addDirEntry(dirList, name, strlen(name),
+					lib->entries[i].type == LIBRARY_TYPE_DIR) != 0)
+			goto out;
+	}
+
+	ret = dirList->dirNum + dirList->fileNum;
+
+out:
+	/* Entries are already in order. */
+	endDirList(dirList, 0);
+	LightLock_Unlock(&shared.lock);
+	return ret;
+}
+
+/**
+ * Find the entry of a file.
+ *
+ * \param	file	Full path of file.
+ * \return			Index of entry, or LIBRARY_NONE if the file is not in the
+ *					library.
+ */
+static uint32_t findFile(const struct library_t* lib, const char* file)
+{
+	const char*	name = strrchr(file, '/');
+	char		dir[PATH_MAX];
+
+	if(lib->count == 0 || name == NULL ||
+			(size_t)(name - file) >= sizeof(dir))
+		return LIBRARY_NONE;
+
+	/* The root folder may end with a separator, such as "sdmc:/". */
+	memcpy(dir, file, name - file);
+	dir[name - file] = '\0';
+	if(dir[0] == '\0' || dir[name - file - 1] == ':')
+		strcpy(dir + (name - file), "/");
+
+	return findChild(lib, findLibraryDir(lib, dir), false, name + 1);
+}
+
+/**
+ * Find the end of the entries below a folder. The children of a folder are
+ * added before those of its subfolders, and the children of each subfolder
+ * before those of the next, so the entries below a folder are contiguous
+ * and end with those below its last subfolder that was read.
+ *
+ * \param	dir	Index of folder.
+ * \return		Index after the last entry below the folder.
+ */
+static uint32_t findTreeEnd(const struct library_t* lib, uint32_t dir)
+{
+	while(true)
+	{
+		const struct libEntry_t*	e = &lib->entries[dir];
+		uint32_t					last = LIBRARY_NONE;
+
+		/* Folders are listed first. Those that were not read have no
+		 * children. */
+		for(uint32_t i = e->first; i < e->first + e->count &&
+				lib->entries[i].type == LIBRARY_TYPE_DIR; i++)
+		{
+			if(lib->entries[i].count != 0)
+				last = i;
+		}
+
+		if(last == LIBRARY_NONE)
+			return e->first + e->count;
+
+		dir = last;
+	}
+}
+
+/**
+ * Get the type of a file from the index.
+ *
+ * \param	file	Full path of file.
+ * \return			enum file_types, which is FILE_TYPE_ERROR for files that
+ *					are not audio files, or -1 if the file is not indexed.
+ */
+int getLibraryFileType(const char* file)
+{
+	const struct library_t*	lib = &shared.lib;
+	uint32_t				i;
+	int						ret = -1;
+
+	if(shared.file[0] == '\0')
+		return -1;
+
+	LightLock_Lock(&shared.lock);
+	if((i = findFile(lib, file)) != LIBRARY_NONE)
+		ret = lib->entries[i].type;
+	LightLock_Unlock(&shared.lock);
+
+	return ret;
+}
+
+/**
+ * Count the entries below a folder and every folder below it, and find the
+ * number of a file among them. The entries are numbered from 0 in the order
+ * of the index, in which they are contiguous.
+ *
+ * \param	path	Full path of folder.
+ * \param	file	Full path of a file below the folder, or NULL.
+ * \param	n		Output number of file, or LIBRARY_NONE if it is not
+ *					below the folder. May be NULL.
+ * \return			Number of entries, or -1 if the folder is not indexed.
+ */
+int getLibraryTreeSize(const char* path, const char* file, uint32_t* n)
+{
+	const struct library_t*	lib = &shared.lib;
+	uint32_t				dir;
+	int						ret = -1;
+
+	if(n != NULL)
+		*n = LIBRARY_NONE;
+
+	if(shared.file[0] == '\0')
+		return -1;
+
+	LightLock_Lock(&shared.lock);
+	if((dir = findLibraryDir(lib, path)) != LIBRARY_NONE)
+	{
+		uint32_t first = lib->entries[dir].first;
+		uint32_t end = findTreeEnd(lib, dir);
+		uint32_t i;
+
+		if(file != NULL && n != NULL &&
+				(i = findFile(lib, file)) != LIBRARY_NONE &&
+				i >= first && i < end)
+			*n = i - first;
+
+		ret = end - first;
+	}
+	LightLock_Unlock(&shared.lock);
+
+	return ret;
+}
+
+/**
+ * Get the path of an entry below a folder, numbered as by
+ * getLibraryTreeSize().
+ *
+ * \param	path	Full path of folder.
+ * \param	n		Number of entry.
+ * \param	file	Output path.
+ * \param	len		Size of file.
+ * \return			0 on success, or -1 if the entry is not a file that may be
+ *					played.
+ */
+int getLibraryTreeFile(const char* path, uint32_t n, char* file, size_t len)
+{
+	const struct library_t*	lib = &shared.lib;
+	uint32_t				parents[LIBRARY_MAX_DEPTH + 2];
+	uint32_t				dir;
+	uint32_t				i;
+	unsigned				depth = 0;
+	int						ret = -1;
+
+	if(shared.file[0] == '\0')
+		return -1;
+
+	LightLock_Lock(&shared.lock);
+	if((dir = findLibraryDir(lib, path)) == LIBRARY_NONE ||
+			(i = lib->entries[dir].first + n) >= findTreeEnd(lib, dir) ||
+			lib->entries[i].type == LIBRARY_TYPE_DIR ||
+			lib->entries[i].type == FILE_TYPE_ERROR)
+		goto out;
+
+	/* The path is built from the root folder, whose name is its path. */
+	for(; i != LIBRARY_NONE && depth < sizeof(parents) / sizeof(*parents);
+			i = lib->entries[i].parent)
+		parents[depth++] = i;
+
+	if(i != LIBRARY_NONE || snprintf(file, len, "%s",
+				lib->strings + lib->entries[0].name) >= (int)len)
+		goto out;
+
+	for(size_t at = strlen(file); depth-- > 1; )
+	{
+		const char* sep = at > 0 && file[at - 1] == '/' ? "" : "/";
+		int w = snprintf(file + at, len - at, "%s%s", sep,
+				lib->strings + lib->entries[parents[depth - 1]].name);
+
+		if(w < 0 || (size_t)w >= len - at)
+			goto out;
+
+		at += w;
+	}
+
+	ret = 0;
+
+out:
+	LightLock_Unlock(&shared.lock);
+	return ret;
+}
+
+/**
+ * Copy a tag from the strings of a library.
+ */
+static void copyTag(char* dst, const struct library_t* lib, uint32_t off)
+{
+	if(off == LIBRARY_NONE)
+		dst[0] = '\0';
+	else
+		snprintf(dst, TAG_LEN, "%s", lib->strings + off);
+}
+
+/**
+ * Get the tags of a file from the index.
+ *
+ * \param	file	Full path of file.
+ * \param	tags	Output tags.
+ * \return			1 if the file has tags, 0 if it has none, or -1 if the
+ *					file is not indexed.
+ */
+int getLibraryTags(const char* file, struct tags_t* tags)
+{
+	const struct library_t*	lib = &shared.lib;
+	uint32_t				i;
+	int						ret = -1;
+
+	if(shared.file[0] == '\0')
+		return -1;
+
+	LightLock_Lock(&shared.lock);
+	if((i = findFile(lib, file)) != LIBRARY_NONE)
+	{
+		const struct libEntry_t* e = &lib->entries[i];
+
+		copyTag(tags->title, lib, e->title);
+		copyTag(tags->artist, lib, e->artist);
+		copyTag(tags->album, lib, e->album);
+		tags->track = e->track;
+		ret = hasTags(tags) ? 1 : 0;
+	}
+	LightLock_Unlock(&shared.lock);
+
+	return ret;
+}
+
+/**
+ * Number of times the index has been updated since startLibrary(), so that
+ * listings taken from it may be refreshed.
+ */
+unsigned getLibraryGen(void)
+{
+	return shared.gen;
+}
+
+/**
+ * Stop updating the index and free it.
+ */
+void exitLibrary(void)
+{
+	if(shared.thread != NULL)
+	{
+		shared.abort = true;
+		threadJoin(shared.thread, U64_MAX);
+		threadFree(shared.thread);
+		shared.thread = NULL;
+	}
+
+	freeLibrary(&shared.lib);
+}
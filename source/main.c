@@ -14,20 +14,121 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "all.h"
+#include "dir.h"
+#include "dirscan.h"
 #include "error.h"
 #include "file.h"
+#include "library.h"
 #include "main.h"
+#include "output.h"
 #include "playback.h"
+#include "playlist.h"
+#include "seekindex.h"
+#include "shuffle.h"
+#include "stream.h"
+#include "tagcache.h"
+#include "treewalk.h"
 
 /* for song skipping - will take three consecutive presses 
  * of the L/ZL or R/ZR buttons to get to the next song */
 #define MAX_PRESSES 3 
+
+/* Holding L, ZL, R or ZR alone for longer than this scrubs through the file
+ * playing. */
+#define SCRUB_DELAY_MS		500
+
+/* Time between seeks whilst scrubbing. */
+#define SCRUB_INTERVAL_MS	250
 					  
 volatile bool runThreads = true;
 
+/* Files of the shuffled order that may not be played, such as folders of a
+ * folder tree, that are passed over before giving up. */
+#define SHUFFLE_MAX_SKIP	64
+
+/* Files in a row that fail to play, such as files that are not audio after
+ * all, that are passed over before a folder tree or shuffle stops. */
+#define QUEUE_MAX_FAIL		8
+
+/* Longest line of the file browser, including colour escape sequences. */
+#define BROWSER_LINE_LEN	64
+
+/* Lines shown by the file browser on the bottom screen. */
+static struct
+{
+	/* The directory line, followed by the listed entries. */
+	char	lines[MAX_LIST + 1][BROWSER_LINE_LEN];
+	bool	valid;
+
+	/* Unchanged lines passed over since the last line drawn. */
+	int		skipped;
+} browser;
+
+/* Playlist being played. While active, its entries are played in place of
+ * the files of the folder shown. */
+static struct
+{
+	struct playlist_t	list;
+	bool				active;
+
+	/* Entry playing, and the entry queued after it, or -1. */
+	int32_t				pos;
+	int32_t				next;
+} playlist;
+
+/* Files that are shuffled. */
+enum shuffle_source
+{
+	SOURCE_FOLDER = 0,
+	SOURCE_TREE,
+	SOURCE_PLAYLIST
+};
+
+/* Shuffled order of the files being played. While active, it takes the
+ * place of the order of the folder or of the playlist being played. */
+static struct
+{
+	enum shuffle_mode	mode;
+	uint32_t			seed;
+	bool				active;
+
+	enum shuffle_source	source;
+
+	/* Folder whose tree is shuffled, and listing of the folder whose files
+	 * are shuffled. */
+	char				dir[PATH_MAX];
+	struct dirList_t	files;
+
+	/* Order at the file playing, and at the file queued after it. */
+	struct shuffle_t	order;
+	struct shuffle_t	next;
+} shuffle;
+
+/* Folder tree being played in order. The walk is kept at the file queued
+ * after the one playing, or past the last file if none is queued. */
+static struct
+{
+	char				root[PATH_MAX];
+	struct treeWalk_t	walk;
+	bool				active;
+
+	char				next[PATH_MAX];
+	bool				queued;
+} tree;
+
+/* Time the UI thread spends on each frame, excluding the wait for VBlank. */
+static struct
+{
+	u64	ticks;
+	u64	maxTicks;
+	u32	frames;
+} uiStats;
+
 /**
  * Prints the current key mappings to stdio.
  */
@@ -38,12 +139,227 @@ static void showControls(void)
 			"Pause: L+R, ZL+ZR, L+Up, or ZL+Up\n"
 			"Previous Song: Hit L or ZL 3 times\n"
 			"Next Song: Hit R or ZR 3 times\n"
+			"Fast forward: Hold R or ZR\n"
+			"Rewind: Hold L or ZL\n"
+			"Gapless on/off: L+Down or ZL+Down\n"
+			"Health overlay on/off: L+Right or ZL+Right\n"
 			"A: Open File\n"
+			"X: Play folder and its subfolders\n"
+			"Y: Shuffle off, folder or folder tree\n"
 			"B: Go up folder\n"
 			"Start: Exit\n"
 			"Browse: Up, Down, Left or Right\n\n");
 }
 
+/**
+ * Seek whilst a shoulder button is held, in steps that grow the longer it is
+ * held, so that long files may be crossed quickly.
+ *
+ * \param	dir		1 to scrub forwards, or -1 backwards.
+ * \param	held	Time the button has been held, in milliseconds.
+ */
+static void scrubPlayback(int dir, u64 held)
+{
+	static u64	lastSeek = 0;
+	u64			now = osGetTime();
+	int32_t		step;
+
+	if(held < SCRUB_DELAY_MS || now - lastSeek < SCRUB_INTERVAL_MS)
+		return;
+
+	if(held < 3000)
+		step = 2 * 1000;
+	else if(held < 8000)
+		step = 10 * 1000;
+	else
+		step = 60 * 1000;
+
+	lastSeek = now;
+	seekPlayback(dir * step);
+}
+
+/**
+ * Print playback health statistics.
+ *
+ * \param	f		Stream to print to.
+ * \param	eol		String to end each line with.
+ */
+static void printHealth(FILE* f, const char* eol)
+{
+	struct playbackStats_t stats;
+	struct streamStats_t streamStats;
+	unsigned codecs = 0;
+
+	getPlaybackStats(&stats);
+	getStreamStats(&streamStats);
+
+	fprintf(f, "Underruns %lu  Refill avg %.1f max %.1f ms%s",
+			(unsigned long)stats.underruns,
+			stats.refills ? stats.refillTotalUs / 1000.0 / stats.refills : 0.0,
+			stats.refillMaxUs / 1000.0, eol);
+
+	fprintf(f, "Start %lu ms  Decode max %.1f ms, calls by ms:%s",
+			(unsigned long)stats.startUs / 1000, stats.decodeMaxUs / 1000.0,
+			eol);
+
+	for(int i = 0; i < STATS_HIST_BUCKETS; i++)
+	{
+		if(i < STATS_HIST_BUCKETS - 1)
+			fprintf(f, "<%u %lu ", 1U << i, (unsigned long)stats.decodeHist[i]);
+		else
+			fprintf(f, ">=%u %lu", 1U << (i - 1),
+					(unsigned long)stats.decodeHist[i]);
+
+		if(i == STATS_HIST_BUCKETS / 2 - 1 || i == STATS_HIST_BUCKETS - 1)
+			fputs(eol, f);
+	}
+
+	/* Real-time factor of each codec played. */
+	fputs("RTF", f);
+	for(int type = 1; type < FILE_TYPES; type++)
+	{
+		if(stats.decodeUs[type] == 0)
+			continue;
+
+		if(codecs++ == 3)
+			fprintf(f, "%s   ", eol);
+
+		fprintf(f, " %s %.1fx", fileToStr(type),
+				(double)stats.audioUs[type] / stats.decodeUs[type]);
+	}
+
+	fputs(eol, f);
+	if(codecs <= 3)
+		fputs(eol, f);
+
+	fprintf(f, "Read %lu KiB  Stalls %lu avg %.1f max %.1f ms%s",
+			(unsigned long)(streamStats.bytesRead / 1024),
+			(unsigned long)streamStats.stalls,
+			streamStats.stalls ? streamStats.stallTotalUs / 1000.0 /
+				streamStats.stalls : 0.0,
+			streamStats.stallMaxUs / 1000.0, eol);
+
+	fprintf(f, "UI avg %.2f max %.2f ms per frame%s",
+			uiStats.frames ? uiStats.ticks * 1000.0 / SYSCLOCK_ARM11 /
+				uiStats.frames : 0.0,
+			uiStats.maxTicks * 1000.0 / SYSCLOCK_ARM11, eol);
+}
+
+/**
+ * List the current directory. Folders in the library index are listed at
+ * once. Other folders are read in the background, and their entries added
+ * by updateDirScan() as they are read.
+ *
+ * \param	dirList	Listing to store entries in.
+ * \return			Number of entries listed so far, or -1 on failure.
+ */
+static int getDirList(struct dirList_t* dirList)
+{
+	char	cwd[PATH_MAX];
+	int		ret;
+
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
+		return readDirList(dirList, NULL);
+
+	if((ret = getLibraryDirList(cwd, dirList)) >= 0)
+	{
+		cancelDirScan();
+		return ret;
+	}
+
+	if(requestDirScan(dirList, cwd) == 0)
+		return 0;
+
+	return readDirList(dirList, cwd);
+}
+
+/**
+ * Keep the selected entry within the listing and on screen.
+ *
+ * \param	fileNum	Selected entry, where 0 is "../".
+ * \param	from	First entry listed.
+ * \param	fileMax	Number of entries.
+ */
+static void clampSelection(int* fileNum, int* from, int fileMax)
+{
+	if(*fileNum > fileMax)
+		*fileNum = fileMax > 0 ? fileMax : 0;
+
+	if(*from > 0 && *fileNum <= *from)
+		*from = *fileNum > 0 ? *fileNum - 1 : 0;
+
+	if(*fileNum >= *from + MAX_LIST)
+		*from = *fileNum - MAX_LIST + 1;
+}
+
+/**
+ * Append playback health statistics to HEALTH_LOG.
+ */
+static void logHealth(void)
+{
+	FILE* f;
+	time_t now = time(NULL);
+
+	mkdir("sdmc:/3ds", 0777);
+	mkdir(CTRMUS_DIR, 0777);
+
+	if((f = fopen(HEALTH_LOG, "a")) == NULL)
+		return;
+
+	fprintf(f, "%s", ctime(&now));
+	printHealth(f, "\n");
+	fputs("\n", f);
+	fclose(f);
+}
+
+/**
+ * Show or hide the playback health overlay below the playback time.
+ */
+static void setHealthOverlay(bool show, PrintConsole* info, PrintConsole* log)
+{
+	// (y-1) + (height) <= 30 (top screen only fits 30 lines)
+	if(show == true)
+	{
+		consoleSetWindow(info, 1, 1, 50, 10);
+		consoleSetWindow(log, 1, 11, 50, 20);
+	}
+	else
+	{
+		consoleSetWindow(info, 1, 1, 50, 2);
+		consoleSetWindow(log, 1, 3, 50, 28);
+	}
+
+	consoleSelect(info);
+	consoleClear();
+	consoleSelect(log);
+	consoleClear();
+}
+
+/**
+ * Print the tags of a file, if they have been read.
+ *
+ * \param	file	Full path of file.
+ */
+static void printTags(const char* file)
+{
+	struct tags_t tags;
+
+	if(getTags(file, &tags) <= 0)
+		return;
+
+	if(tags.title[0] != '\0')
+		printf("Title: %s\n", tags.title);
+
+	if(tags.artist[0] != '\0')
+		printf("Artist: %s\n", tags.artist);
+
+	if(tags.album[0] != '\0')
+		printf("Album: %s\n", tags.album);
+
+	if(tags.track != 0)
+		printf("Track: %u\n", tags.track);
+}
+
 /**
  * Allows the playback thread to return any error messages that it may
  * encounter.
@@ -78,228 +394,843 @@ void playbackWatchdog(void* infoIn)
 //		}
 	}
 
-	return;
+	return;
+}
+
+/**
+ * Stop the currently playing file (if there is one) and play another file.
+ *
+ * \param	ep_file			File to play.
+ * \param	next			File to play after ep_file, or NULL.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ */
+static int changeFile(const char* ep_file, const char* next,
+		struct playbackInfo_t* playbackInfo)
+{
+	struct stream_t* stream;
+
+	/* If file is NULL, then only stopping playback was requested. */
+	if(ep_file == NULL || playbackInfo == NULL)
+	{
+		stopPlayback();
+		return 0;
+	}
+
+	/* The file is opened once, both to detect its type and to decode it. */
+	if((stream = openStream(ep_file)) == NULL ||
+			stream->type == FILE_TYPE_ERROR)
+	{
+		*playbackInfo->errInfo->error = errno;
+		svcSignalEvent(*playbackInfo->errInfo->failEvent);
+		closeStream(stream);
+		return -1;
+	}
+
+	if(startPlayback(stream, next) != 0)
+	{
+		closeStream(stream);
+		puts("Error: File path too long\n");
+		return -1;
+	}
+
+	printf("Playing: %s\n", ep_file);
+	printTags(ep_file);
+	return 0;
+}
+
+/**
+ * Get the full path of an entry in the directory listing, if it is a file.
+ *
+ * \param	dirList	Directory listing.
+ * \param	fileNum	Entry, where 0 is "../".
+ * \param	path	Output path.
+ * \param	len		Size of path.
+ * \return			0 on success, or -1 if the entry is not a file.
+ */
+static int getFilePath(const struct dirList_t* dirList, int fileNum,
+		char* path, size_t len)
+{
+	const char* sep = "/";
+	size_t dirLen;
+
+	/* Don't try to play folders */
+	if(fileNum > dirList->dirNum + dirList->fileNum ||
+			dirList->dirNum >= fileNum)
+		return -1;
+
+	dirLen = strlen(dirList->currentDir);
+	if(dirLen > 0 && dirList->currentDir[dirLen - 1] == '/')
+		sep = "";
+
+	if(snprintf(path, len, "%s%s%s", dirList->currentDir, sep,
+				getDirEntryName(dirList, fileNum - 1)) >= (int)len)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Get the file to queue after an entry for gapless playback. Playlists are
+ * not queued, as they are only played once selected or reached.
+ *
+ * \param	dirList	Directory listing.
+ * \param	fileNum	Entry playing.
+ * \param	next	Output path.
+ * \param	len		Size of next.
+ * \return			next, or NULL if there is no file to queue.
+ */
+static const char* getNextFile(const struct dirList_t* dirList, int fileNum,
+		char* next, size_t len)
+{
+	if(getFilePath(dirList, fileNum + 1, next, len) != 0 ||
+			getPlaylistType(next) != PLAYLIST_NONE)
+		return NULL;
+
+	return next;
+}
+
+/**
+ * Play an entry of the playlist, or else the nearest entry in the given
+ * direction that may be played, and queue the entry after it for gapless
+ * playback. Paths are only resolved here, as entries are reached.
+ *
+ * \param	n				Entry to play.
+ * \param	step			1 to pass over entries forwards, or -1 backwards.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if no entry may be played,
+ *							which ends the playlist.
+ */
+static int playPlaylistEntry(int32_t n, int step,
+		struct playbackInfo_t* playbackInfo)
+{
+	char file[PATH_MAX];
+	char next[PATH_MAX];
+
+	if((n = findPlaylistEntry(&playlist.list, n, step, file,
+					sizeof(file))) < 0)
+	{
+		playlist.active = false;
+		return -1;
+	}
+
+	playlist.pos = n;
+	playlist.next = findPlaylistEntry(&playlist.list, n + 1, 1, next,
+			sizeof(next));
+	return changeFile(file, playlist.next >= 0 ? next : NULL, playbackInfo);
+}
+
+/**
+ * Whether a file may be an audio file, without reading it on the UI thread.
+ * Its type is taken from the library index, or else files with the extension
+ * of cover art and the like are passed over. Other files that turn out not
+ * to be audio fail in changeFile(), and are passed over then.
+ */
+static bool isAudioFile(const char* file)
+{
+	int type = getLibraryFileType(file);
+
+	if(type < 0)
+		return !hasOtherExtension(file);
+
+	return type != FILE_TYPE_ERROR;
+}
+
+/**
+ * Whether a file found in a folder tree may be played. Playlists are passed
+ * over, as are files that are not audio files.
+ */
+static bool isTreeFilePlayable(const char* file)
+{
+	return getPlaylistType(file) == PLAYLIST_NONE && isAudioFile(file);
+}
+
+/**
+ * Move the walk over the folder tree to a file that may be played.
+ *
+ * \param	step	1 for the next file, or -1 for the previous file.
+ * \param	file	Output path.
+ * \param	len		Size of file.
+ * \return			0 on success, or -1 if there is no such file.
+ */
+static int stepTree(int step, char* file, size_t len)
+{
+	while(stepTreeWalk(&tree.walk, step, file, len) == 0)
+	{
+		if(isTreeFilePlayable(file))
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Move the walk over the folder tree to the file after the one playing.
+ *
+ * \return	Path of the file, or NULL if there is no file to queue.
+ */
+static const char* getTreeNext(void)
+{
+	tree.queued = stepTree(1, tree.next, sizeof(tree.next)) == 0;
+	return tree.queued ? tree.next : NULL;
+}
+
+/**
+ * Play the next or previous file of the folder tree, and queue the file
+ * after it for gapless playback.
+ *
+ * \param	step			1 for the next file, or -1 for the previous file.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if there is no file to play,
+ *							which ends the folder tree.
+ */
+static int playTree(int step, struct playbackInfo_t* playbackInfo)
+{
+	char	file[PATH_MAX];
+	bool	found = true;
+
+	/* A file that fails to play is passed over in the same direction. */
+	for(int tries = 0; found == true && tries < QUEUE_MAX_FAIL; tries++)
+	{
+		if(step > 0)
+		{
+			if((found = tree.queued) == true)
+				strcpy(file, tree.next);
+		}
+		else
+		{
+			/* The walk is one file ahead of the file tried last, so it is
+			 * moved back two files. Going back from the first file plays it
+			 * again. */
+			found = stepTree(-1, file, sizeof(file)) == 0;
+			if(found == true && stepTree(-1, file, sizeof(file)) != 0)
+				found = stepTree(1, file, sizeof(file)) == 0;
+		}
+
+		if(found == true && changeFile(file, getTreeNext(),
+					playbackInfo) == 0)
+			return 0;
+	}
+
+	tree.active = false;
+	return -1;
+}
+
+/**
+ * Start playing the files of a folder and of every folder below it, in
+ * order.
+ *
+ * \param	root			Folder.
+ * \param	file			File below the folder to start from, or NULL to start
+ *							from the first file.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if there is no file to play.
+ */
+static int startTree(const char* root, const char* file,
+		struct playbackInfo_t* playbackInfo)
+{
+	char first[PATH_MAX];
+
+	tree.active = false;
+	if(strlen(root) >= sizeof(tree.root))
+		return -1;
+
+	if(file == NULL || startTreeWalk(&tree.walk, root, file) != 0)
+	{
+		if(startTreeWalk(&tree.walk, root, NULL) != 0)
+			return -1;
+
+		file = NULL;
+	}
+
+	/* A file that may not be played starts from the file after it. */
+	if(file == NULL || !isTreeFilePlayable(file))
+	{
+		if(stepTree(1, first, sizeof(first)) != 0)
+			return -1;
+
+		file = first;
+	}
+
+	strcpy(tree.root, root);
+	tree.active = true;
+	if(changeFile(file, getTreeNext(), playbackInfo) == 0)
+		return 0;
+
+	return playTree(1, playbackInfo);
+}
+
+/**
+ * Get the path of a track of the shuffled order.
+ *
+ * \param	track	Track.
+ * \param	path	Output path.
+ * \param	len		Size of path.
+ * \return			0 on success, or -1 if the track may not be played.
+ */
+static int getShuffleFile(uint32_t track, char* path, size_t len)
+{
+	switch(shuffle.source)
+	{
+	case SOURCE_FOLDER:
+		if(getFilePath(&shuffle.files, shuffle.files.dirNum + 1 + track, path,
+					len) != 0 || getPlaylistType(path) != PLAYLIST_NONE ||
+				!isAudioFile(path))
+			return -1;
+		return 0;
+
+	case SOURCE_TREE:
+		return getLibraryTreeFile(shuffle.dir, track, path, len);
+
+	case SOURCE_PLAYLIST:
+		return findPlaylistEntry(&playlist.list, track, 1, path, len) ==
+			(int32_t)track ? 0 : -1;
+	}
+
+	return -1;
+}
+
+/**
+ * Move through a shuffled order to a file that may be played.
+ *
+ * \param	order	Shuffled order.
+ * \param	step	1 for the next file, -1 for the previous file, or 0 for
+ *					the current file or else the next.
+ * \param	path	Output path.
+ * \param	len		Size of path.
+ * \return			0 on success, or -1 if no file was found.
+ */
+static int stepShuffle(struct shuffle_t* order, int step, char* path,
+		size_t len)
+{
+	if(step == 0 && getShuffleFile(getShuffleTrack(order), path, len) == 0)
+		return 0;
+
+	/* Give up after a number of files, so as not to hold up the UI. */
+	for(int tries = 0; tries < SHUFFLE_MAX_SKIP; tries++)
+	{
+		uint32_t track;
+
+		if(step < 0)
+		{
+			if(prevShuffleTrack(order, &track) != 0)
+				return -1;
+		}
+		else
+			track = nextShuffleTrack(order);
+
+		if(getShuffleFile(track, path, len) == 0)
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Save the seed of the shuffled order once it changes, so that the same
+ * order is played after a restart.
+ */
+static void keepShuffleSeed(void)
+{
+	if(shuffle.order.seed == shuffle.seed)
+		return;
+
+	shuffle.seed = shuffle.order.seed;
+	saveShuffleSettings(SHUFFLE_FILE, shuffle.mode, shuffle.seed);
+}
+
+/**
+ * Find the file after the one playing in the shuffled order.
+ *
+ * \param	next	Output path.
+ * \param	len		Size of next.
+ * \return			next, or NULL if there is no file to queue.
+ */
+static const char* getShuffleNext(char* next, size_t len)
+{
+	shuffle.next = shuffle.order;
+	return stepShuffle(&shuffle.next, 1, next, len) == 0 ? next : NULL;
+}
+
+/**
+ * Play the next or previous file of the shuffled order, and queue the file
+ * after it for gapless playback.
+ *
+ * \param	step			1 for the next file, -1 for the previous file, or 0
+ *							for the current file.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if no file may be played,
+ *							which ends the shuffle.
+ */
+static int playShuffle(int step, struct playbackInfo_t* playbackInfo)
+{
+	char file[PATH_MAX];
+	char next[PATH_MAX];
+
+	for(int tries = 0; tries < QUEUE_MAX_FAIL; tries++)
+	{
+		struct shuffle_t order = shuffle.order;
+
+		/* Going back from the first file of a cycle plays it again. */
+		if(step < 0 && stepShuffle(&order, -1, file, sizeof(file)) != 0)
+		{
+			order = shuffle.order;
+			step = 0;
+		}
+
+		if(step >= 0 && stepShuffle(&order, step, file, sizeof(file)) != 0)
+			break;
+
+		shuffle.order = order;
+		keepShuffleSeed();
+		if(changeFile(file, getShuffleNext(next, sizeof(next)),
+					playbackInfo) == 0)
+			return 0;
+
+		/* A file that fails to play is passed over in the same direction. */
+		if(step == 0)
+			step = 1;
+	}
+
+	shuffle.active = false;
+	playlist.active = false;
+	return -1;
+}
+
+/**
+ * Start playing files in shuffled order: the entries of the playlist being
+ * played, or else the files of a folder, and of every folder below it once
+ * the folder has been indexed.
+ *
+ * \param	dir				Folder to shuffle, or NULL for the folder of file.
+ * \param	file			File to start from, or NULL to start from the first
+ *							file of the order.
+ * \param	playing			file is already playing, so that only the file
+ *							after it is queued.
+ * \param	subfolders		Shuffle the files of the folders below dir too.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if there is no file to play.
+ */
+static int startShuffle(const char* dir, const char* file, bool playing,
+		bool subfolders, struct playbackInfo_t* playbackInfo)
+{
+	char		folder[PATH_MAX];
+	char		next[PATH_MAX];
+	uint32_t	first = UINT32_MAX;
+	int			count = -1;
+
+	shuffle.active = false;
+
+	if(file != NULL)
+	{
+		const char* sep = strrchr(file, '/');
+
+		/* The root folder keeps its separator, such as "sdmc:/". */
+		if(sep == NULL || (size_t)(sep - file) + 2 > sizeof(folder))
+			return -1;
+
+		memcpy(folder, file, sep - file + 1);
+		folder[sep - file + (sep == file || sep[-1] == ':')] = '\0';
+		if(dir == NULL)
+			dir = folder;
+	}
+
+	if(dir == NULL && playlist.active == false)
+		return -1;
+
+	if(playlist.active == true)
+	{
+		shuffle.source = SOURCE_PLAYLIST;
+		count = playlist.list.count;
+		if(file != NULL)
+			first = playlist.pos;
+	}
+	else if(subfolders == true &&
+			strlen(dir) < sizeof(shuffle.dir) &&
+			(count = getLibraryTreeSize(dir, file, &first)) > 0 &&
+			(file == NULL || first != LIBRARY_NONE))
+	{
+		shuffle.source = SOURCE_TREE;
+		strcpy(shuffle.dir, dir);
+	}
+	else
+	{
+		/* Folders that are not indexed yet are shuffled alone. */
+		const char*	name = file != NULL ? strrchr(file, '/') + 1 : NULL;
+
+		shuffle.source = SOURCE_FOLDER;
+		if((count = readDirList(&shuffle.files,
+						file != NULL ? folder : dir)) < 0)
+			return -1;
+
+		count = shuffle.files.fileNum;
+		first = UINT32_MAX;
+		for(int i = 0; name != NULL && i < count; i++)
+		{
+			if(strcmp(getDirEntryName(&shuffle.files,
+							shuffle.files.dirNum + i), name) == 0)
+			{
+				first = i;
+				break;
+			}
+		}
+	}
+
+	if(count <= 0)
+		return -1;
+
+	initShuffle(&shuffle.order, count, shuffle.seed, first);
+	shuffle.active = true;
+
+	if(playing == false)
+		return playShuffle(0, playbackInfo);
+
+	queueNextFile(getShuffleNext(next, sizeof(next)));
+	return 0;
 }
 
 /**
- * Stop the currently playing file (if there is one) and play another file.
+ * Change the shuffle mode. The file playing stays playing, and the files
+ * after it are played in the new order.
  *
- * \param	ep_file			File to play.
+ * \param	mode			New mode.
+ * \param	dir				Folder shown.
  * \param	playbackInfo	Information that the playback thread requires to
  *							play file.
  */
-static int changeFile(const char* ep_file, struct playbackInfo_t* playbackInfo)
+static void setShuffleMode(enum shuffle_mode mode, const char* dir,
+		struct playbackInfo_t* playbackInfo)
 {
-	s32 prio;
-	static Thread thread = NULL;
+	bool playing = isPlaying();
 
-	if(ep_file != NULL && getFileType(ep_file) == FILE_TYPE_ERROR)
-	{
-		*playbackInfo->errInfo->error = errno;
-		svcSignalEvent(*playbackInfo->errInfo->failEvent);
-		return -1;
-	}
+	shuffle.mode = mode;
+	saveShuffleSettings(SHUFFLE_FILE, shuffle.mode, shuffle.seed);
 
-	/**
-	 * If music is playing, stop it. Only one playback thread should be playing
-	 * at any time.
-	 */
-	if(thread != NULL)
+	/* Otherwise the mode applies once a file is selected. */
+	if(playing == false)
+		return;
+
+	if(mode != SHUFFLE_OFF)
 	{
-		/* Tell the thread to stop playback before we join it */
-		stopPlayback();
+		const char*	file = playbackInfo->file;
+		size_t		len;
 
-		threadJoin(thread, U64_MAX);
-		threadFree(thread);
-		thread = NULL;
-	}
+		/* A folder tree being played is shuffled whole. */
+		if(tree.active == true)
+		{
+			if(startShuffle(tree.root, file, true, true, playbackInfo) == 0)
+				tree.active = false;
+			return;
+		}
 
-	/* If file is NULL, then only thread termination was requested. */
-	if(ep_file == NULL || playbackInfo == NULL)
-		return 0;
-	
-	//playbackInfo->file = strdup(ep_file);
-	if (memccpy(playbackInfo->file, ep_file, '\0', sizeof(playbackInfo->file)) == NULL)
-	{
-		puts("Error: File path too long\n");
-		return -1;
+		/* The tree shown is shuffled if the file playing is within it, or
+		 * else the folder of the file. */
+		len = strlen(dir);
+		if(mode != SHUFFLE_TREE || len == 0 ||
+				strncmp(file, dir, len) != 0 ||
+				(dir[len - 1] != '/' && file[len] != '/'))
+			dir = NULL;
+
+		startShuffle(dir, file, true, mode == SHUFFLE_TREE, playbackInfo);
+		return;
 	}
 
-	printf("Playing: %s\n", playbackInfo->file);
-	playbackInfo->samples_total = 0;
-	playbackInfo->samples_played = 0;
-	playbackInfo->samples_per_second = 0;
+	if(shuffle.active == false)
+		return;
 
-	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
-	thread = threadCreate(playFile, playbackInfo, 32 * 1024, prio - 1, -2, false);
+	shuffle.active = false;
 
-	return 0;
+	/* A playlist carries on in order from the entry playing. */
+	if(playlist.active == true)
+	{
+		char next[PATH_MAX];
+
+		playlist.pos = getShuffleTrack(&shuffle.order);
+		playlist.next = findPlaylistEntry(&playlist.list, playlist.pos + 1,
+				1, next, sizeof(next));
+		queueNextFile(playlist.next >= 0 ? next : NULL);
+	}
+	/* A shuffled folder tree carries on in order from the file playing. */
+	else if(shuffle.source == SOURCE_TREE &&
+			startTreeWalk(&tree.walk, shuffle.dir, playbackInfo->file) == 0)
+	{
+		strcpy(tree.root, shuffle.dir);
+		tree.active = true;
+		queueNextFile(getTreeNext());
+	}
+	else
+		queueNextFile(NULL);
 }
 
-static int cmpstringp(const void *p1, const void *p2)
+/**
+ * Whether files are played from a playlist, a folder tree or in shuffled
+ * order, rather than in the order of the folder shown.
+ */
+static bool isQueueActive(void)
 {
-	/* The actual arguments to this function are "pointers to
-	   pointers to char", but strcmp(3) arguments are "pointers
-	   to char", hence the following cast plus dereference */
-
-	return strcasecmp(* (char * const *) p1, * (char * const *) p2);
+	return playlist.active == true || shuffle.active == true ||
+		tree.active == true;
 }
 
 /**
- * Store the list of files and folders in current directory to an array.
+ * Play the next or previous file of the playlist, of the folder tree or of
+ * the shuffled order.
+ *
+ * \param	step			1 for the next file, or -1 for the previous file.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if there is no file to play.
  */
-static int getDir(struct dirList_t* dirList)
+static int playQueueEntry(int step, struct playbackInfo_t* playbackInfo)
 {
-	DIR				*dp;
-	struct dirent	*ep;
-	int				fileNum = 0;
-	int				dirNum = 0;
-	char*			wd = getcwd(NULL, 0);
+	if(shuffle.active == true)
+		return playShuffle(step, playbackInfo);
 
-	if(wd == NULL)
-		goto out;
+	if(tree.active == true)
+		return playTree(step, playbackInfo);
 
-	/* Clear strings */
-	for(int i = 0; i < dirList->dirNum; i++)
-		free(dirList->directories[i]);
+	if(step < 0)
+		return playPlaylistEntry(playlist.pos > 0 ? playlist.pos - 1 : 0, -1,
+				playbackInfo);
 
-	for(int i = 0; i < dirList->fileNum; i++)
-		free(dirList->files[i]);
-
-	free(dirList->currentDir);
+	return playPlaylistEntry(playlist.pos + 1, 1, playbackInfo);
+}
 
-	if((dirList->currentDir = strdup(wd)) == NULL)
-		puts("Failure");
+/**
+ * Move to the file that was queued once it plays, and queue the file after
+ * it.
+ */
+static void advanceQueue(void)
+{
+	char next[PATH_MAX];
 
-	if((dp = opendir(wd)) == NULL)
-		goto out;
+	if(shuffle.active == true)
+	{
+		shuffle.order = shuffle.next;
+		keepShuffleSeed();
+		queueNextFile(getShuffleNext(next, sizeof(next)));
+		return;
+	}
 
-	while((ep = readdir(dp)) != NULL)
+	if(tree.active == true)
 	{
-		/* Skip hidden entries (names starting with '.') */
-		if(ep->d_name[0] == '.')
-			continue;
+		queueNextFile(getTreeNext());
+		return;
+	}
 
-		if(ep->d_type == DT_DIR)
-		{
-			/* Add more space for another pointer to a dirent struct */
-			dirList->directories = realloc(dirList->directories, (dirNum + 1) * sizeof(char*));
+	playlist.pos = playlist.next;
+	playlist.next = findPlaylistEntry(&playlist.list, playlist.pos + 1, 1,
+			next, sizeof(next));
+	queueNextFile(playlist.next >= 0 ? next : NULL);
+}
 
-			if((dirList->directories[dirNum] = strdup(ep->d_name)) == NULL)
-				puts("Failure");
+/**
+ * Play the selected file, and queue the file after it for gapless playback.
+ * A selected playlist is played from its first entry. While shuffle is on,
+ * the files after it are played in shuffled order.
+ *
+ * \param	dirList			Directory listing.
+ * \param	fileNum			Selected entry. Must be a file.
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ */
+static int playEntry(struct dirList_t* dirList, int fileNum,
+		struct playbackInfo_t* playbackInfo)
+{
+	char file[PATH_MAX];
+	char next[PATH_MAX];
 
-			dirNum++;
-			continue;
-		}
+	if(getFilePath(dirList, fileNum, file, sizeof(file)) != 0)
+		return -1;
 
-		/* Add more space for another pointer to a dirent struct */
-		dirList->files = realloc(dirList->files, (fileNum + 1) * sizeof(char*));
+	/* A playlist is played in place of the files after it. */
+	if(getPlaylistType(file) != PLAYLIST_NONE)
+	{
+		playlist.active = false;
+		shuffle.active = false;
+		tree.active = false;
+		if(openPlaylist(&playlist.list, file) < 0)
+		{
+			printf("%s: %s\n", file, ctrmus_strerror(errno));
+			return -1;
+		}
 
-		if((dirList->files[fileNum] = strdup(ep->d_name)) == NULL)
-			puts("Failure");
+		playlist.active = true;
+		if((shuffle.mode != SHUFFLE_OFF ?
+					startShuffle(NULL, NULL, false, false, playbackInfo) :
+					playPlaylistEntry(0, 1, playbackInfo)) != 0)
+		{
+			playlist.active = false;
+			puts("No playable entries in playlist");
+			return -1;
+		}
 
-		fileNum++;
+		return 0;
 	}
 
-	qsort(&dirList->files[0], fileNum, sizeof(char *), cmpstringp);
-	qsort(&dirList->directories[0], dirNum, sizeof(char *), cmpstringp);
-
-	dirList->dirNum = dirNum;
-	dirList->fileNum = fileNum;
-
-	if(closedir(dp) != 0)
-		goto out;
+	playlist.active = false;
+	tree.active = false;
+	if(shuffle.mode != SHUFFLE_OFF &&
+			startShuffle(dirList->currentDir, file, false,
+				shuffle.mode == SHUFFLE_TREE, playbackInfo) == 0)
+		return 0;
 
-out:
-	free(wd);
-	return fileNum + dirNum;
+	shuffle.active = false;
+	return changeFile(file, getNextFile(dirList, fileNum, next, sizeof(next)),
+			playbackInfo);
 }
 
 /**
- * List current directory.
+ * Play the selected folder and every folder below it, or else the folder
+ * shown from the selected file, in order or in shuffled order.
  *
- * \param	from	First entry in directory to list.
- * \param	max		Maximum number of entries to list. Must be > 0.
- * \param	select	File to show as selected. Must be > 0.
- * \return			Number of entries listed or negative on error.
+ * \param	dirList			Directory listing.
+ * \param	fileNum			Selected entry, where 0 is "../".
+ * \param	playbackInfo	Information that the playback thread requires to
+ *							play file.
+ * \return					0 on success, or -1 if there is no file to play.
  */
-static int listDir(int from, int max, int select, struct dirList_t dirList)
+static int playTreeEntry(const struct dirList_t* dirList, int fileNum,
+		struct playbackInfo_t* playbackInfo)
 {
-	int				fileNum = 0;
-	int				listed = 0;
+	char		root[PATH_MAX];
+	char		file[PATH_MAX];
+	const char*	start = NULL;
 
-	printf("\033[0;0H");
-	printf("Dir: %.33s\n", dirList.currentDir);
+	playlist.active = false;
+	shuffle.active = false;
+	tree.active = false;
 
-	if(from == 0)
+	if(fileNum > 0 && fileNum <= dirList->dirNum)
 	{
-		printf("\33[2K%c../\n", select == 0 ? '>' : ' ');
-		listed++;
-		max--;
+		size_t		len = strlen(dirList->currentDir);
+		const char*	sep = len > 0 && dirList->currentDir[len - 1] == '/' ?
+			"" : "/";
+
+		if(snprintf(root, sizeof(root), "%s%s%s", dirList->currentDir, sep,
+					getDirEntryName(dirList, fileNum - 1)) >=
+				(int)sizeof(root))
+			return -1;
 	}
-
-	while(dirList.fileNum + dirList.dirNum > fileNum)
+	else
 	{
-		fileNum++;
+		snprintf(root, sizeof(root), "%s", dirList->currentDir);
+		if(getFilePath(dirList, fileNum, file, sizeof(file)) == 0)
+			start = file;
+	}
 
-		if(fileNum <= from)
-			continue;
+	if(shuffle.mode != SHUFFLE_OFF)
+		return startShuffle(root, start, false, true, playbackInfo);
 
-		listed++;
+	return startTree(root, start, playbackInfo);
+}
 
-		if(dirList.dirNum >= fileNum)
-		{
-			printf("\33[2K%c\x1b[34;1m%.37s/\x1b[0m\n",
-					select == fileNum ? '>' : ' ',
-					dirList.directories[fileNum - 1]);
+/**
+ * Get the text shown for a file, which is its title, track number and artist
+ * once its tags have been read, or else its name.
+ *
+ * \param	dirList	Directory listing.
+ * \param	fileNum	Entry, where 0 is "../". Must be a file.
+ * \param	title	Output buffer, which may be used for the text.
+ * \param	len		Size of title.
+ * \return			Text to show.
+ */
+static const char* getEntryTitle(const struct dirList_t* dirList, int fileNum,
+		char* title, size_t len)
+{
+	struct tags_t	tags;
+	char			path[PATH_MAX];
+	int				n = 0;
 
-		}
+	if(getFilePath(dirList, fileNum, path, sizeof(path)) != 0 ||
+			getTags(path, &tags) <= 0 || tags.title[0] == '\0')
+		return getDirEntryName(dirList, fileNum - 1);
 
-		/* fileNum must be referring to a file instead of a directory. */
-		if(dirList.dirNum < fileNum)
-		{
-			printf("\33[2K%c%.37s\n",
-					select == fileNum ? '>' : ' ',
-					dirList.files[fileNum - dirList.dirNum - 1]);
+	if(tags.track != 0)
+		n = snprintf(title, len, "%02u ", tags.track);
 
-		}
+	snprintf(title + n, len - n, tags.artist[0] != '\0' ? "%s - %s" : "%s",
+			tags.title, tags.artist);
+	return title;
+}
 
-		if(fileNum == max + from)
-			break;
+/**
+ * Draw a line of the file browser, unless it is already shown. Lines are
+ * drawn in order from the top of the screen, with skipped lines passed
+ * over by moving the cursor down.
+ *
+ * \param	line	Line of the screen.
+ * \param	text	Text of line, which may be empty to clear it.
+ */
+static void drawLine(int line, const char* text)
+{
+	if(browser.valid == true && strcmp(browser.lines[line], text) == 0)
+	{
+		browser.skipped++;
+		return;
 	}
 
-	return listed;
+	for(; browser.skipped > 0; browser.skipped--)
+		putchar('\n');
+
+	printf("\33[2K%s\n", text);
+	strcpy(browser.lines[line], text);
 }
 
 /**
- * Get number of files in current working folder
+ * List current directory. Only lines that differ from those already on the
+ * bottom screen are redrawn, which on moving the selection is usually two.
  *
- * \return	Number of files in current working folder, -1 on failure with
- *			errno set.
+ * \param	from	First entry in directory to list.
+ * \param	max		Maximum number of entries to list. Must be > 0.
+ * \param	select	File to show as selected. Must be > 0.
+ * \return			Number of entries listed or negative on error.
  */
-int getNumberFiles(void)
+static int listDir(int from, int max, int select,
+		const struct dirList_t* dirList)
 {
-	DIR				*dp;
-	struct dirent	*ep;
-	int				ret = 0;
+	char	text[BROWSER_LINE_LEN];
+	char	title[TAG_LEN * 2 + 8];
+	int		total = dirList->dirNum + dirList->fileNum;
+	int		listed = 0;
 
-	if((dp = opendir(".")) == NULL)
-		goto err;
+	if(max > MAX_LIST)
+		max = MAX_LIST;
 
-	while((ep = readdir(dp)) != NULL) {
-		if(ep->d_name[0] == '.')
-			continue;
-		ret++;
-	}
-	
-	closedir(dp);
+	printf("\033[0;0H");
+	browser.skipped = 0;
 
-out:
-	return ret;
+	snprintf(text, sizeof(text), "Dir: %.33s", dirList->currentDir);
+	drawLine(0, text);
 
-err:
-	ret = -1;
-	goto out;
+	/* The first line is "../" when listing from the start. */
+	for(int line = 0; line < MAX_LIST; line++)
+	{
+		int fileNum = from == 0 ? line : from + 1 + line;
+		char mark = select == fileNum ? '>' : ' ';
+
+		if(line >= max || fileNum > total)
+			text[0] = '\0';
+		else if(fileNum == 0)
+			snprintf(text, sizeof(text), "%c../", mark);
+		else if(dirList->dirNum >= fileNum)
+			snprintf(text, sizeof(text), "%c\x1b[34;1m%.37s/\x1b[0m", mark,
+					getDirEntryName(dirList, fileNum - 1));
+		else
+			snprintf(text, sizeof(text), "%c%.37s", mark,
+					getEntryTitle(dirList, fileNum, title, sizeof(title)));
+
+		listed += text[0] != '\0';
+		drawLine(line + 1, text);
+	}
+
+	browser.valid = true;
+	return listed;
 }
 
 int main(int argc, char **argv)
@@ -313,8 +1244,14 @@ int main(int argc, char **argv)
 	struct watchdogInfo	watchdogInfoIn;
 	struct errInfo_t	errInfo;
 	struct playbackInfo_t	playbackInfo = { 0 };
+	struct output_fn	output;
+	bool			showHealth = false;
+	u64			healthTime = 0;
 	volatile int		error = 0;
 	struct dirList_t	dirList = { 0 };
+	unsigned		libraryGen = 0;
+	unsigned		tagGen = 0;
+	u64			frameTick = 0;
 
 	/* ignore key release of L/R if L+R or L+down was pressed */
 	bool keyLComboPressed = false;
@@ -369,6 +1306,16 @@ int main(int argc, char **argv)
 			&watchdogInfoIn, 4 * 1024, 0x20, -2, true);
 
 	playbackInfo.errInfo = &errInfo;
+	playbackInfo.gapless = true;
+	playbackInfo.decodeAheadMs = DECODE_AHEAD_MS;
+	playbackInfo.waveBufs = WAVEBUFS_DEFAULT;
+
+	setNdspOutput(&output);
+	if(startPlaybackEngine(&playbackInfo, &output) != 0)
+	{
+		puts("Unable to start playback thread");
+		goto err;
+	}
 
 	/* position of parent folder in parent directory */
 	int prevPosition[MAX_DIRECTORIES] = {0};
@@ -378,21 +1325,42 @@ int main(int argc, char **argv)
 	chdir(DEFAULT_DIR);
 	chdir("MUSIC");
 
-	/* TODO: Not actually possible to get less than 0 */
-	if(getDir(&dirList) < 0)
+	if(startDirScanner() != 0)
+		puts("Unable to start directory scanner");
+
+	/* Index the music folder in the background, listing folders from the
+	 * previous index until it completes. */
+	mkdir("sdmc:/3ds", 0777);
+	mkdir(CTRMUS_DIR, 0777);
+	{
+		char cwd[PATH_MAX];
+
+		if(getcwd(cwd, sizeof(cwd)) != NULL)
+			startLibrary(cwd, LIBRARY_FILE);
+	}
+
+	if(startTagCache() != 0)
+		puts("Unable to start tag reader");
+
+	if(startSeekIndex(SEEK_INDEX_DIR) != 0)
+		puts("Unable to start seek indexer");
+
+	/* The order of the last run is played again. */
+	if(loadShuffleSettings(SHUFFLE_FILE, &shuffle.mode, &shuffle.seed) != 0)
+		shuffle.seed = newShuffleSeed();
+
+	if((fileMax = getDirList(&dirList)) < 0)
 	{
 		puts("Unable to obtain directory information");
 		goto err;
 	}
 
-	if(listDir(from, MAX_LIST, 0, dirList) < 0)
+	if(listDir(from, MAX_LIST, 0, &dirList) < 0)
 	{
 		err_print("Unable to list directory.");
 		goto err;
 	}
 
-	fileMax = getNumberFiles();
-
 	/**
 	 * This allows for music to continue playing through the headphones whilst
 	 * the 3DS is closed.
@@ -406,9 +1374,21 @@ int main(int argc, char **argv)
 		u32         kUp;
 		static u64	mill = 0;
 
+		/* Time spent on the previous frame. */
+		if(frameTick != 0)
+		{
+			u64 ticks = svcGetSystemTick() - frameTick;
+
+			uiStats.ticks += ticks;
+			uiStats.frames++;
+			if(ticks > uiStats.maxTicks)
+				uiStats.maxTicks = ticks;
+		}
+
 		gfxFlushBuffers();
 		gspWaitForVBlank();
 		gfxSwapBuffers();
+		frameTick = svcGetSystemTick();
 
 		hidScanInput();
 		kDown = hidKeysDown();
@@ -478,6 +1458,53 @@ int main(int argc, char **argv)
 		if(kDown)
 			mill = osGetTime();
 
+		/* Refresh the listing once the library index has been updated. */
+		if(getLibraryGen() != libraryGen)
+		{
+			char	cwd[PATH_MAX];
+			int		ret;
+
+			libraryGen = getLibraryGen();
+			if(getcwd(cwd, sizeof(cwd)) != NULL &&
+					(ret = getLibraryDirList(cwd, &dirList)) >= 0)
+			{
+				cancelDirScan();
+				fileMax = ret;
+				clampSelection(&fileNum, &from, fileMax);
+				if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
+					err_print("Unable to list directory.");
+			}
+		}
+
+		/* Show files by their tags as they are read. */
+		if(getTagCacheGen() != tagGen)
+		{
+			tagGen = getTagCacheGen();
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
+				err_print("Unable to list directory.");
+		}
+
+		/* Add entries of a folder being read, keeping the same entry
+		 * selected. */
+		{
+			int keep = fileNum - 1;
+			int ret = updateDirScan(&dirList, &keep);
+
+			if(ret < 0)
+				err_print("Unable to obtain directory information");
+
+			if(ret != 0)
+			{
+				fileMax = dirList.dirNum + dirList.fileNum;
+				if(fileNum > 0)
+					fileNum = keep + 1;
+
+				clampSelection(&fileNum, &from, fileMax);
+				if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
+					err_print("Unable to list directory.");
+			}
+		}
+
 		if(kHeld & KEY_L)
 		{
 			/* Pause/Play */
@@ -515,6 +1542,29 @@ int main(int argc, char **argv)
 				keyLComboPressed = true;
 				continue;
 			}
+
+			/* Gapless on/off */
+			if(kDown & KEY_DOWN)
+			{
+				consoleSelect(&topScreenLog);
+				playbackInfo.gapless = !playbackInfo.gapless;
+				printf("Gapless %s\n", playbackInfo.gapless ? "on" : "off");
+				keyLComboPressed = true;
+				continue;
+			}
+
+			/* Health overlay on/off */
+			if(kDown & KEY_RIGHT)
+			{
+				showHealth = !showHealth;
+				setHealthOverlay(showHealth, &topScreenInfo, &topScreenLog);
+				logHealth();
+				printf("Health overlay %s\nLogged to %s\n",
+						showHealth ? "on" : "off", HEALTH_LOG);
+				healthTime = 0;
+				keyLComboPressed = true;
+				continue;
+			}
 		}
 		// if R is pressed first
 		if ((kHeld & KEY_R) && (kDown & KEY_L))
@@ -576,6 +1626,29 @@ int main(int argc, char **argv)
 				keyZLComboPressed = true;
 				continue;
 			}
+
+			/* Gapless on/off (redundancy) */
+			if(kDown & KEY_DOWN)
+			{
+				consoleSelect(&topScreenLog);
+				playbackInfo.gapless = !playbackInfo.gapless;
+				printf("Gapless %s\n", playbackInfo.gapless ? "on" : "off");
+				keyZLComboPressed = true;
+				continue;
+			}
+
+			/* Health overlay on/off (redundancy) */
+			if(kDown & KEY_RIGHT)
+			{
+				showHealth = !showHealth;
+				setHealthOverlay(showHealth, &topScreenInfo, &topScreenLog);
+				logHealth();
+				printf("Health overlay %s\nLogged to %s\n",
+						showHealth ? "on" : "off", HEALTH_LOG);
+				healthTime = 0;
+				keyZLComboPressed = true;
+				continue;
+			}
 		}
 		// if ZR is pressed first
 		if ((kHeld & KEY_ZR) && (kDown & KEY_ZL))
@@ -610,7 +1683,7 @@ int main(int argc, char **argv)
 			if(fileMax - fileNum > MAX_LIST-2 && from != 0)
 				from--;
 
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				err_print("Unable to list directory.");
 		}
 
@@ -624,7 +1697,7 @@ int main(int argc, char **argv)
 					from < fileMax - MAX_LIST)
 				from++;
 
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				err_print("Unable to list directory.");
 		}
 
@@ -647,7 +1720,7 @@ int main(int argc, char **argv)
 					from = 0;
 			}
 
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				err_print("Unable to list directory.");
 		}
 
@@ -670,7 +1743,7 @@ int main(int argc, char **argv)
 					from = fileMax - MAX_LIST;
 			}
 
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				err_print("Unable to list directory.");
 		}
 
@@ -682,8 +1755,7 @@ int main(int argc, char **argv)
 				((kDown & KEY_A) && (from == 0 && fileNum == 0)))
 		{
 			chdir("..");
-			consoleClear();
-			fileMax = getDir(&dirList);
+			fileMax = getDirList(&dirList);
 
 			fileNum = prevPosition[0];
 			from = prevFrom[0];
@@ -695,7 +1767,10 @@ int main(int argc, char **argv)
 			prevPosition[MAX_DIRECTORIES-1] = 0;
 			prevFrom[MAX_DIRECTORIES-1] = 0;
 
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+			/* Entries of a folder being read are not all listed yet. */
+			clampSelection(&fileNum, &from, fileMax);
+
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				err_print("Unable to list directory.");
 
 			continue;
@@ -705,16 +1780,15 @@ int main(int argc, char **argv)
 		{
 			if(dirList.dirNum >= fileNum)
 			{
-				chdir(dirList.directories[fileNum - 1]);
-				consoleClear();
-				fileMax = getDir(&dirList);
+				chdir(getDirEntryName(&dirList, fileNum - 1));
+				fileMax = getDirList(&dirList);
 
 				oldFileNum = fileNum;
 				oldFrom = from;
 				fileNum = 0;
 				from = 0;
 
-				if(listDir(from, MAX_LIST, fileNum, dirList) < 0)
+				if(listDir(from, MAX_LIST, fileNum, &dirList) < 0)
 				{
 					err_print("Unable to list directory.");
 				}
@@ -738,12 +1812,62 @@ int main(int argc, char **argv)
 				consoleSelect(&topScreenLog);
 				//consoleClear();
 
-				changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
+				playEntry(&dirList, fileNum, &playbackInfo);
 				error = 0;
 				continue;
 			}
 		}
 
+		/* Play folder tree */
+		if(kDown & KEY_X)
+		{
+			consoleSelect(&topScreenInfo);
+			consoleClear();
+			consoleSelect(&topScreenLog);
+
+			if(playTreeEntry(&dirList, fileNum, &playbackInfo) != 0)
+				puts("No files to play in folder tree");
+
+			error = 0;
+			consoleSelect(&bottomScreen);
+			continue;
+		}
+
+		/* Shuffle off, folder or folder tree */
+		if(kDown & KEY_Y)
+		{
+			static const char* const modes[SHUFFLE_MODES] =
+			{
+				"off", "folder", "folder tree"
+			};
+
+			consoleSelect(&topScreenLog);
+			setShuffleMode((shuffle.mode + 1) % SHUFFLE_MODES,
+					dirList.currentDir, &playbackInfo);
+			printf("Shuffle %s\n", modes[shuffle.mode]);
+			consoleSelect(&bottomScreen);
+			continue;
+		}
+
+		/* Hold R or ZR to fast forward, or L or ZL to rewind, unless the
+		 * button is part of a combination. */
+		if(isPlaying() == true && !(kHeld & (KEY_L | KEY_ZL)))
+		{
+			if((kHeld & KEY_R) && rPressTime != 0 && !keyRComboPressed)
+				scrubPlayback(1, now - rPressTime);
+			else if((kHeld & KEY_ZR) && zrPressTime != 0 &&
+					!keyZRComboPressed)
+				scrubPlayback(1, now - zrPressTime);
+		}
+		else if(isPlaying() == true && !(kHeld & (KEY_R | KEY_ZR)))
+		{
+			if((kHeld & KEY_L) && lPressTime != 0 && !keyLComboPressed)
+				scrubPlayback(-1, now - lPressTime);
+			else if((kHeld & KEY_ZL) && zlPressTime != 0 &&
+					!keyZLComboPressed)
+				scrubPlayback(-1, now - zlPressTime);
+		}
+
 		/* 
 		 * Handle song change for R/ZR and L/ZL:
 		 * - press L/ZL three times within half a second to go back one song
@@ -761,20 +1885,35 @@ int main(int argc, char **argv)
 					{
 						if (now - lastSkipTime > 1000) // cannot skip song for one second to avoid button spam
 						{ 
-							if (fileNum < fileMax && dirList.dirNum < fileNum+1) 
+							/* The playback engine moves to its queued file,
+							 * and signals PLAYBACK_NEXT_TRACK. */
+							if (isPlaying() == true)
 							{
-								fileNum += 1;
-								if(fileNum >= MAX_LIST && fileMax - fileNum >= 0 && from < fileMax - MAX_LIST)
-									from++;
+								skipPlayback();
 								lastSkipTime = now;
 							}
-							consoleSelect(&topScreenInfo);
-							consoleClear();
-							consoleSelect(&topScreenLog);
-							changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
-							error = 0;
-							consoleSelect(&bottomScreen);
-							if(listDir(from, MAX_LIST, fileNum, dirList) < 0) err_print("Unable to list directory.");
+							else
+							{
+								if (isQueueActive() == true)
+									lastSkipTime = now;
+								else if (fileNum < fileMax && dirList.dirNum < fileNum+1) 
+								{
+									fileNum += 1;
+									if(fileNum >= MAX_LIST && fileMax - fileNum >= 0 && from < fileMax - MAX_LIST)
+										from++;
+									lastSkipTime = now;
+								}
+								consoleSelect(&topScreenInfo);
+								consoleClear();
+								consoleSelect(&topScreenLog);
+								if (isQueueActive() == true)
+									playQueueEntry(1, &playbackInfo);
+								else
+									playEntry(&dirList, fileNum, &playbackInfo);
+								error = 0;
+								consoleSelect(&bottomScreen);
+								if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
+							}
 							
 							/* reset index after operation completes */
 							zrPressIdx = 0;
@@ -796,7 +1935,9 @@ int main(int argc, char **argv)
 					{
 						if (now - lastSkipTime > 1000)
 						{
-							if (fileNum > 1 && dirList.dirNum < fileNum-1) 
+							if (isQueueActive() == true)
+								lastSkipTime = now;
+							else if (fileNum > 1 && dirList.dirNum < fileNum-1) 
 							{
 								fileNum -= 1;
 								if(fileMax - fileNum > MAX_LIST-2 && from != 0)
@@ -806,10 +1947,13 @@ int main(int argc, char **argv)
 							consoleSelect(&topScreenInfo);
 							consoleClear();
 							consoleSelect(&topScreenLog);
-							changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
+							if (isQueueActive() == true)
+								playQueueEntry(-1, &playbackInfo);
+							else
+								playEntry(&dirList, fileNum, &playbackInfo);
 							error = 0;
 							consoleSelect(&bottomScreen);
-							if(listDir(from, MAX_LIST, fileNum, dirList) < 0) err_print("Unable to list directory.");
+							if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
 							zlPressIdx = 0;
 							memset(zlPressCount, 0, sizeof(zlPressCount));
 							//zlHoldTriggered = true;
@@ -830,19 +1974,32 @@ int main(int argc, char **argv)
 					{
 						if (now - lastSkipTime > 1000)
 						{
-							if (fileNum < fileMax && dirList.dirNum < fileNum+1) {
-								fileNum += 1;
-								if(fileNum >= MAX_LIST && fileMax - fileNum >= 0 && from < fileMax - MAX_LIST)
-									from++;
+							if (isPlaying() == true)
+							{
+								skipPlayback();
 								lastSkipTime = now;
 							}
-							consoleSelect(&topScreenInfo);
-							consoleClear();
-							consoleSelect(&topScreenLog);
-							changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
-							error = 0;
-							consoleSelect(&bottomScreen);
-							if(listDir(from, MAX_LIST, fileNum, dirList) < 0) err_print("Unable to list directory.");
+							else
+							{
+								if (isQueueActive() == true)
+									lastSkipTime = now;
+								else if (fileNum < fileMax && dirList.dirNum < fileNum+1) {
+									fileNum += 1;
+									if(fileNum >= MAX_LIST && fileMax - fileNum >= 0 && from < fileMax - MAX_LIST)
+										from++;
+									lastSkipTime = now;
+								}
+								consoleSelect(&topScreenInfo);
+								consoleClear();
+								consoleSelect(&topScreenLog);
+								if (isQueueActive() == true)
+									playQueueEntry(1, &playbackInfo);
+								else
+									playEntry(&dirList, fileNum, &playbackInfo);
+								error = 0;
+								consoleSelect(&bottomScreen);
+								if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
+							}
 							rPressIdx = 0;                                
 							memset(rPressCount, 0, sizeof(rPressCount)); 
 						}
@@ -861,7 +2018,9 @@ int main(int argc, char **argv)
 					if (count == MAX_PRESSES)
 					{
 						if (now - lastSkipTime > 1000){
-							if (fileNum > 1 && dirList.dirNum < fileNum-1) {
+							if (isQueueActive() == true)
+								lastSkipTime = now;
+							else if (fileNum > 1 && dirList.dirNum < fileNum-1) {
 								fileNum -= 1;
 								if(fileMax - fileNum > MAX_LIST-2 && from != 0)
 									from--;
@@ -870,10 +2029,13 @@ int main(int argc, char **argv)
 							consoleSelect(&topScreenInfo);
 							consoleClear();
 							consoleSelect(&topScreenLog);
-							changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
+							if (isQueueActive() == true)
+								playQueueEntry(-1, &playbackInfo);
+							else
+								playEntry(&dirList, fileNum, &playbackInfo);
 							error = 0;
 							consoleSelect(&bottomScreen);
-							if(listDir(from, MAX_LIST, fileNum, dirList) < 0) err_print("Unable to list directory.");
+							if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
 							lPressIdx = 0;                                
 							memset(lPressCount, 0, sizeof(lPressCount));
 						}
@@ -882,9 +2044,53 @@ int main(int argc, char **argv)
 			}
 		}
 
+		/* Playback continued with the queued file without stopping. */
+		if(error == PLAYBACK_NEXT_TRACK)
+		{
+			char next[PATH_MAX];
+
+			error = 0;
+			consoleSelect(&topScreenInfo);
+			consoleClear();
+			consoleSelect(&topScreenLog);
+			printf("Playing: %s\n", playbackInfo.file);
+			printTags(playbackInfo.file);
+
+			if(isQueueActive() == true)
+			{
+				advanceQueue();
+				consoleSelect(&bottomScreen);
+				continue;
+			}
+
+			fileNum += 1;
+			if(fileNum >= MAX_LIST && fileMax - fileNum >= 0 &&
+					from < fileMax - MAX_LIST)
+				from++;
+
+			if(getNextFile(&dirList, fileNum, next, sizeof(next)) != NULL)
+				queueNextFile(next);
+
+			consoleSelect(&bottomScreen);
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
+			continue;
+		}
+
 		// play next song automatically
-		if (error == -1) 
+		if (error == PLAYBACK_STOPPED) 
 		{
+			/* The playlist ends once no entry after it may be played. */
+			if (isQueueActive() == true)
+			{
+				consoleSelect(&topScreenInfo);
+				consoleClear();
+				consoleSelect(&topScreenLog);
+				playQueueEntry(1, &playbackInfo);
+				error = 0;
+				consoleSelect(&bottomScreen);
+				continue;
+			}
+
 			// don't try to play folders
 			if (fileNum >= fileMax || dirList.dirNum >= fileNum) 
 			{
@@ -896,13 +2102,25 @@ int main(int argc, char **argv)
 			consoleClear();
 			consoleSelect(&topScreenLog);
 			//consoleClear();
-			changeFile(dirList.files[fileNum - dirList.dirNum - 1], &playbackInfo);
+			playEntry(&dirList, fileNum, &playbackInfo);
 			error = 0;
 			consoleSelect(&bottomScreen);
-			if(listDir(from, MAX_LIST, fileNum, dirList) < 0) err_print("Unable to list directory.");
+			if(listDir(from, MAX_LIST, fileNum, &dirList) < 0) err_print("Unable to list directory.");
 			continue;
 		}
 
+		/* Update health overlay once a second. */
+		if(showHealth == true && osGetTime() - healthTime >= 1000)
+		{
+			healthTime = osGetTime();
+			consoleSelect(&topScreenInfo);
+			/* Below the playback time. */
+			printf("\033[0;0H\n");
+			printHealth(stdout, "\033[K\n");
+			memset(&uiStats, 0, sizeof(uiStats));
+			consoleSelect(&bottomScreen);
+		}
+
 		/* After 1000ms, update playback time. */
 		while(osGetTime() - mill > 1000)
 		{
@@ -941,15 +2159,29 @@ int main(int argc, char **argv)
 				printf(" %02d:%02d:%02d", hr, min, sec);
 			}
 
+#ifdef DEBUG
+			printf(" %3u wakeups/s", playbackInfo.wakeupsPerSec);
+#endif
 			break;
 		}
 	}
 
 out:
 	puts("Exiting...");
+	if(showHealth == true)
+		logHealth();
+
 	runThreads = false;
 	svcSignalEvent(playbackFailEvent);
-	changeFile(NULL, &playbackInfo);
+	exitTagCache();
+	exitSeekIndex();
+	exitLibrary();
+	exitDirScanner();
+	exitPlaybackEngine();
+	freeDirList(&dirList);
+	freePlaylist(&playlist.list);
+	freeDirList(&shuffle.files);
+	freeTreeWalk(&tree.walk);
 
 	gfxExit();
 	return 0;
@@ -4,19 +4,43 @@
 #include <string.h>
 
 #include "mp3.h"
+#include "mpeg.h"
 #include "playback.h"
+#include "seekindex.h"
+#include "stream.h"
 
-static size_t*			buffSize;
-static mpg123_handle	*mh = NULL;
-static uint32_t			rate;
-static uint8_t			channels;
-
-static int initMp3(const char* file);
-static uint32_t rateMp3(void);
-static uint8_t channelMp3(void);
-static uint64_t decodeMp3(void* buffer);
-static void exitMp3(void);
-static size_t getFileSamplesMp3(void);
+struct mp3_t
+{
+	mpg123_handle*		mh;
+	struct stream_t*	stream;
+	size_t			buffSize;
+	long			rate;
+	int				channels;
+
+	/* Samples of each channel in the file, or 0 if only mpg123 can estimate
+	 * them. */
+	uint64_t			samples;
+
+	/* Seek index, once loaded, and seek index generation it was last tried
+	 * at. */
+	struct seekIndex_t*	index;
+	unsigned			indexGen;
+};
+
+/* MP3 file indexed by indexMp3(). */
+struct mp3Scan_t
+{
+	struct stream_t*	stream;
+	volatile bool*		abort;
+};
+
+static int initMp3(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateMp3(void* ctx);
+static uint8_t channelMp3(void* ctx);
+static uint64_t decodeMp3(void* ctx, void* buffer);
+static void exitMp3(void* ctx);
+static size_t getFileSamplesMp3(void* ctx);
+static int seekMp3(void* ctx, uint64_t frame);
 
 /**
  * Set decoder parameters for MP3.
@@ -32,45 +56,156 @@ void setMp3(struct decoder_fn* decoder)
 	 * buffSize changes depending on input file. So we set buffSize later when
 	 * decoder is initialised.
 	 */
-	buffSize = &(decoder->buffSize);
 	decoder->decode = &decodeMp3;
 	decoder->exit = &exitMp3;
 	decoder->getFileSamples = &getFileSamplesMp3;
+	decoder->seek = &seekMp3;
+	decoder->ctx = NULL;
+}
+
+/**
+ * Load the seek index of the MP3 file and hand it to mpg123. The index is
+ * built in the background if it has not been.
+ */
+static void loadIndexMp3(struct mp3_t* mp3)
+{
+	off_t* offsets;
+
+	mp3->indexGen = getSeekIndexGen();
+	if((mp3->index = loadSeekIndex(mp3->stream)) == NULL)
+		return;
+
+	if(mp3->samples == 0)
+		mp3->samples = mp3->index->samples;
+
+	if(mp3->index->count == 0 ||
+			(offsets = malloc(mp3->index->count * sizeof(off_t))) == NULL)
+		return;
+
+	for(uint32_t i = 0; i < mp3->index->count; i++)
+		offsets[i] = mp3->index->points[i].offset;
+
+	/* mpg123 copies the offsets. */
+	mpg123_set_index(mp3->mh, offsets, mp3->index->step, mp3->index->count);
+	free(offsets);
 }
 
-static size_t getFileSamplesMp3(void)
+/**
+ * Get the number of samples in the MP3 file. Where no header of the file
+ * gives it, it is estimated from the size of the file until the seek index,
+ * which counts every frame, has been built.
+ */
+static size_t getFileSamplesMp3(void* ctx)
 {
-	off_t len = mpg123_length(mh);
-	if(len == MPG123_ERR)
+	struct mp3_t* mp3 = ctx;
+	off_t len;
+
+	if(mp3->samples == 0 && mp3->index == NULL &&
+			mp3->indexGen != getSeekIndexGen())
+		loadIndexMp3(mp3);
+
+	if(mp3->samples != 0)
+		return mp3->samples * mp3->channels;
+
+	if((len = mpg123_length(mp3->mh)) == MPG123_ERR)
 		return 0;
-	
-	return len * (size_t)channels;
+
+	return len * (size_t)mp3->channels;
+}
+
+/**
+ * Read the length of an MP3 file from the header of its first frame. The
+ * frame is found in the start of the file read when it was opened, or in the
+ * block read after an ID3v2 tag holding cover art.
+ *
+ * \param	stream	Opened MP3 file.
+ * \return			Samples of each channel, or 0 if no header gives them.
+ */
+static uint64_t readLengthMp3(const struct stream_t* stream)
+{
+	const struct probe_t*	probe = &stream->probe;
+	const uint8_t*			data = probe->data;
+	size_t					len = probe->len;
+	uint64_t				tag = getId3v2Size(data, len);
+	struct mpegHeader_t		header;
+
+	if(probe->framesLen > 0)
+	{
+		data = probe->frames;
+		len = probe->framesLen;
+	}
+	else if(tag <= len)
+	{
+		data += tag;
+		len -= tag;
+	}
+	else
+		return 0;
+
+	/* Padding may follow the tag. The first frame found is the only one
+	 * that may hold the header. */
+	for(size_t i = 0; i + 4 <= len; i++)
+	{
+		if(data[i] == 0xFF && parseMpegHeader(data + i, &header) == 0)
+			return getMpegInfoSamples(data + i, len - i, &header);
+	}
+
+	return 0;
+}
+
+static ssize_t onReadMp3(void* stream, void* buf, size_t count)
+{
+	return readStream(stream, buf, count);
+}
+
+static off_t onSeekMp3(void* stream, off_t offset, int whence)
+{
+	if(seekStream(stream, offset, whence) != 0)
+		return -1;
+
+	return tellStream(stream);
 }
 
 /**
  * Initialise MP3 decoder.
  *
- * \param	file	Location of MP3 file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened MP3 file, which is closed by exitMp3().
  * \return			0 on success, else failure.
  */
-int initMp3(const char* file)
+int initMp3(struct decoder_fn* decoder, struct stream_t* stream)
 {
+	struct mp3_t* mp3;
 	int err = 0;
 	int encoding = 0;
 
-	if((err = mpg123_init()) != MPG123_OK)
-		return err;
+	if((mp3 = calloc(1, sizeof(struct mp3_t))) == NULL)
+		return -1;
 
-	if((mh = mpg123_new(NULL, &err)) == NULL)
+	if((mp3->mh = mpg123_new(NULL, &err)) == NULL)
 	{
 		printf("Error: %s\n", mpg123_plain_strerror(err));
+		exitMp3(mp3);
 		return err;
 	}
 
-	if(mpg123_open(mh, file) != MPG123_OK ||
-			mpg123_getformat(mh, (long *) &rate, (int *) &channels, &encoding) != MPG123_OK)
+	mp3->samples = readLengthMp3(stream);
+
+	/*
+	 * Remove encoder delay and padding, as given by the LAME tag, so that
+	 * consecutive files play without a gap.
+	 */
+	mpg123_param(mp3->mh, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0.0);
+
+	/* The stream is closed by exitMp3(), not by mpg123_close(). */
+	if(mpg123_replace_reader_handle(mp3->mh, onReadMp3, onSeekMp3,
+				NULL) != MPG123_OK ||
+			mpg123_open_handle(mp3->mh, stream) != MPG123_OK ||
+			mpg123_getformat(mp3->mh, &mp3->rate, &mp3->channels,
+				&encoding) != MPG123_OK)
 	{
-		printf("Trouble with mpg123: %s\n", mpg123_strerror(mh));
+		printf("Trouble with mpg123: %s\n", mpg123_strerror(mp3->mh));
+		exitMp3(mp3);
 		return -1;
 	}
 
@@ -78,26 +213,57 @@ int initMp3(const char* file)
 	 * Ensure that this output format will not change (it might, when we allow
 	 * it).
 	 */
-	mpg123_format_none(mh);
-	mpg123_format(mh, rate, channels, encoding);
+	mpg123_format_none(mp3->mh);
+	mpg123_format(mp3->mh, mp3->rate, mp3->channels, encoding);
 
 	/*
 	 * Buffer could be almost any size here, mpg123_outblock() is just some
 	 * recommendation. The size should be a multiple of the PCM frame size.
+	 * buffSize is in samples, so that a full buffer is only returned before
+	 * the end of the file.
 	 */
-	*buffSize = mpg123_outblock(mh) * 16;
+	mp3->buffSize = mpg123_outblock(mp3->mh) * 16 / sizeof(int16_t);
+	mp3->stream = stream;
+	decoder->buffSize = mp3->buffSize;
+	decoder->ctx = mp3;
+
+	/* The index of a file with no header giving its length also gives it,
+	 * once built. */
+	if(mp3->samples == 0)
+		loadIndexMp3(mp3);
+	else
+		queueSeekIndex(stream);
 
 	return 0;
 }
 
+/**
+ * Seek to a sample of MP3 file. Without a seek index, mpg123 reads frame
+ * headers from the last position it knows up to the sample. With one, it
+ * reads from the frame indexed before the sample. Either way, the seek is
+ * exact.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, else failure.
+ */
+static int seekMp3(void* ctx, uint64_t frame)
+{
+	struct mp3_t* mp3 = ctx;
+
+	if(mp3->index == NULL)
+		loadIndexMp3(mp3);
+
+	return mpg123_seek(mp3->mh, frame, SEEK_SET) < 0 ? -1 : 0;
+}
+
 /**
  * Get sampling rate of MP3 file.
  *
  * \return	Sampling rate.
  */
-uint32_t rateMp3(void)
+uint32_t rateMp3(void* ctx)
 {
-	return rate;
+	return ((struct mp3_t*)ctx)->rate;
 }
 
 /**
@@ -105,9 +271,9 @@ uint32_t rateMp3(void)
  *
  * \return	Number of channels for opened file.
  */
-uint8_t channelMp3(void)
+uint8_t channelMp3(void* ctx)
 {
-	return channels;
+	return ((struct mp3_t*)ctx)->channels;
 }
 
 /**
@@ -116,109 +282,121 @@ uint8_t channelMp3(void)
  * \param buffer	Decoded output.
  * \return			Samples read for each channel.
  */
-uint64_t decodeMp3(void* buffer)
+uint64_t decodeMp3(void* ctx, void* buffer)
 {
+	struct mp3_t* mp3 = ctx;
 	size_t done = 0;
-	mpg123_read(mh, buffer, *buffSize, &done);
+	mpg123_read(mp3->mh, buffer, mp3->buffSize * sizeof(int16_t), &done);
 	return done / (sizeof(int16_t));
 }
 
 /**
  * Free MP3 decoder.
  */
-void exitMp3(void)
+void exitMp3(void* ctx)
 {
-	mpg123_close(mh);
-	mpg123_delete(mh);
-	mpg123_exit();
-}
+	struct mp3_t* mp3 = ctx;
 
-/**
- * Check if a file is a valid MP3 file.
- * 
- * \param path	Path to the MP3 file.
- * \return		0 if valid MP3, 1 if not valid.
- */
-int isMp3(const char *path)
-{
-#if 0
-	int err;
-	int result = 1;
-	mpg123_handle *mh = NULL;
-	long rate;
-	int channels, encoding;
-
-	// Initialise the library
-	if (mpg123_init() != MPG123_OK)
-		goto out;
-
-	// Create a decoder handle
-	mh = mpg123_new(NULL, &err);
-	if (!mh)
-		goto exit_init;
-
-	// skip ID3v2 tags rather than parsing them (so tag-only files don’t count as valid mp3)
-	mpg123_param(mh, MPG123_SKIP_ID3V2, 1, 0);
-
-	// limit how many bytes to scan for a frame sync (e.g. 2048 bytes)
-	mpg123_param(mh, MPG123_RESYNC_LIMIT, 2048, 0);
-
-	// Try opening the file
-	err = mpg123_open(mh, path);
-	if (err != MPG123_OK)
-		goto exit_handle;
-
-	// Query the decoded format
-	if (mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK)
-		goto close_handle;
-
-	// Parse first frame in file
-	err = mpg123_framebyframe_next(mh);
-	if (err != MPG123_OK)
+	if(mp3->mh != NULL)
 	{
-		// If we can't read the first frame, it's not a valid MP3
-		goto close_handle;
+		mpg123_close(mp3->mh);
+		mpg123_delete(mp3->mh);
 	}
 
-	// All checks passed: valid MP3
-	result = 0;
-
-close_handle:
-	mpg123_close(mh);
+	closeStream(mp3->stream);
+	free(mp3->index);
+	free(mp3);
+}
 
-exit_handle:
-	mpg123_delete(mh);
+static ssize_t onReadIndexMp3(void* handle, void* buf, size_t count)
+{
+	struct mp3Scan_t* scan = handle;
 
-exit_init:
-	mpg123_exit();
+	if(*scan->abort == true)
+		return -1;
 
-out:
-	return result;
-#else
-    unsigned char buf[4];
-	FILE *f = fopen(path, "rb");
-	int ret = 1;
+	return readStream(scan->stream, buf, count);
+}
 
-	if(!f) return 1;
+static off_t onSeekIndexMp3(void* handle, off_t offset, int whence)
+{
+	return onSeekMp3(((struct mp3Scan_t*)handle)->stream, offset, whence);
+}
 
-    if(fread(buf, 1, 4, f) < 4)
-		goto out;
+/**
+ * Build the seek index of an MP3 file. mpg123 reads every frame header
+ * without decoding, and keeps the offset of every step frames, doubling
+ * step as its index fills. The frames counted give the exact length of the
+ * file.
+ *
+ * \param	stream	Opened MP3 file, positioned at its start.
+ * \param	index	Output index, with room for SEEK_INDEX_POINTS points.
+ * \param	abort	Stop once this is true.
+ * \return			0 on success, else failure.
+ */
+int indexMp3(struct stream_t* stream, struct seekIndex_t* index,
+		volatile bool* abort)
+{
+	struct mp3Scan_t	scan = { stream, abort };
+	mpg123_handle*		mh;
+	off_t*				offsets;
+	off_t				step;
+	off_t				length;
+	size_t				fill;
+	int					spf;
+	int					err = -1;
+
+	if((mh = mpg123_new(NULL, NULL)) == NULL)
+		return -1;
 
-    // ID3v2 tag?
-    if(buf[0]=='I' && buf[1]=='D' && buf[2]=='3') {
-		ret = 0;
-		goto out;
+	/* The length is counted as the decoder plays it. */
+	mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0.0);
+
+	if(mpg123_param(mh, MPG123_INDEX_SIZE, SEEK_INDEX_POINTS,
+				0.0) == MPG123_OK &&
+			mpg123_replace_reader_handle(mh, onReadIndexMp3, onSeekIndexMp3,
+				NULL) == MPG123_OK &&
+			mpg123_open_handle(mh, &scan) == MPG123_OK &&
+			mpg123_scan(mh) == MPG123_OK &&
+			mpg123_index(mh, &offsets, &step, &fill) == MPG123_OK &&
+			(spf = mpg123_spf(mh)) > 0 &&
+			(length = mpg123_length(mh)) > 0)
+	{
+		if(fill > SEEK_INDEX_POINTS)
+			fill = SEEK_INDEX_POINTS;
+
+		for(size_t i = 0; i < fill; i++)
+		{
+			index->points[i].sample = (uint64_t)i * step * spf;
+			index->points[i].offset = offsets[i];
+		}
+
+		index->step = step;
+		index->count = fill;
+		index->samples = length;
+		err = 0;
 	}
 
-    // MPEG frame sync: 11 one-bits in a row
-    if(buf[0]==0xFF && (buf[1]&0xE0)==0xE0) {
-		ret = 0;
-		goto out;
-	}
+	mpg123_close(mh);
+	mpg123_delete(mh);
+	return err;
+}
 
-out:
-	fclose(f);
-    return ret;
-#endif
+/**
+ * Initialise the MP3 decoding library. Must be called once before any MP3
+ * decoder is initialised.
+ *
+ * \return	0 on success, else failure.
+ */
+int initMp3Library(void)
+{
+	return mpg123_init() == MPG123_OK ? 0 : -1;
 }
 
+/**
+ * Free the MP3 decoding library, once all MP3 decoders have been freed.
+ */
+void exitMp3Library(void)
+{
+	mpg123_exit();
+}
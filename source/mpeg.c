@@ -0,0 +1,209 @@
+#include <string.h>
+
+#include "mpeg.h"
+
+/* Bitrates in kbit/s by bitrate index, for MPEG-1 layers I to III and then
+ * MPEG-2 and MPEG-2.5 layer I, and layers II and III. */
+static const uint16_t bitrates[5][15] = {
+	{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+	{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+	{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+	{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+};
+
+/* Sampling rates of MPEG-1 by sampling rate index, which are halved for
+ * MPEG-2 and quartered for MPEG-2.5. */
+static const uint32_t rates[3] = { 44100, 48000, 32000 };
+
+static uint32_t readBE32(const uint8_t* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * Parse the header of an MPEG audio frame. Free format frames, whose size is
+ * not given by their header, are not accepted.
+ *
+ * \param	h		Four bytes of header.
+ * \param	header	Output header.
+ * \return			0 on success, or -1 if not a valid header.
+ */
+int parseMpegHeader(const uint8_t* h, struct mpegHeader_t* header)
+{
+	static const uint8_t versions[4] = { 3, 0, 2, 1 };
+	unsigned bitrateIdx = h[2] >> 4;
+	unsigned rateIdx = (h[2] >> 2) & 3;
+	unsigned padding = (h[2] >> 1) & 1;
+	unsigned table;
+
+	/* Sync, then reserved version, layer, bitrate, rate and emphasis. */
+	if(h[0] != 0xFF || (h[1] & 0xE0) != 0xE0 ||
+			((h[1] >> 3) & 3) == 1 || ((h[1] >> 1) & 3) == 0 ||
+			bitrateIdx == 0 || bitrateIdx == 15 || rateIdx == 3 ||
+			(h[3] & 3) == 2)
+		return -1;
+
+	header->version = versions[(h[1] >> 3) & 3];
+	header->layer = 4 - ((h[1] >> 1) & 3);
+	header->channels = (h[3] >> 6) == 3 ? 1 : 2;
+	header->crc = (h[1] & 1) == 0;
+	header->rate = rates[rateIdx] >> (header->version - 1);
+
+	if(header->version == 1)
+		table = header->layer - 1;
+	else
+		table = header->layer == 1 ? 3 : 4;
+
+	header->bitrate = bitrates[table][bitrateIdx] * 1000;
+
+	if(header->layer == 1)
+	{
+		header->samples = 384;
+		header->size = (12 * header->bitrate / header->rate + padding) * 4;
+	}
+	else
+	{
+		header->samples = header->layer == 3 && header->version != 1 ?
+			576 : 1152;
+		header->size = header->samples / 8 * header->bitrate /
+			header->rate + padding;
+	}
+
+	return 0;
+}
+
+/**
+ * Check that data starts with consecutive MPEG audio frames, each following
+ * the last by the frame size given by its header, with the same version,
+ * layer, sampling rate and channels.
+ *
+ * \param	data	Data to check.
+ * \param	len		Bytes in data.
+ * \param	frames	Frames to check. Fewer are checked where the data ends
+ *					first, but never fewer than two.
+ * \return			true if the frames were found.
+ */
+bool checkMpegFrames(const uint8_t* data, size_t len, unsigned frames)
+{
+	struct mpegHeader_t	first;
+	struct mpegHeader_t	next;
+	size_t				at;
+	unsigned			n;
+
+	if(len < 4 || parseMpegHeader(data, &first) != 0)
+		return false;
+
+	at = first.size;
+	for(n = 1; n < frames && at + 4 <= len; n++)
+	{
+		if(parseMpegHeader(data + at, &next) != 0 ||
+				next.version != first.version ||
+				next.layer != first.layer || next.rate != first.rate ||
+				next.channels != first.channels)
+			return false;
+
+		at += next.size;
+	}
+
+	return n >= 2;
+}
+
+/**
+ * Get the size of an ID3v2 tag at the start of a file.
+ *
+ * \param	data	Start of file.
+ * \param	len		Bytes in data, at least ID3V2_HEADER_SIZE for a tag to be
+ *					found.
+ * \return			Bytes in tag, with its header and footer, or 0 if there
+ *					is no tag.
+ */
+uint64_t getId3v2Size(const uint8_t* data, size_t len)
+{
+	uint64_t size = 0;
+
+	if(len < ID3V2_HEADER_SIZE || memcmp(data, "ID3", 3) != 0 ||
+			data[3] == 0xFF || data[4] == 0xFF)
+		return 0;
+
+	/* The size is syncsafe: seven bits in each byte. */
+	for(int i = 6; i < 10; i++)
+	{
+		if(data[i] & 0x80)
+			return 0;
+
+		size = size << 7 | data[i];
+	}
+
+	/* A footer follows the tag where flagged. */
+	return ID3V2_HEADER_SIZE + size + (data[5] & 0x10 ? ID3V2_HEADER_SIZE : 0);
+}
+
+/**
+ * Get the length of an MP3 file from the Xing, Info or VBRI header of its
+ * first frame, without the encoder delay and padding given by a LAME tag.
+ *
+ * \param	frame	First frame, of which up to MPEG_INFO_SIZE bytes are read.
+ * \param	len		Bytes in frame.
+ * \param	header	Parsed header of the frame.
+ * \return			Samples of each channel, or 0 if the frame has no header
+ *					giving the length.
+ */
+uint64_t getMpegInfoSamples(const uint8_t* frame, size_t len,
+		const struct mpegHeader_t* header)
+{
+	uint64_t	samples;
+	uint32_t	flags;
+	uint32_t	trim = 0;
+	size_t		at;
+
+	if(header->layer != 3)
+		return 0;
+
+	if(len > header->size)
+		len = header->size;
+
+	/* A Xing header, or an Info header from a CBR encode, follows the side
+	 * information. The frame it is in holds no audio. */
+	if(header->version == 1)
+		at = 4 + (header->channels == 1 ? 17 : 32);
+	else
+		at = 4 + (header->channels == 1 ? 9 : 17);
+
+	if(header->crc)
+		at += 2;
+
+	if(len >= at + 12 && (memcmp(frame + at, "Xing", 4) == 0 ||
+				memcmp(frame + at, "Info", 4) == 0))
+	{
+		flags = readBE32(frame + at + 4);
+		if((flags & 1) == 0)
+			return 0;
+
+		samples = (uint64_t)readBE32(frame + at + 8) * header->samples;
+
+		/* Frames, then bytes, table of contents and quality fields. */
+		at += 8 + 4 + (flags & 2 ? 4 : 0) + (flags & 4 ? 100 : 0) +
+			(flags & 8 ? 4 : 0);
+
+		/* The LAME tag gives the delay and padding in 12 bits each, after
+		 * 21 bytes of version, lowpass, ReplayGain and bitrate. FFmpeg
+		 * writes the tag too. */
+		if(len >= at + 24 && (memcmp(frame + at, "LAME", 4) == 0 ||
+					memcmp(frame + at, "Lav", 3) == 0))
+		{
+			trim = (frame[at + 21] << 4 | frame[at + 22] >> 4) +
+				((frame[at + 22] & 0x0F) << 8 | frame[at + 23]);
+		}
+
+		return samples > trim ? samples - trim : 0;
+	}
+
+	/* A VBRI header, from the Fraunhofer encoder, is always 32 bytes after
+	 * the frame header. */
+	if(len >= 4 + 32 + 18 && memcmp(frame + 36, "VBRI", 4) == 0)
+		return (uint64_t)readBE32(frame + 36 + 14) * header->samples;
+
+	return 0;
+}
@@ -3,18 +3,33 @@
 
 #include "opus.h"
 #include "playback.h"
+#include "seekindex.h"
+#include "stream.h"
+#include "tags.h"
+
+/* Samples decoded before a sample seeked to with the seek index, as
+ * op_pcm_seek() does, so that the decoder has converged: 80 ms at 48 kHz. */
+#define OPUS_PREROLL	3840
+
+struct opus_t
+{
+	OggOpusFile*		opusFile;
+	struct stream_t*	stream;
+
+	/* Seek index, once loaded. */
+	struct seekIndex_t*	index;
+};
 
-static OggOpusFile*		opusFile;
-static const OpusHead*	opusHead;
 static const size_t		buffSize = 32 * 1024;
 
-static int initOpus(const char* file);
-static uint32_t rateOpus(void);
-static uint8_t channelOpus(void);
-static uint64_t decodeOpus(void* buffer);
-static void exitOpus(void);
-static uint64_t fillOpusBuffer(int16_t* bufferOut);
-static size_t getFileSamplesOpus(void);
+static int initOpus(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateOpus(void* ctx);
+static uint8_t channelOpus(void* ctx);
+static uint64_t decodeOpus(void* ctx, void* buffer);
+static void exitOpus(void* ctx);
+static uint64_t fillOpusBuffer(OggOpusFile* opusFile, int16_t* bufferOut);
+static size_t getFileSamplesOpus(void* ctx);
+static int seekOpus(void* ctx, uint64_t frame);
 
 /**
  * Set decoder parameters for Opus.
@@ -30,38 +45,138 @@ void setOpus(struct decoder_fn* decoder)
 	decoder->decode = &decodeOpus;
 	decoder->exit = &exitOpus;
 	decoder->getFileSamples = &getFileSamplesOpus;
+	decoder->seek = &seekOpus;
+	decoder->ctx = NULL;
 }
 
-static size_t getFileSamplesOpus(void)
+static size_t getFileSamplesOpus(void* ctx)
 {
-	ogg_int64_t len = op_pcm_total(opusFile, -1);
+	ogg_int64_t len = op_pcm_total(((struct opus_t*)ctx)->opusFile, -1);
 
 	if(len == OP_EINVAL)
 		return 0;
 
-	return len * (size_t)channelOpus();
+	return len * (size_t)channelOpus(ctx);
+}
+
+static int onReadOpus(void* stream, unsigned char* ptr, int nbytes)
+{
+	return readStream(stream, ptr, nbytes);
+}
+
+static int onSeekOpus(void* stream, opus_int64 offset, int whence)
+{
+	return seekStream(stream, offset, whence);
+}
+
+static opus_int64 onTellOpus(void* stream)
+{
+	return tellStream(stream);
 }
 
+/* The stream is closed by exitOpus(), not by op_free(). */
+static const OpusFileCallbacks opusCallbacks = {
+	onReadOpus, onSeekOpus, onTellOpus, NULL
+};
+
 /**
  * Initialise Opus decoder.
  *
- * \param	file	Location of opus file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened opus file, which is closed by exitOpus().
  * \return			0 on success, else failure.
  */
-int initOpus(const char* file)
+int initOpus(struct decoder_fn* decoder, struct stream_t* stream)
 {
-	int err = 0;
+	struct opus_t*	opus;
+	int				err = -1;
 
-	if((opusFile = op_open_file(file, &err)) == NULL)
+	if((opus = calloc(1, sizeof(struct opus_t))) == NULL)
 		goto out;
 
-	if((err = op_current_link(opusFile)) < 0)
-		goto out;
+	if((opus->opusFile = op_open_callbacks(stream, &opusCallbacks, NULL, 0,
+					&err)) == NULL)
+		goto err;
 
-	opusHead = op_head(opusFile, err);
+	if((err = op_current_link(opus->opusFile)) < 0)
+	{
+		op_free(opus->opusFile);
+		goto err;
+	}
+
+	opus->stream = stream;
+	decoder->ctx = opus;
+	queueSeekIndex(stream);
+	err = 0;
 
 out:
 	return err;
+
+err:
+	free(opus);
+	goto out;
+}
+
+/**
+ * Decode and drop samples up to a sample, after seeking to a page before it.
+ *
+ * \param	frame	Sample of each channel, at 48 kHz.
+ * \return			0 on success, or -1 if already past the sample or on
+ *					failure.
+ */
+static int skipOpus(OggOpusFile* opusFile, uint64_t frame)
+{
+	const int		scratchSize = 120 * 48 * 2;
+	ogg_int64_t		pos = op_pcm_tell(opusFile);
+	opus_int16*		scratch;
+	int				err = 0;
+
+	if(pos < 0 || (uint64_t)pos > frame ||
+			(scratch = malloc(scratchSize * sizeof(opus_int16))) == NULL)
+		return -1;
+
+	while(err == 0 && (uint64_t)pos < frame)
+	{
+		uint64_t	left = (frame - pos) * 2;
+		int			n = op_read_stereo(opusFile, scratch,
+				left < (uint64_t)scratchSize ? (int)left : scratchSize);
+
+		if(n <= 0)
+			err = -1;
+		else
+			pos += n;
+	}
+
+	free(scratch);
+	return err;
+}
+
+/**
+ * Seek to a sample of Opus file. With a seek index, decoding starts from the
+ * page indexed before the sample, rather than from a search over the file.
+ *
+ * \param	frame	Sample of each channel, at 48 kHz.
+ * \return			0 on success, else failure.
+ */
+static int seekOpus(void* ctx, uint64_t frame)
+{
+	struct opus_t*				opus = ctx;
+	const struct seekPoint_t*	point = NULL;
+	uint64_t					granule;
+
+	if(opus->index == NULL)
+		opus->index = loadSeekIndex(opus->stream);
+
+	/* Only the first link of a chained file is indexed. */
+	granule = frame + op_head(opus->opusFile, 0)->pre_skip;
+	if(granule >= OPUS_PREROLL)
+		point = findSeekPoint(opus->index, granule - OPUS_PREROLL);
+
+	if(point != NULL && op_raw_seek(opus->opusFile, point->offset) == 0 &&
+			skipOpus(opus->opusFile, frame) == 0)
+		return 0;
+
+	return op_pcm_seek(opus->opusFile, frame) == 0 ? 0 : -1;
 }
 
 /**
@@ -69,8 +184,9 @@ out:
  *
  * \return	Sampling rate. Should be 48000.
  */
-uint32_t rateOpus(void)
+uint32_t rateOpus(void* ctx)
 {
+	(void)ctx;
 	return 48000;
 }
 
@@ -79,9 +195,10 @@ uint32_t rateOpus(void)
  *
  * \return	Number of channels for opened file, so always be 2.
  */
-uint8_t channelOpus(void)
+uint8_t channelOpus(void* ctx)
 {
 	/* Opus decoder always returns stereo stream */
+	(void)ctx;
 	return 2;
 }
 
@@ -92,26 +209,32 @@ uint8_t channelOpus(void)
  * \return			Samples read for each channel. 0 for end of file, negative
  *					for error.
  */
-uint64_t decodeOpus(void* buffer)
+uint64_t decodeOpus(void* ctx, void* buffer)
 {
-	return fillOpusBuffer(buffer);
+	return fillOpusBuffer(((struct opus_t*)ctx)->opusFile, buffer);
 }
 
 /**
  * Free Opus decoder.
  */
-void exitOpus(void)
+void exitOpus(void* ctx)
 {
-	op_free(opusFile);
+	struct opus_t* opus = ctx;
+
+	op_free(opus->opusFile);
+	closeStream(opus->stream);
+	free(opus->index);
+	free(opus);
 }
 
 /**
  * Decode Opus file to fill buffer.
  *
+ * \param opusFile		File to decode.
  * \param bufferOut		Pointer to buffer.
  * \return				Samples read per channel.
  */
-uint64_t fillOpusBuffer(int16_t* bufferOut)
+uint64_t fillOpusBuffer(OggOpusFile* opusFile, int16_t* bufferOut)
 {
 	uint64_t samplesRead = 0;
 	int samplesToRead = buffSize;
@@ -138,16 +261,30 @@ uint64_t fillOpusBuffer(int16_t* bufferOut)
 }
 
 /**
- * Checks if the input file is Opus.
+ * Read the tags of an Opus file from its comment header.
  *
- * \param in	Input file.
- * \return		0 if Opus file, else not or failure.
+ * \param	stream	Opened Opus file, positioned at its start.
+ * \param	tags	Tags to store comments in.
+ * \return			0 on success, or -1 if the headers could not be read.
  */
-int isOpus(const char* in)
+int readOpusTags(struct stream_t* stream, struct tags_t* tags)
 {
-	int err = 0;
-	OggOpusFile* opusTest = op_test_file(in, &err);
+	OggOpusFile*	opusFile;
+	const OpusTags*	opusTags;
 
-	op_free(opusTest);
-	return err;
+	/* Only the headers are read, rather than also seeking to the end of the
+	 * file to find its duration. */
+	if((opusFile = op_test_callbacks(stream, &opusCallbacks, NULL, 0,
+					NULL)) == NULL)
+		return -1;
+
+	if((opusTags = op_tags(opusFile, -1)) != NULL)
+	{
+		for(int i = 0; i < opusTags->comments; i++)
+			addVorbisComment(tags, opusTags->user_comments[i],
+					opusTags->comment_lengths[i]);
+	}
+
+	op_free(opusFile);
+	return opusTags == NULL ? -1 : 0;
 }
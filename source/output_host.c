@@ -0,0 +1,281 @@
+#if !defined __arm__
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+
+/* Size of a canonical WAV header. */
+#define WAV_HEADER_SIZE	44
+
+/*
+ * Host sink. A thread takes submitted buffers in order, writes them to the
+ * WAV file if there is one, and sleeps for their duration if consuming at a
+ * multiple of real time.
+ */
+static struct
+{
+	Thread					thread;
+	LightLock				lock;
+	LightEvent				event;
+	volatile bool			exit;
+	volatile bool			paused;
+
+	/* Queue of submitted buffers. */
+	struct outputBuf_t*		head;
+	struct outputBuf_t*		tail;
+
+	void					(*callback)(void* data);
+	void*					data;
+
+	volatile uint32_t		rate;
+	volatile uint8_t		channels;
+	volatile size_t			position;
+
+	/* Multiple of real time, or 0 for as fast as possible. */
+	unsigned				speed;
+
+	/* WAV file, or empty for the null sink. */
+	char					file[PATH_MAX];
+	FILE*					wav;
+	uint32_t				wavRate;
+	uint8_t					wavChannels;
+	uint32_t				wavBytes;
+} sink;
+
+static void put16(uint8_t* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+/**
+ * Write WAV header for the samples written so far to the start of the file.
+ */
+static void writeWavHeader(void)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+
+	memcpy(header, "RIFF", 4);
+	put32(header + 4, WAV_HEADER_SIZE - 8 + sink.wavBytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put32(header + 16, 16);
+	put16(header + 20, 1);
+	put16(header + 22, sink.wavChannels);
+	put32(header + 24, sink.wavRate);
+	put32(header + 28, sink.wavRate * sink.wavChannels * sizeof(int16_t));
+	put16(header + 32, sink.wavChannels * sizeof(int16_t));
+	put16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put32(header + 40, sink.wavBytes);
+
+	fseek(sink.wav, 0, SEEK_SET);
+	fwrite(header, sizeof(header), 1, sink.wav);
+	fseek(sink.wav, 0, SEEK_END);
+}
+
+static void sinkThread(void* arg)
+{
+	(void)arg;
+
+	while(sink.exit == false)
+	{
+		struct outputBuf_t* buf;
+
+		LightLock_Lock(&sink.lock);
+		buf = sink.paused == true ? NULL : sink.head;
+		if(buf != NULL)
+			buf->status = OUTPUT_BUF_PLAYING;
+		LightLock_Unlock(&sink.lock);
+
+		if(buf == NULL)
+		{
+			LightEvent_Wait(&sink.event);
+			continue;
+		}
+
+		sink.position = 0;
+
+		if(sink.wav != NULL)
+		{
+			if(sink.wavRate == 0)
+			{
+				sink.wavRate = sink.rate;
+				sink.wavChannels = sink.channels;
+			}
+
+			sink.wavBytes += fwrite(buf->data, sizeof(int16_t),
+					buf->frames * sink.channels, sink.wav) * sizeof(int16_t);
+		}
+
+		if(sink.speed != 0)
+			svcSleepThread(buf->frames * 1000000000ULL /
+					(sink.rate * sink.speed));
+
+		sink.position = buf->frames;
+
+		/* The buffer may have been cleared whilst it played. */
+		LightLock_Lock(&sink.lock);
+		if(sink.head == buf)
+		{
+			sink.head = buf->next;
+			buf->status = OUTPUT_BUF_DONE;
+		}
+		LightLock_Unlock(&sink.lock);
+
+		if(sink.callback != NULL)
+			(*sink.callback)(sink.data);
+	}
+}
+
+static int initHost(void)
+{
+	if(sink.file[0] != '\0')
+	{
+		uint8_t header[WAV_HEADER_SIZE] = {0};
+
+		if((sink.wav = fopen(sink.file, "wb")) == NULL)
+			return errno;
+
+		/* Header is written once the format and length are known. */
+		fwrite(header, sizeof(header), 1, sink.wav);
+		sink.wavRate = 0;
+		sink.wavChannels = 0;
+		sink.wavBytes = 0;
+	}
+
+	LightLock_Init(&sink.lock);
+	LightEvent_Init(&sink.event, RESET_ONESHOT);
+	sink.exit = false;
+	sink.paused = false;
+	sink.head = sink.tail = NULL;
+	sink.rate = 48000;
+	sink.channels = 2;
+
+	if((sink.thread = threadCreate(sinkThread, NULL, 32 * 1024, 0x18, -2,
+					false)) == NULL)
+	{
+		if(sink.wav != NULL)
+			fclose(sink.wav);
+
+		sink.wav = NULL;
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+static void setCallbackHost(void (*callback)(void* data), void* data)
+{
+	sink.callback = callback;
+	sink.data = data;
+}
+
+static void clearHost(void)
+{
+	LightLock_Lock(&sink.lock);
+	sink.head = sink.tail = NULL;
+	LightLock_Unlock(&sink.lock);
+}
+
+static void resetHost(void)
+{
+	clearHost();
+	sink.paused = false;
+	LightEvent_Signal(&sink.event);
+}
+
+static void setFormatHost(uint32_t rate, uint8_t channels)
+{
+	sink.rate = rate;
+	sink.channels = channels;
+}
+
+static void submitHost(struct outputBuf_t* buf, const int16_t* data,
+		size_t frames)
+{
+	buf->data = data;
+	buf->frames = frames;
+	buf->status = OUTPUT_BUF_QUEUED;
+	buf->next = NULL;
+
+	LightLock_Lock(&sink.lock);
+	if(sink.head == NULL)
+		sink.head = buf;
+	else
+		sink.tail->next = buf;
+
+	sink.tail = buf;
+	LightLock_Unlock(&sink.lock);
+
+	LightEvent_Signal(&sink.event);
+}
+
+static enum output_status statusHost(const struct outputBuf_t* buf)
+{
+	return buf->status;
+}
+
+static void setPausedHost(bool paused)
+{
+	sink.paused = paused;
+	LightEvent_Signal(&sink.event);
+}
+
+static size_t positionHost(void)
+{
+	return sink.position;
+}
+
+static void exitHost(void)
+{
+	sink.exit = true;
+	LightEvent_Signal(&sink.event);
+	threadJoin(sink.thread, U64_MAX);
+	threadFree(sink.thread);
+	sink.thread = NULL;
+	sink.callback = NULL;
+
+	if(sink.wav != NULL)
+	{
+		writeWavHeader();
+		fclose(sink.wav);
+		sink.wav = NULL;
+	}
+}
+
+static void setHostOutput(struct output_fn* output)
+{
+	output->init = &initHost;
+	output->setCallback = &setCallbackHost;
+	output->reset = &resetHost;
+	output->setFormat = &setFormatHost;
+	output->submit = &submitHost;
+	output->status = &statusHost;
+	output->clear = &clearHost;
+	output->setPaused = &setPausedHost;
+	output->position = &positionHost;
+	output->exit = &exitHost;
+}
+
+void setNullOutput(struct output_fn* output, unsigned speed)
+{
+	setHostOutput(output);
+	sink.speed = speed;
+	sink.file[0] = '\0';
+}
+
+void setWavOutput(struct output_fn* output, const char* file)
+{
+	setHostOutput(output);
+	sink.speed = 0;
+	snprintf(sink.file, sizeof(sink.file), "%s", file);
+}
+#endif
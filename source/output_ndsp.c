@@ -0,0 +1,86 @@
+#if defined __arm__
+#include <3ds.h>
+#include <string.h>
+
+#include "error.h"
+#include "output.h"
+#include "playback.h"
+
+static int initNdsp(void)
+{
+	if(ndspInit() < 0)
+		return NDSP_INIT_FAIL;
+
+	ndspSetOutputMode(NDSP_OUTPUT_STEREO);
+	return 0;
+}
+
+static void setCallbackNdsp(void (*callback)(void* data), void* data)
+{
+	ndspSetCallback(callback, data);
+}
+
+static void resetNdsp(void)
+{
+	ndspChnReset(CHANNEL);
+	ndspChnWaveBufClear(CHANNEL);
+	ndspChnSetInterp(CHANNEL, NDSP_INTERP_POLYPHASE);
+}
+
+static void setFormatNdsp(uint32_t rate, uint8_t channels)
+{
+	ndspChnSetRate(CHANNEL, rate);
+	ndspChnSetFormat(CHANNEL, channels == 2 ?
+			NDSP_FORMAT_STEREO_PCM16 : NDSP_FORMAT_MONO_PCM16);
+}
+
+static void submitNdsp(struct outputBuf_t* buf, const int16_t* data,
+		size_t frames)
+{
+	memset(&buf->waveBuf, 0, sizeof(buf->waveBuf));
+	buf->waveBuf.data_vaddr = data;
+	buf->waveBuf.nsamples = frames;
+	ndspChnWaveBufAdd(CHANNEL, &buf->waveBuf);
+}
+
+static enum output_status statusNdsp(const struct outputBuf_t* buf)
+{
+	/* NDSP_WBUF_* values match output_status. */
+	return buf->waveBuf.status;
+}
+
+static void clearNdsp(void)
+{
+	ndspChnWaveBufClear(CHANNEL);
+}
+
+static void setPausedNdsp(bool paused)
+{
+	ndspChnSetPaused(CHANNEL, paused);
+}
+
+static size_t positionNdsp(void)
+{
+	return ndspChnGetSamplePos(CHANNEL);
+}
+
+static void exitNdsp(void)
+{
+	ndspSetCallback(NULL, NULL);
+	ndspExit();
+}
+
+void setNdspOutput(struct output_fn* output)
+{
+	output->init = &initNdsp;
+	output->setCallback = &setCallbackNdsp;
+	output->reset = &resetNdsp;
+	output->setFormat = &setFormatNdsp;
+	output->submit = &submitNdsp;
+	output->status = &statusNdsp;
+	output->clear = &clearNdsp;
+	output->setPaused = &setPausedNdsp;
+	output->position = &positionNdsp;
+	output->exit = &exitNdsp;
+}
+#endif
@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "platform.h"
+
+#if !defined __arm__
+
+struct thread_t
+{
+	pthread_t	thread;
+	ThreadFunc	entry;
+	void*		arg;
+};
+
+void LightLock_Init(LightLock* lock)
+{
+	pthread_mutex_init(lock, NULL);
+}
+
+void LightLock_Lock(LightLock* lock)
+{
+	pthread_mutex_lock(lock);
+}
+
+void LightLock_Unlock(LightLock* lock)
+{
+	pthread_mutex_unlock(lock);
+}
+
+void LightEvent_Init(LightEvent* event, ResetType type)
+{
+	pthread_mutex_init(&event->lock, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->signalled = false;
+	event->type = type;
+}
+
+void LightEvent_Clear(LightEvent* event)
+{
+	pthread_mutex_lock(&event->lock);
+	event->signalled = false;
+	pthread_mutex_unlock(&event->lock);
+}
+
+void LightEvent_Signal(LightEvent* event)
+{
+	pthread_mutex_lock(&event->lock);
+	event->signalled = true;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->lock);
+}
+
+void LightEvent_Wait(LightEvent* event)
+{
+	pthread_mutex_lock(&event->lock);
+	while(event->signalled == false)
+		pthread_cond_wait(&event->cond, &event->lock);
+
+	if(event->type == RESET_ONESHOT)
+		event->signalled = false;
+	pthread_mutex_unlock(&event->lock);
+}
+
+int LightEvent_WaitTimeout(LightEvent* event, s64 timeout_ns)
+{
+	struct timespec	deadline;
+	int				ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ns / 1000000000;
+	deadline.tv_nsec += timeout_ns % 1000000000;
+	if(deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&event->lock);
+	while(event->signalled == false && ret == 0)
+	{
+		if(pthread_cond_timedwait(&event->cond, &event->lock,
+					&deadline) == ETIMEDOUT)
+			ret = 1;
+	}
+
+	if(event->signalled == true && event->type == RESET_ONESHOT)
+	{
+		event->signalled = false;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&event->lock);
+
+	return ret;
+}
+
+static void* threadEntry(void* arg)
+{
+	struct thread_t* thread = arg;
+
+	(*thread->entry)(thread->arg);
+	return NULL;
+}
+
+Thread threadCreate(ThreadFunc entry, void* arg, size_t stack_size, int prio,
+		int core_id, bool detached)
+{
+	struct thread_t* thread;
+
+	(void)stack_size;
+	(void)prio;
+	(void)core_id;
+
+	if((thread = malloc(sizeof(struct thread_t))) == NULL)
+		return NULL;
+
+	thread->entry = entry;
+	thread->arg = arg;
+
+	if(pthread_create(&thread->thread, NULL, threadEntry, thread) != 0)
+	{
+		free(thread);
+		return NULL;
+	}
+
+	if(detached == true)
+		pthread_detach(thread->thread);
+
+	return thread;
+}
+
+Result threadJoin(Thread thread, u64 timeout_ns)
+{
+	(void)timeout_ns;
+	return pthread_join(thread->thread, NULL);
+}
+
+void threadFree(Thread thread)
+{
+	free(thread);
+}
+
+void svcSleepThread(s64 ns)
+{
+	struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+Result svcGetThreadPriority(s32* out, Handle handle)
+{
+	(void)handle;
+	*out = 0x30;
+	return 0;
+}
+
+Result svcCreateEvent(Handle* event, ResetType reset_type)
+{
+	LightEvent* e;
+
+	if((e = malloc(sizeof(LightEvent))) == NULL)
+		return -1;
+
+	LightEvent_Init(e, reset_type);
+	*event = (Handle)e;
+	return 0;
+}
+
+Result svcSignalEvent(Handle handle)
+{
+	LightEvent_Signal((LightEvent*)handle);
+	return 0;
+}
+
+Result svcWaitSynchronization(Handle handle, s64 timeout_ns)
+{
+	if(timeout_ns < 0)
+	{
+		LightEvent_Wait((LightEvent*)handle);
+		return 0;
+	}
+
+	return LightEvent_WaitTimeout((LightEvent*)handle, timeout_ns);
+}
+
+Result svcCloseHandle(Handle handle)
+{
+	free((LightEvent*)handle);
+	return 0;
+}
+
+Result APT_CheckNew3DS(bool* out)
+{
+	*out = false;
+	return 0;
+}
+
+u64 osGetTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+u64 svcGetSystemTick(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void* linearAlloc(size_t size)
+{
+	return malloc(size);
+}
+
+void linearFree(void* mem)
+{
+	free(mem);
+}
+
+Result DSP_FlushDataCache(const void* address, u32 size)
+{
+	(void)address;
+	(void)size;
+	return 0;
+}
+
+#endif
+
+/**
+ * Get the modification time of a file. On the 3DS, stat() leaves st_mtime
+ * of files on the SD card at 0, so it is read from the archive instead.
+ *
+ * \param	file	File location.
+ * \return			Modification time, or -1 on failure.
+ */
+int64_t getFileMtime(const char* file)
+{
+#if defined __arm__
+	u64 mtime;
+
+	if(R_FAILED(archive_getmtime(file, &mtime)))
+		return -1;
+
+	return mtime;
+#else
+	struct stat st;
+
+	return stat(file, &st) == 0 ? st.st_mtime : -1;
+#endif
+}
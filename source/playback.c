@@ -1,4 +1,3 @@
-#include <3ds.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +8,251 @@
 #include "flac.h"
 #include "mp3.h"
 #include "opus.h"
+#include "output.h"
+#include "platform.h"
 #include "playback.h"
+#include "stream.h"
 #include "vorbis.h"
 #include "wav.h"
 #include "sid.h"
 
-static volatile bool stop = true;
+/* Maximum number of commands waiting for the playback engine. */
+#define ENGINE_QUEUE_LEN	16
+
+/* Commands sent from the UI to the playback engine. */
+enum engine_cmd
+{
+	ENGINE_CMD_NONE = 0,
+	ENGINE_CMD_PLAY,
+	ENGINE_CMD_STOP,
+	ENGINE_CMD_PAUSE,
+	ENGINE_CMD_NEXT,
+	ENGINE_CMD_SEEK,
+	ENGINE_CMD_EXIT
+};
+
+/*
+ * Maximum number of decoded blocks held between the decode thread and the
+ * DSP. The decode thread also stops once the blocks it holds are longer than
+ * playbackInfo_t.decodeAheadMs.
+ */
+#define RING_BLOCKS			16
+
+#if RING_BLOCKS < WAVEBUFS_MAX
+#error "RING_BLOCKS must be able to fill the output queue."
+#endif
+
+/* Files that may be decoded ahead of the file that is playing. */
+#define TRACK_QUEUE_LEN		4
+
+/* Longest the engine thread sleeps without an event, in nanoseconds. */
+#define ENGINE_WAIT_NS		(500 * 1000 * 1000)
+
+/* Second application core, only available on the New 3DS. */
+#define DECODE_CORE_N3DS	2
+
+/* Buffer of samples in the linear heap, so that the DSP can read it. */
+struct pcmBuffer_t
+{
+	int16_t*	data;
+	size_t		size;
+};
+
+/* Block of decoded samples. */
+struct pcmBlock_t
+{
+	struct pcmBuffer_t	buffer;
+	struct outputBuf_t	outBuf;
+
+	/* Interleaved samples in block. */
+	size_t				samples;
+	uint32_t			rate;
+	uint8_t				channels;
+	uint32_t			ms;
+
+	/* File that the block was decoded from. */
+	unsigned			gen;
+};
+
+/* File opened by the decode thread. */
+struct track_t
+{
+	char		file[PATH_MAX];
+	size_t		samples_total;
+	size_t		samples_per_second;
+};
+
+/*
+ * Decoded blocks, passed from the decode thread to the engine thread without
+ * locking. Only the decode thread writes blocks between tail and head and
+ * advances head. Only the engine thread reads blocks between tail and head
+ * and advances tail once the DSP has played them.
+ */
+static struct
+{
+	struct pcmBlock_t	block[RING_BLOCKS];
+	unsigned			head;
+	unsigned			tail;
+
+	/* Duration of the blocks between tail and head. */
+	uint32_t			ms;
+
+	/* Signalled by the engine thread when it frees a block. */
+	LightEvent			space;
+} ring;
+
+/* State of the decode thread. */
+static struct
+{
+	Thread				thread;
+
+	/* Signalled to start decoding, and when decoding has stopped. */
+	LightEvent			start;
+	LightEvent			idle;
+
+	/* Opened file to decode, or NULL to decode the queued next file
+	 * instead. Closed by the decode thread. */
+	struct stream_t*	stream;
+
+	/* Path of the queued file. */
+	char				file[PATH_MAX];
+
+	volatile bool		running;
+	volatile bool		abort;
+	volatile bool		exit;
+
+	/* All blocks have been decoded. */
+	volatile bool		done;
+
+	/* Error opening the first file, or 0. */
+	volatile int		error;
+
+	/* Sample of each channel of the first file to start decoding from. */
+	uint64_t			startFrame;
+
+	/* Set by the engine thread to seek the file of generation seekGen to
+	 * seekFrame, and cleared by the decode thread once it has tried, with
+	 * seeked signalled and the result in seekResult. */
+	volatile bool		seeking;
+	unsigned			seekGen;
+	uint64_t			seekFrame;
+	int					seekResult;
+	LightEvent			seeked;
+
+	/* Generation of the first file decoded when next started. */
+	unsigned			gen;
+
+	/* Files decoded, indexed by generation. */
+	struct track_t		tracks[TRACK_QUEUE_LEN];
+} decode;
+
+static struct
+{
+	Thread					thread;
+	struct playbackInfo_t*	info;
+	struct output_fn		output;
+	bool					isOutputInit;
+
+	/* Queue of commands from the UI. */
+	LightLock				lock;
+	LightEvent				event;
+	enum engine_cmd			queue[ENGINE_QUEUE_LEN];
+	unsigned				head;
+	unsigned				tail;
+
+	/* Files requested by the most recent ENGINE_CMD_PLAY. */
+	struct stream_t*		playStream;
+	char					playNext[PATH_MAX];
+	bool					playQueued;
+
+	/* Tick at which the playing file was opened, or 0 once it started. */
+	u64						openTick;
+
+	/* File to play after the current one in gapless mode. */
+	char					nextFile[PATH_MAX];
+	bool					nextQueued;
+
+	/* Offset requested with seekPlayback() and not yet made. */
+	int64_t					seekMs;
+	bool					seekQueued;
+
+	/* Generation of the file that is playing. */
+	volatile unsigned		gen;
+
+	/* Blocks queued on the output at once. */
+	volatile unsigned		waveBufs;
+
+	/* Oldest queued buffer, checked by the output callback. */
+	struct outputBuf_t* volatile	watch;
+
+	/* Engine thread waits for the decode thread to publish a block. */
+	bool					starved;
+
+	/* Tick at which the oldest queued buffer was seen done, or 0. */
+	volatile u64			doneTick;
+
+	/* Wakeups of the engine thread since wakeupTime. */
+	unsigned				wakeups;
+	u64						wakeupTime;
+
+	volatile bool			playing;
+	volatile bool			paused;
+} engine;
+
+/* Counters of each field are only written by one thread. */
+static struct playbackStats_t stats;
+
+/* The linear heap allocator is used by the engine and decode threads. */
+static LightLock linearLock;
+
+/**
+ * Add a command to the engine queue.
+ *
+ * \return	0 on success, or -1 if the queue is full.
+ */
+static int pushCommand(enum engine_cmd cmd)
+{
+	int ret = -1;
+
+	LightLock_Lock(&engine.lock);
+	if(engine.tail - engine.head < ENGINE_QUEUE_LEN)
+	{
+		engine.queue[engine.tail++ % ENGINE_QUEUE_LEN] = cmd;
+		ret = 0;
+	}
+	LightLock_Unlock(&engine.lock);
+
+	LightEvent_Signal(&engine.event);
+	return ret;
+}
+
+/**
+ * Get the next command for the engine without removing it from the queue.
+ *
+ * \return	Next command, or ENGINE_CMD_NONE if the queue is empty.
+ */
+static enum engine_cmd peekCommand(void)
+{
+	enum engine_cmd cmd = ENGINE_CMD_NONE;
+
+	LightLock_Lock(&engine.lock);
+	if(engine.head != engine.tail)
+		cmd = engine.queue[engine.head % ENGINE_QUEUE_LEN];
+	LightLock_Unlock(&engine.lock);
+
+	return cmd;
+}
+
+/**
+ * Remove the next command from the engine queue.
+ */
+static void popCommand(void)
+{
+	LightLock_Lock(&engine.lock);
+	if(engine.head != engine.tail)
+		engine.head++;
+	LightLock_Unlock(&engine.lock);
+}
 
 /**
  * Pause or play current file.
@@ -23,17 +261,68 @@ static volatile bool stop = true;
  */
 bool togglePlayback(void)
 {
-	bool paused = ndspChnIsPaused(CHANNEL);
-	ndspChnSetPaused(CHANNEL, !paused);
-	return !paused;
+	engine.paused = !engine.paused;
+	pushCommand(ENGINE_CMD_PAUSE);
+	return engine.paused;
 }
 
 /**
- * Stops current playback. Playback thread should exit as a result.
+ * Stops current playback.
  */
 void stopPlayback(void)
 {
-	stop = true;
+	pushCommand(ENGINE_CMD_STOP);
+}
+
+/**
+ * Skip to the file queued with queueNextFile(). PLAYBACK_NEXT_TRACK is
+ * signalled once it is playing.
+ */
+void skipPlayback(void)
+{
+	pushCommand(ENGINE_CMD_NEXT);
+}
+
+/**
+ * Move playback of the current file forwards or backwards. Offsets requested
+ * before the engine makes the seek are added together.
+ *
+ * \param	ms	Offset from the position playing, in milliseconds.
+ */
+void seekPlayback(int32_t ms)
+{
+	bool push = false;
+
+	LightLock_Lock(&engine.lock);
+	engine.seekMs += ms;
+	if(engine.seekQueued == false)
+		push = engine.seekQueued = true;
+	LightLock_Unlock(&engine.lock);
+
+	if(push == true && pushCommand(ENGINE_CMD_SEEK) != 0)
+	{
+		LightLock_Lock(&engine.lock);
+		engine.seekQueued = false;
+		LightLock_Unlock(&engine.lock);
+	}
+}
+
+/**
+ * Take the offset requested with seekPlayback().
+ *
+ * \return	Offset in milliseconds.
+ */
+static int64_t takeSeek(void)
+{
+	int64_t ms;
+
+	LightLock_Lock(&engine.lock);
+	ms = engine.seekMs;
+	engine.seekMs = 0;
+	engine.seekQueued = false;
+	LightLock_Unlock(&engine.lock);
+
+	return ms;
 }
 
 /**
@@ -41,185 +330,1088 @@ void stopPlayback(void)
  */
 bool isPlaying(void)
 {
-	return !stop;
+	return engine.playing;
 }
 
 /**
- * Should only be called from a new thread only, and have only one playback
- * thread at time. This function has not been written for more than one
- * playback thread in mind.
+ * Stop the current file and play another.
  *
- * \param	infoIn	Playback information.
+ * \param	stream	Opened file to play. On success, it is closed by the
+ *					playback engine.
+ * \param	next	File to play after it in gapless mode, or NULL.
+ * \return			0 on success, or -1 if a path is too long.
  */
-void playFile(void* infoIn)
+int startPlayback(struct stream_t* stream, const char* next)
 {
-	struct decoder_fn decoder = { 0 };
-	struct playbackInfo_t* info = infoIn;
-	int16_t*		buffer1 = NULL;
-	int16_t*		buffer2 = NULL;
-	ndspWaveBuf		waveBuf[2];
-	bool			lastbuf = false;
-	int				ret = -1;
-	const char*		file = info->file;
-	bool			isNdspInit = false;
+	struct stream_t* superseded = NULL;
+	bool push = false;
+	int ret = 0;
 
-	/* Reset previous stop command */
-	stop = false;
+	LightLock_Lock(&engine.lock);
+	if(next != NULL && memccpy(engine.playNext, next, '\0',
+				sizeof(engine.playNext)) == NULL)
+		ret = -1;
+	else if(next == NULL)
+		engine.playNext[0] = '\0';
 
-	switch(getFileType(file))
+	/* Only the most recently requested file is played. */
+	if(ret == 0)
+	{
+		superseded = engine.playStream;
+		engine.playStream = stream;
+
+		if(engine.playQueued == false)
+			push = engine.playQueued = true;
+	}
+	LightLock_Unlock(&engine.lock);
+
+	closeStream(superseded);
+	if(ret == 0)
+		preloadFile(next);
+
+	if(push == true && pushCommand(ENGINE_CMD_PLAY) != 0)
+	{
+		LightLock_Lock(&engine.lock);
+		engine.playStream = NULL;
+		engine.playQueued = false;
+		LightLock_Unlock(&engine.lock);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/**
+ * Set the file to play after the current one in gapless mode, or when
+ * skipping with skipPlayback().
+ *
+ * \param	file	File to play next, or NULL to play nothing after the
+ *					current file.
+ * \return			0 on success, or -1 if the file path is too long.
+ */
+int queueNextFile(const char* file)
+{
+	int ret = 0;
+
+	LightLock_Lock(&engine.lock);
+	engine.nextQueued = false;
+
+	if(file != NULL)
+	{
+		if(memccpy(engine.nextFile, file, '\0',
+					sizeof(engine.nextFile)) == NULL)
+			ret = -1;
+		else
+			engine.nextQueued = true;
+	}
+	LightLock_Unlock(&engine.lock);
+
+	if(ret == 0)
+		preloadFile(file);
+
+	return ret;
+}
+
+/**
+ * Select and initialise a decoder for an opened file.
+ *
+ * \param	decoder	Decoder to initialise.
+ * \param	stream	Opened file. On success, it is closed by the decoder.
+ *					On failure, it is closed before returning.
+ * \param	type	Output type of file.
+ * \return			0 on success, else error number.
+ */
+int openDecoder(struct decoder_fn* decoder, struct stream_t* stream,
+		enum file_types* type)
+{
+	switch(*type = stream->type)
 	{
 		case FILE_TYPE_WAV:
-			setWav(&decoder);
+			setWav(decoder);
 			break;
 
 		case FILE_TYPE_FLAC:
-			setFlac(&decoder);
+			setFlac(decoder);
 			break;
 
 		case FILE_TYPE_OPUS:
-			setOpus(&decoder);
+			setOpus(decoder);
 			break;
 
 		case FILE_TYPE_MP3:
-			setMp3(&decoder);
+			setMp3(decoder);
 			break;
 
 		case FILE_TYPE_VORBIS:
-			setVorbis(&decoder);
+			setVorbis(decoder);
 			break;
-		
+
 		case FILE_TYPE_SID:
-			setSid(&decoder);
+			setSid(decoder);
 			break;
 
 		default:
-			goto err;
+			closeStream(stream);
+			return FILE_NOT_SUPPORTED;
+	}
+
+	if((*decoder->init)(decoder, stream) != 0)
+	{
+		closeStream(stream);
+		return DECODER_INIT_FAIL;
+	}
+
+	if((*decoder->channels)(decoder->ctx) > 2 ||
+			(*decoder->channels)(decoder->ctx) < 1)
+	{
+		(*decoder->exit)(decoder->ctx);
+		return UNSUPPORTED_CHANNELS;
+	}
+
+	return 0;
+}
+
+/**
+ * Ensure a buffer holds at least the given number of samples. Must not be
+ * called whilst the DSP may be reading from the buffer.
+ *
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int reserveBuffer(struct pcmBuffer_t* buffer, size_t size)
+{
+	if(buffer->size >= size)
+		return 0;
+
+	LightLock_Lock(&linearLock);
+	linearFree(buffer->data);
+	buffer->size = 0;
+
+	if((buffer->data = linearAlloc(size * sizeof(int16_t))) != NULL)
+		buffer->size = size;
+	LightLock_Unlock(&linearLock);
+
+	return buffer->data == NULL ? -1 : 0;
+}
+
+/**
+ * Take the file queued with queueNextFile().
+ *
+ * \param	file	Output path of size PATH_MAX, or NULL to only check
+ *					whether a file is queued.
+ * \return			true if a file was queued.
+ */
+static bool takeNextFile(char* file)
+{
+	bool queued;
+
+	LightLock_Lock(&engine.lock);
+	queued = engine.nextQueued;
+	if(file != NULL)
+	{
+		memcpy(file, engine.nextFile, PATH_MAX);
+		engine.nextQueued = false;
 	}
+	LightLock_Unlock(&engine.lock);
+
+	return queued;
+}
+
+/**
+ * Open the file queued with queueNextFile() and a decoder for it.
+ *
+ * \param	decoder	Decoder to initialise.
+ * \param	type	Output type of file.
+ * \return			0 on success, else error number.
+ */
+static int openNextFile(struct decoder_fn* decoder, enum file_types* type)
+{
+	struct stream_t* stream;
+
+	if(takeNextFile(decode.file) == false)
+		return ENOENT;
+
+	if((stream = openStream(decode.file)) == NULL)
+		return errno;
+
+	stream->playing = true;
+	startReadAhead(stream);
+	return openDecoder(decoder, stream, type);
+}
+
+/**
+ * Signal the UI thread.
+ *
+ * \param	error	Error number, or PLAYBACK_* value.
+ */
+static void signalInfo(struct playbackInfo_t* info, int error)
+{
+	*info->errInfo->error = error;
+	svcSignalEvent(*info->errInfo->failEvent);
+}
+
+/**
+ * Wake the engine thread if it is waiting for decoded blocks.
+ */
+static void wakeEngine(void)
+{
+	if(__atomic_exchange_n(&engine.starved, false, __ATOMIC_SEQ_CST) == true)
+		LightEvent_Signal(&engine.event);
+}
+
+/**
+ * Seek the file being decoded to the sample requested by the engine thread,
+ * which waits with the output cleared, and empty the ring on success.
+ *
+ * \param	decoder	Decoder of the file, or NULL if no file is open.
+ * \param	gen		Generation of the file.
+ */
+static void seekDecoder(struct decoder_fn* decoder, unsigned gen)
+{
+	int ret = -1;
 
-	if(ndspInit() < 0)
+	/* Once the next file is opened, the engine reopens the file instead. */
+	if(decoder != NULL && decoder->seek != NULL && gen == decode.seekGen &&
+			(ret = (*decoder->seek)(decoder->ctx, decode.seekFrame)) == 0)
 	{
-		errno = NDSP_INIT_FAIL;
-		goto err;
+		ring.head = ring.tail = ring.ms = 0;
 	}
 
-	isNdspInit = true;
+	decode.seekResult = ret;
+	__atomic_store_n(&decode.seeking, false, __ATOMIC_SEQ_CST);
+	LightEvent_Signal(&decode.seeked);
+}
 
-	if((ret = (*decoder.init)(file)) != 0)
+/**
+ * Wait until the ring has a free block and holds less than the decode ahead
+ * duration, or a seek is requested.
+ *
+ * \return	false if decoding was aborted.
+ */
+static bool waitForSpace(void)
+{
+	while(decode.abort == false)
 	{
-		errno = DECODER_INIT_FAIL;
-		goto err;
+		if(__atomic_load_n(&decode.seeking, __ATOMIC_ACQUIRE) == true)
+			return true;
+
+		unsigned used = ring.head - __atomic_load_n(&ring.tail,
+				__ATOMIC_ACQUIRE);
+
+		/* Always allow enough blocks to fill the channel queue. */
+		if(used < engine.waveBufs || (used < RING_BLOCKS &&
+					__atomic_load_n(&ring.ms, __ATOMIC_ACQUIRE) <
+					engine.info->decodeAheadMs))
+			return true;
+
+		LightEvent_WaitTimeout(&ring.space, 10 * 1000 * 1000);
 	}
 
-	if((*decoder.channels)() > 2 || (*decoder.channels)() < 1)
+	return false;
+}
+
+/**
+ * Wait until the engine thread has started playing a file far enough behind
+ * the given file, so that its information may be stored.
+ *
+ * \return	false if decoding was aborted.
+ */
+static bool waitForTrack(unsigned gen)
+{
+	while(decode.abort == false)
 	{
-		errno = UNSUPPORTED_CHANNELS;
-		goto err;
+		if(__atomic_load_n(&decode.seeking, __ATOMIC_ACQUIRE) == true)
+			seekDecoder(NULL, gen);
+
+		if(gen - engine.gen < TRACK_QUEUE_LEN)
+			return true;
+
+		LightEvent_WaitTimeout(&ring.space, 10 * 1000 * 1000);
 	}
 
-	if(decoder.getFileSamples != NULL)
-		info->samples_total = decoder.getFileSamples();
+	return false;
+}
+
+static uint32_t ticksToUs(u64 ticks)
+{
+	return ticks * 1000000 / SYSCLOCK_ARM11;
+}
+
+/**
+ * Record the time taken to decode a block.
+ *
+ * \param	type	Type of file decoded.
+ * \param	ticks	System ticks taken to decode.
+ * \param	block	Decoded block.
+ */
+static void recordDecode(enum file_types type, u64 ticks,
+		const struct pcmBlock_t* block)
+{
+	uint32_t us = ticksToUs(ticks);
+	unsigned bucket = 0;
+
+	while(bucket < STATS_HIST_BUCKETS - 1 && us >= (1000U << bucket))
+		bucket++;
+
+	stats.decodeHist[bucket]++;
+	if(us > stats.decodeMaxUs)
+		stats.decodeMaxUs = us;
 
-	info->samples_per_second = decoder.rate() * decoder.channels();
-	buffer1 = linearAlloc(decoder.buffSize * sizeof(int16_t));
-	buffer2 = linearAlloc(decoder.buffSize * sizeof(int16_t));
+	stats.decodeUs[type] += us;
+	stats.audioUs[type] += (uint64_t)block->samples * 1000000 /
+		(block->rate * block->channels);
+}
 
-	ndspChnReset(CHANNEL);
-	ndspChnWaveBufClear(CHANNEL);
-	ndspSetOutputMode(NDSP_OUTPUT_STEREO);
-	ndspChnSetInterp(CHANNEL, NDSP_INTERP_POLYPHASE);
-	ndspChnSetRate(CHANNEL, (*decoder.rate)());
-	ndspChnSetFormat(CHANNEL,
-			(*decoder.channels)() == 2 ? NDSP_FORMAT_STEREO_PCM16 :
-			NDSP_FORMAT_MONO_PCM16);
+/**
+ * Decode decode.stream, followed by queued files in gapless mode, into the
+ * ring until it ends or decoding is aborted.
+ */
+static void decodeFiles(void)
+{
+	struct decoder_fn	decoder;
+	enum file_types		type;
+	struct stream_t*	stream = decode.stream;
+	unsigned			gen = decode.gen;
+	bool				ended;
+	int					err;
 
-	memset(waveBuf, 0, sizeof(waveBuf));
-	waveBuf[0].nsamples = (*decoder.decode)(&buffer1[0]) / (*decoder.channels)();
-	waveBuf[0].data_vaddr = &buffer1[0];
-	ndspChnWaveBufAdd(CHANNEL, &waveBuf[0]);
+	decode.stream = NULL;
+	if(stream != NULL)
+	{
+		memcpy(decode.file, stream->file, sizeof(decode.file));
+		stream->playing = true;
+		startReadAhead(stream);
+	}
 
-	waveBuf[1].nsamples = (*decoder.decode)(&buffer2[0]) / (*decoder.channels)();
-	waveBuf[1].data_vaddr = &buffer2[0];
-	ndspChnWaveBufAdd(CHANNEL, &waveBuf[1]);
+	if((err = stream != NULL ? openDecoder(&decoder, stream, &type) :
+				openNextFile(&decoder, &type)) != 0)
+	{
+		decode.error = err;
+		goto out;
+	}
 
-	/**
-	 * There may be a chance that the music has not started by the time we get
-	 * to the while loop. So we ensure that music has started here.
-	 */
-	while(ndspChnIsPlaying(CHANNEL) == false);
+	/* A file reopened to seek has ended if the seek fails, such as past the
+	 * end of a file whose length was only estimated. */
+	ended = decode.startFrame != 0 && (decoder.seek == NULL ||
+			(*decoder.seek)(decoder.ctx, decode.startFrame) != 0);
 
-	while(stop == false)
+	while(true)
 	{
-		svcSleepThread(100 * 1000);
+		struct track_t* track = &decode.tracks[gen % TRACK_QUEUE_LEN];
 
-		/* When the last buffer has finished playing, break. */
-		if(lastbuf == true && waveBuf[0].status == NDSP_WBUF_DONE &&
-				waveBuf[1].status == NDSP_WBUF_DONE)
+		memcpy(track->file, decode.file, sizeof(track->file));
+		track->samples_total = 0;
+		if(decoder.getFileSamples != NULL)
+			track->samples_total = decoder.getFileSamples(decoder.ctx);
+
+		track->samples_per_second = decoder.rate(decoder.ctx) *
+			decoder.channels(decoder.ctx);
+
+		while(ended == false && waitForSpace() == true)
+		{
+			struct pcmBlock_t* block;
+			size_t read;
+			u64 tick;
+
+			if(__atomic_load_n(&decode.seeking, __ATOMIC_ACQUIRE) == true)
+			{
+				seekDecoder(&decoder, gen);
+				continue;
+			}
+
+			block = &ring.block[ring.head % RING_BLOCKS];
+			if(reserveBuffer(&block->buffer, decoder.buffSize) != 0)
+				break;
+
+			tick = svcGetSystemTick();
+			read = (*decoder.decode)(decoder.ctx, block->buffer.data);
+			tick = svcGetSystemTick() - tick;
+
+			if(read <= 0)
+				break;
+
+			block->samples = read;
+			block->rate = decoder.rate(decoder.ctx);
+			block->channels = decoder.channels(decoder.ctx);
+			block->ms = read * 1000 / (block->rate * block->channels);
+			block->gen = gen;
+			recordDecode(type, tick, block);
+
+			/* An estimated length may have been made exact. */
+			if(decoder.getFileSamples != NULL)
+				__atomic_store_n(&track->samples_total,
+						decoder.getFileSamples(decoder.ctx), __ATOMIC_RELAXED);
+
+			/* The DSP reads from memory, not the CPU cache. */
+			DSP_FlushDataCache(block->buffer.data, read * sizeof(int16_t));
+
+			__atomic_add_fetch(&ring.ms, block->ms, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring.head, ring.head + 1, __ATOMIC_SEQ_CST);
+			wakeEngine();
+		}
+
+		(*decoder.exit)(decoder.ctx);
+		ended = false;
+
+		if(decode.abort == true)
+			break;
+
+		/* Continue with the queued file in gapless mode. */
+		if(engine.info->gapless == false ||
+				takeNextFile(NULL) == false ||
+				waitForTrack(gen + 1) == false ||
+				openNextFile(&decoder, &type) != 0)
 			break;
 
-		if(ndspChnIsPaused(CHANNEL) == true || lastbuf == true)
+		gen++;
+	}
+
+	decode.gen = gen + 1;
+
+out:
+	__atomic_store_n(&decode.done, true, __ATOMIC_SEQ_CST);
+	wakeEngine();
+}
+
+/**
+ * Decode thread. Decodes files into the ring when started by the engine
+ * thread, so that slow decoding or file access doesn't delay the DSP.
+ */
+static void decodeThread(void* arg)
+{
+	(void)arg;
+
+	while(true)
+	{
+		LightEvent_Wait(&decode.start);
+
+		if(decode.exit == true)
+			break;
+
+		decodeFiles();
+		decode.running = false;
+		LightEvent_Signal(&decode.idle);
+	}
+}
+
+/**
+ * Empty the ring and start the decode thread. The decode thread must be
+ * idle.
+ *
+ * \param	stream	Opened file to decode, which the decode thread closes, or
+ *					NULL to decode the queued next file.
+ * \param	frame	Sample of each channel of the file to start from.
+ */
+static void startDecode(struct stream_t* stream, uint64_t frame)
+{
+	ring.head = ring.tail = ring.ms = 0;
+	decode.stream = stream;
+	decode.startFrame = frame;
+
+	decode.abort = false;
+	decode.done = false;
+	decode.error = 0;
+	decode.running = true;
+
+	LightEvent_Clear(&decode.idle);
+	LightEvent_Signal(&decode.start);
+}
+
+/**
+ * Stop the decode thread and wait until it is idle.
+ */
+static void stopDecode(void)
+{
+	decode.abort = true;
+	LightEvent_Signal(&ring.space);
+
+	if(decode.running == true)
+		LightEvent_Wait(&decode.idle);
+}
+
+/**
+ * Ask the decode thread to seek the file playing, if it is still decoding
+ * it, and wait for it to try.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, or -1 if the file must be reopened to seek.
+ */
+static int seekDecode(uint64_t frame)
+{
+	decode.seekGen = engine.gen;
+	decode.seekFrame = frame;
+	LightEvent_Clear(&decode.seeked);
+	__atomic_store_n(&decode.seeking, true, __ATOMIC_SEQ_CST);
+	LightEvent_Signal(&ring.space);
+
+	/* The decode thread may have finished decoding and gone idle. */
+	while(__atomic_load_n(&decode.seeking, __ATOMIC_SEQ_CST) == true &&
+			decode.running == true)
+		LightEvent_WaitTimeout(&decode.seeked, 10 * 1000 * 1000);
+
+	if(__atomic_exchange_n(&decode.seeking, false, __ATOMIC_SEQ_CST) == true)
+		return -1;
+
+	return decode.seekResult;
+}
+
+/**
+ * Decode the file playing again from a sample, once the decode thread has
+ * moved on from it. In gapless mode, the file that followed it is queued
+ * again.
+ *
+ * \param	frame	Sample of each channel.
+ */
+static void reopenDecode(uint64_t frame)
+{
+	struct track_t*		track = &decode.tracks[engine.gen % TRACK_QUEUE_LEN];
+	struct stream_t*	stream;
+
+	stopDecode();
+
+	LightLock_Lock(&engine.lock);
+	if(engine.nextQueued == false && decode.gen - engine.gen > 1)
+	{
+		memcpy(engine.nextFile, decode.tracks[(engine.gen + 1) %
+				TRACK_QUEUE_LEN].file, sizeof(engine.nextFile));
+		engine.nextQueued = true;
+	}
+	LightLock_Unlock(&engine.lock);
+
+	/* Playback ends once the empty ring is played if the file has gone. */
+	if((stream = openStream(track->file)) == NULL)
+	{
+		ring.head = ring.tail = ring.ms = 0;
+		return;
+	}
+
+	decode.gen = engine.gen;
+	startDecode(stream, frame);
+}
+
+/**
+ * Move playback of the file playing by the offset requested with
+ * seekPlayback(). Queued blocks are dropped, so that the new position plays
+ * as soon as its first block is decoded.
+ *
+ * \param	rate		Sampling rate of the file playing.
+ * \param	channels	Channels of the file playing.
+ * \return				true if the ring was emptied.
+ */
+static bool seekTrack(struct playbackInfo_t* info, uint32_t rate,
+		uint8_t channels)
+{
+	int64_t ms = takeSeek();
+	int64_t frame;
+	int64_t total;
+
+	if(ms == 0 || rate == 0 || channels == 0)
+		return false;
+
+	frame = (int64_t)(info->samples_played / channels) + ms * rate / 1000;
+	total = info->samples_total / channels;
+	if(total != 0 && frame >= total)
+		frame = total - 1;
+
+	if(frame < 0)
+		frame = 0;
+
+	/* The DSP must not read blocks while the decode thread reuses them. */
+	(*engine.output.clear)();
+	engine.watch = NULL;
+	engine.doneTick = 0;
+
+	if(seekDecode(frame) != 0)
+		reopenDecode(frame);
+
+	info->samples_played = frame * channels;
+	return true;
+}
+
+/**
+ * Update playback information once the first block of a file starts playing.
+ *
+ * \param	info	Playback information.
+ * \param	gen		Generation of the file.
+ * \param	signal	Signal PLAYBACK_NEXT_TRACK to the UI thread.
+ */
+static void startTrack(struct playbackInfo_t* info, unsigned gen, bool signal)
+{
+	struct track_t* track = &decode.tracks[gen % TRACK_QUEUE_LEN];
+
+	memcpy(info->file, track->file, sizeof(info->file));
+	info->samples_total = track->samples_total;
+	info->samples_per_second = track->samples_per_second;
+	info->samples_played = 0;
+	engine.gen = gen;
+
+	/* Allow the decode thread to store another file. */
+	LightEvent_Signal(&ring.space);
+
+	if(signal == true)
+		signalInfo(info, PLAYBACK_NEXT_TRACK);
+}
+
+/**
+ * Output callback, called once per NDSP frame on the 3DS. Wakes the engine
+ * thread once the oldest queued buffer has been played.
+ */
+static void outputCallback(void* data)
+{
+	struct outputBuf_t* buf = engine.watch;
+
+	(void)data;
+
+	if(buf != NULL && (*engine.output.status)(buf) == OUTPUT_BUF_DONE)
+	{
+		engine.watch = NULL;
+		if(engine.doneTick == 0)
+			engine.doneTick = svcGetSystemTick();
+
+		LightEvent_Signal(&engine.event);
+	}
+}
+
+/**
+ * Sleep until the DSP has played the oldest queued block, the decode thread
+ * publishes a block that the channel has room for, or a command arrives.
+ *
+ * \param	sub		Blocks up to sub have been handed to the DSP.
+ * \param	head	Ring head when blocks were last handed to the DSP.
+ */
+static void waitForEvent(struct playbackInfo_t* info, unsigned sub,
+		unsigned head)
+{
+	u64 now;
+
+	engine.watch = NULL;
+	if(engine.paused == false && ring.tail != sub)
+		engine.watch = &ring.block[ring.tail % RING_BLOCKS].outBuf;
+
+	if(engine.paused == false && sub == head &&
+			sub - ring.tail < engine.waveBufs)
+	{
+		__atomic_store_n(&engine.starved, true, __ATOMIC_SEQ_CST);
+
+		/* Don't sleep through a block published before starved was set. */
+		if(__atomic_load_n(&ring.head, __ATOMIC_SEQ_CST) != head ||
+				(__atomic_load_n(&decode.done, __ATOMIC_SEQ_CST) == true &&
+				 ring.tail == head))
+		{
+			engine.starved = false;
+			return;
+		}
+	}
+
+	/* Several commands may have been pushed for one signal. */
+	if(peekCommand() == ENGINE_CMD_NONE)
+		LightEvent_WaitTimeout(&engine.event, ENGINE_WAIT_NS);
+
+	engine.starved = false;
+	engine.wakeups++;
+
+	if((now = osGetTime()) - engine.wakeupTime >= 1000)
+	{
+		info->wakeupsPerSec = engine.wakeups * 1000 /
+			(now - engine.wakeupTime);
+		engine.wakeups = 0;
+		engine.wakeupTime = now;
+	}
+}
+
+/**
+ * Hand decoded blocks to the DSP until playback ends, playback is stopped,
+ * or another command that the engine must handle arrives. The decode thread
+ * must have been started.
+ *
+ * In gapless mode, the decode thread continues with the file queued with
+ * queueNextFile() and its blocks are queued directly after those of the
+ * current file. PLAYBACK_NEXT_TRACK is then signalled once the next file
+ * starts playing.
+ *
+ * \param	info	Playback information.
+ */
+static void playRing(struct playbackInfo_t* info)
+{
+	/* Blocks from tail up to sub have been handed to the DSP. */
+	unsigned		sub = 0;
+	unsigned		head = 0;
+	uint32_t		rate = 0;
+	uint8_t			channels = 0;
+	/* A file has started playing. */
+	bool			started = false;
+	/* Playback was stopped by a command rather than the file ending. */
+	bool			stopped = false;
+
+	(*engine.output.reset)();
+
+	engine.playing = true;
+	engine.wakeups = 0;
+	engine.wakeupTime = osGetTime();
+
+	while(true)
+	{
+		enum engine_cmd cmd;
+		unsigned submitted;
+		bool released;
+
+		waitForEvent(info, sub, head);
+
+		/* Commands that end playback are left for the engine to handle. */
+		if((cmd = peekCommand()) == ENGINE_CMD_PLAY || cmd == ENGINE_CMD_EXIT)
+		{
+			stopped = true;
+			break;
+		}
+
+		if(cmd != ENGINE_CMD_NONE)
+			popCommand();
+
+		if(cmd == ENGINE_CMD_STOP)
+		{
+			stopped = true;
+			break;
+		}
+
+		if(cmd == ENGINE_CMD_PAUSE)
+			(*engine.output.setPaused)(engine.paused);
+
+		if(cmd == ENGINE_CMD_SEEK && seekTrack(info, rate, channels) == true)
+			sub = head = 0;
+
+		/* Drop decoded samples and decode the next file instead. */
+		if(cmd == ENGINE_CMD_NEXT && takeNextFile(NULL) == true)
+		{
+			stopDecode();
+			(*engine.output.clear)();
+			sub = head = 0;
+			engine.doneTick = 0;
+			startDecode(NULL, 0);
+		}
+
+		if(engine.paused == true)
 			continue;
 
-		if(waveBuf[0].status == NDSP_WBUF_DONE)
+		/* Free blocks that the DSP has played. */
+		released = false;
+		while(ring.tail != sub && (*engine.output.status)(
+					&ring.block[ring.tail % RING_BLOCKS].outBuf) ==
+				OUTPUT_BUF_DONE)
 		{
-			size_t read = (*decoder.decode)(&buffer1[0]);
+			released = true;
+			if(engine.doneTick == 0)
+				engine.doneTick = svcGetSystemTick();
+
+			struct pcmBlock_t* block = &ring.block[ring.tail % RING_BLOCKS];
+
 			/* The previous block of samples have finished playing,
 			 * so accumulate them here. */
-			info->samples_played += waveBuf[0].nsamples * decoder.channels();
+			info->samples_played += block->samples;
 
-			if(read <= 0)
+			__atomic_sub_fetch(&ring.ms, block->ms, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring.tail, ring.tail + 1, __ATOMIC_RELEASE);
+			LightEvent_Signal(&ring.space);
+
+			/* Following block is now playing. */
+			block = &ring.block[ring.tail % RING_BLOCKS];
+			if(ring.tail != sub && block->gen != engine.gen)
+				startTrack(info, block->gen, true);
+		}
+
+		if(released == true)
+			info->samples_total = __atomic_load_n(&decode.tracks[engine.gen %
+					TRACK_QUEUE_LEN].samples_total, __ATOMIC_RELAXED);
+
+		head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+
+		/* The channel ran dry, other than at the end or to change format. */
+		if(released == true && ring.tail == sub &&
+				(__atomic_load_n(&decode.done, __ATOMIC_ACQUIRE) == false ||
+				 sub != head) &&
+				(sub == head ||
+				 (ring.block[sub % RING_BLOCKS].rate == rate &&
+				  ring.block[sub % RING_BLOCKS].channels == channels)))
+			stats.underruns++;
+
+		/* Hand decoded blocks to the DSP. */
+		submitted = sub;
+		while(sub != head && sub - ring.tail < engine.waveBufs)
+		{
+			struct pcmBlock_t* block = &ring.block[sub % RING_BLOCKS];
+
+			if(block->rate != rate || block->channels != channels)
 			{
-				lastbuf = true;
-				continue;
+				/* The channel must run dry before changing format. */
+				if(sub != ring.tail)
+					break;
+
+				rate = block->rate;
+				channels = block->channels;
+				(*engine.output.setFormat)(rate, channels);
+			}
+
+			/* Nothing else is queued, so this block plays straight away. */
+			if(sub == ring.tail && (started == false ||
+						block->gen != engine.gen))
+			{
+				startTrack(info, block->gen, started);
+				started = true;
+			}
+
+			if(engine.openTick != 0)
+			{
+				stats.startUs = ticksToUs(svcGetSystemTick() -
+						engine.openTick);
+				if(stats.startUs > stats.startMaxUs)
+					stats.startMaxUs = stats.startUs;
+
+				engine.openTick = 0;
 			}
-			else if(read < decoder.buffSize)
-				waveBuf[0].nsamples = read / (*decoder.channels)();
 
-			ndspChnWaveBufAdd(CHANNEL, &waveBuf[0]);
+			(*engine.output.submit)(&block->outBuf, block->buffer.data,
+					block->samples / block->channels);
+			sub++;
 		}
 
-		if(waveBuf[1].status == NDSP_WBUF_DONE)
+		if(sub != submitted && engine.doneTick != 0)
 		{
-			size_t read = (*decoder.decode)(&buffer2[0]);
-			info->samples_played += waveBuf[0].nsamples * decoder.channels();
+			uint32_t us = ticksToUs(svcGetSystemTick() - engine.doneTick);
 
-			if(read <= 0)
+			stats.refills++;
+			stats.refillTotalUs += us;
+			if(us > stats.refillMaxUs)
+				stats.refillMaxUs = us;
+
+			engine.doneTick = 0;
+		}
+
+		/* When the last buffer has finished playing, break. */
+		if(__atomic_load_n(&decode.done, __ATOMIC_ACQUIRE) == true &&
+				ring.tail == __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE))
+		{
+			/* As before the engine existed, an error is not followed by
+			 * PLAYBACK_STOPPED, so that it isn't overwritten before the
+			 * UI reads it. */
+			if(decode.error != 0)
 			{
-				lastbuf = true;
-				continue;
+				signalInfo(info, decode.error);
+				stopped = true;
 			}
-			else if(read < decoder.buffSize)
-				waveBuf[1].nsamples = read / (*decoder.channels)();
 
-			ndspChnWaveBufAdd(CHANNEL, &waveBuf[1]);
+			break;
+		}
+	}
+
+	stopDecode();
+	(*engine.output.clear)();
+	engine.watch = NULL;
+	engine.doneTick = 0;
+	engine.playing = false;
+	info->wakeupsPerSec = 0;
+
+	/* Signal Watchdog thread that we've stopped playing */
+	if(stopped == false)
+		signalInfo(info, PLAYBACK_STOPPED);
+}
+
+/**
+ * Initialise the output, if it isn't already.
+ *
+ * \return	0 on success, else an errno or custom error code.
+ */
+static int initOutput(void)
+{
+	int err;
+
+	if(engine.isOutputInit == true)
+		return 0;
+
+	if((err = (*engine.output.init)()) != 0)
+		return err;
+
+	(*engine.output.setCallback)(outputCallback, NULL);
+	engine.isOutputInit = true;
+	return 0;
+}
+
+/**
+ * Playback engine thread. Owns the output, the decode thread and the sample
+ * buffers for the lifetime of the application, and plays files as commanded.
+ *
+ * \param	infoIn	Playback information.
+ */
+static void playbackEngine(void* infoIn)
+{
+	struct playbackInfo_t* info = infoIn;
+	struct stream_t* stream;
+	bool isNew3ds = false;
+	s32 prio;
+	int err;
+
+	initOutput();
+
+	/* Decode on the second application core where there is one. */
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	APT_CheckNew3DS(&isNew3ds);
+
+	if(isNew3ds == true)
+		decode.thread = threadCreate(decodeThread, NULL, 32 * 1024, prio + 1,
+				DECODE_CORE_N3DS, false);
+
+	if(decode.thread == NULL)
+		decode.thread = threadCreate(decodeThread, NULL, 32 * 1024, prio + 1,
+				-2, false);
+
+	while(decode.thread != NULL)
+	{
+		enum engine_cmd cmd;
+
+		while((cmd = peekCommand()) == ENGINE_CMD_NONE)
+			LightEvent_Wait(&engine.event);
+
+		popCommand();
+
+		if(cmd == ENGINE_CMD_EXIT)
+			break;
+
+		/* Nothing is playing to seek. */
+		if(cmd == ENGINE_CMD_SEEK)
+			takeSeek();
+
+		if(cmd != ENGINE_CMD_PLAY)
+			continue;
+
+		LightLock_Lock(&engine.lock);
+		stream = engine.playStream;
+		engine.playStream = NULL;
+		memcpy(engine.nextFile, engine.playNext, sizeof(engine.nextFile));
+		engine.nextQueued = engine.playNext[0] != '\0';
+		engine.playQueued = false;
+		engine.seekMs = 0;
+		LightLock_Unlock(&engine.lock);
+
+		if(stream == NULL)
+			continue;
+
+		/* NDSP may fail to initialise if DSP firmware is missing. */
+		if((err = initOutput()) != 0)
+		{
+			closeStream(stream);
+			signalInfo(info, err);
+			continue;
 		}
 
-		DSP_FlushDataCache(buffer1, decoder.buffSize * sizeof(int16_t));
-		DSP_FlushDataCache(buffer2, decoder.buffSize * sizeof(int16_t));
+		info->samples_total = 0;
+		info->samples_played = 0;
+		info->samples_per_second = 0;
+		engine.paused = false;
+		engine.gen = decode.gen;
+
+		engine.waveBufs = info->waveBufs;
+		if(engine.waveBufs < WAVEBUFS_MIN)
+			engine.waveBufs = WAVEBUFS_MIN;
+		else if(engine.waveBufs > WAVEBUFS_MAX)
+			engine.waveBufs = WAVEBUFS_MAX;
+
+		engine.openTick = stream->openTick;
+		startDecode(stream, 0);
+		playRing(info);
 	}
 
-	info->samples_played += waveBuf[0].nsamples * decoder.channels();
-	info->samples_played += waveBuf[0].nsamples * decoder.channels();
+	/* A file may have been requested after the last command was handled. */
+	closeStream(engine.playStream);
+	engine.playStream = NULL;
 
-	(*decoder.exit)();
-out:
-	if(isNdspInit == true)
+	if(decode.thread != NULL)
 	{
-		ndspChnWaveBufClear(CHANNEL);
-		ndspExit();
+		decode.exit = true;
+		LightEvent_Signal(&decode.start);
+		threadJoin(decode.thread, U64_MAX);
+		threadFree(decode.thread);
+		decode.thread = NULL;
 	}
 
-	linearFree(buffer1);
-	linearFree(buffer2);
+	for(int i = 0; i < RING_BLOCKS; i++)
+	{
+		linearFree(ring.block[i].buffer.data);
+		ring.block[i].buffer.data = NULL;
+		ring.block[i].buffer.size = 0;
+	}
 
-	/* Signal Watchdog thread that we've stopped playing */
-	*info->errInfo->error = -1;
-	svcSignalEvent(*info->errInfo->failEvent);
+	if(engine.isOutputInit == true)
+		(*engine.output.exit)();
 
-	threadExit(0);
-	return;
+	engine.isOutputInit = false;
+}
 
-err:
-	*info->errInfo->error = errno;
-	svcSignalEvent(*info->errInfo->failEvent);
-	goto out;
+/**
+ * Start the playback engine thread. Must be called before any other playback
+ * function. The codec libraries are initialised before it returns, so that
+ * other threads may open decoders from then on.
+ *
+ * \param	info	Playback information, which must remain valid until
+ *					exitPlaybackEngine() is called.
+ * \param	output	Output backend to play to.
+ * \return			0 on success, or -1 on failure.
+ */
+int startPlaybackEngine(struct playbackInfo_t* info,
+		const struct output_fn* output)
+{
+	s32 prio;
+
+	LightLock_Init(&engine.lock);
+	LightLock_Init(&linearLock);
+	LightEvent_Init(&engine.event, RESET_ONESHOT);
+	LightEvent_Init(&ring.space, RESET_ONESHOT);
+	LightEvent_Init(&decode.start, RESET_ONESHOT);
+	LightEvent_Init(&decode.idle, RESET_ONESHOT);
+	LightEvent_Init(&decode.seeked, RESET_ONESHOT);
+	engine.info = info;
+	engine.output = *output;
+
+	if(initMp3Library() != 0)
+		return -1;
+
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+	/* Files are read directly if the prefetch thread can not start. */
+	startPrefetch(prio - 1);
+
+	engine.thread = threadCreate(playbackEngine, info, 32 * 1024, prio - 1,
+			-2, false);
+
+	if(engine.thread == NULL)
+	{
+		exitPrefetch();
+		exitMp3Library();
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stop playback and the playback engine thread.
+ */
+void exitPlaybackEngine(void)
+{
+	if(engine.thread == NULL)
+		return;
+
+	pushCommand(ENGINE_CMD_EXIT);
+	threadJoin(engine.thread, U64_MAX);
+	threadFree(engine.thread);
+	engine.thread = NULL;
+
+	exitPrefetch();
+	exitMp3Library();
+}
+
+/**
+ * Get playback health statistics.
+ *
+ * \param	out		Output statistics.
+ */
+void getPlaybackStats(struct playbackStats_t* out)
+{
+	memcpy(out, &stats, sizeof(stats));
 }
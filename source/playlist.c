@@ -0,0 +1,438 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "playlist.h"
+
+/* Size of each block read while looking for entries. */
+#define PLAYLIST_BLOCK		(16 * 1024)
+
+/* Entries first allocated for a playlist. */
+#define PLAYLIST_MIN_ENTRIES	1024
+
+/* Entries that may not be played that are passed over before giving up, so
+ * that a playlist of missing files does not hold up the UI. */
+#define PLAYLIST_MAX_SKIP	64
+
+/* Longest key of a PLS line that is compared, such as "File123". */
+#define PLS_KEY_MAX	16
+
+enum line_state
+{
+	LINE_START = 0,
+	LINE_KEY,
+	LINE_SKIP
+};
+
+/**
+ * Get the type of a playlist from its file name.
+ *
+ * \param	file	File name or path.
+ * \return			Type of playlist, or PLAYLIST_NONE if it is not one.
+ */
+enum playlist_type getPlaylistType(const char* file)
+{
+	const char* ext = strrchr(file, '.');
+
+	if(ext == NULL)
+		return PLAYLIST_NONE;
+
+	if(strcasecmp(ext, ".m3u") == 0)
+		return PLAYLIST_M3U;
+
+	if(strcasecmp(ext, ".m3u8") == 0)
+		return PLAYLIST_M3U8;
+
+	if(strcasecmp(ext, ".pls") == 0)
+		return PLAYLIST_PLS;
+
+	return PLAYLIST_NONE;
+}
+
+/**
+ * Add an entry to a playlist.
+ *
+ * \param	off	Offset of the path of the entry in the playlist file.
+ * \return		0 on success, 1 if the playlist is full, or -1 if out of
+ *				memory.
+ */
+static int addEntry(struct playlist_t* playlist, uint32_t off)
+{
+	if(playlist->count == playlist->cap)
+	{
+		uint32_t	cap = playlist->cap * 2;
+		uint32_t*	entries;
+
+		if(playlist->cap == PLAYLIST_MAX_ENTRIES)
+			return 1;
+
+		if(cap < PLAYLIST_MIN_ENTRIES)
+			cap = PLAYLIST_MIN_ENTRIES;
+		else if(cap > PLAYLIST_MAX_ENTRIES)
+			cap = PLAYLIST_MAX_ENTRIES;
+
+		if((entries = realloc(playlist->entries,
+						cap * sizeof(*entries))) == NULL)
+			return -1;
+
+		playlist->entries = entries;
+		playlist->cap = cap;
+	}
+
+	playlist->entries[playlist->count++] = off;
+	return 0;
+}
+
+/**
+ * Whether a PLS key names the path of an entry, such as "File1".
+ */
+static bool isFileKey(const char* key, size_t len)
+{
+	size_t i;
+
+	while(len > 0 && (key[len - 1] == ' ' || key[len - 1] == '\t'))
+		len--;
+
+	if(len <= 4 || strncasecmp(key, "file", 4) != 0)
+		return false;
+
+	for(i = 4; i < len; i++)
+	{
+		if(key[i] < '0' || key[i] > '9')
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Read the entries of a playlist, replacing those of any playlist read
+ * before. The file is read in blocks, and only the offset of each entry is
+ * kept.
+ *
+ * \param	playlist	Playlist, which must be zeroed before its first use.
+ * \param	file		Path of playlist file.
+ * \return				Number of entries, or -1 on failure with errno set.
+ */
+int openPlaylist(struct playlist_t* playlist, const char* file)
+{
+	static const uint8_t	bom[3] = { 0xEF, 0xBB, 0xBF };
+	enum line_state			state = LINE_START;
+	char					key[PLS_KEY_MAX];
+	size_t					keyLen = 0;
+	uint32_t				off = 0;
+	char*					block = NULL;
+	const char*				sep;
+	FILE*					f = NULL;
+	size_t					got;
+	int						full = 0;
+
+	playlist->count = 0;
+	playlist->file[0] = '\0';
+
+	if((playlist->type = getPlaylistType(file)) == PLAYLIST_NONE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(strlen(file) >= sizeof(playlist->file))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if((block = malloc(PLAYLIST_BLOCK)) == NULL)
+	{
+		errno = ENOMEM;
+		goto err;
+	}
+
+	if((f = fopen(file, "rb")) == NULL)
+		goto err;
+
+	while(full == 0 && (got = fread(block, 1, PLAYLIST_BLOCK, f)) > 0)
+	{
+		for(size_t i = 0; full == 0 && i < got; i++, off++)
+		{
+			char c = block[i];
+
+			if(c == '\n' || c == '\r')
+			{
+				state = LINE_START;
+				continue;
+			}
+
+			switch(state)
+			{
+			case LINE_START:
+				if(c == ' ' || c == '\t' || (off < sizeof(bom) &&
+							(uint8_t)c == bom[off]))
+					break;
+
+				/* Each line of an M3U playlist is a path or a comment. */
+				if(playlist->type != PLAYLIST_PLS)
+				{
+					if(c != '#')
+						full = addEntry(playlist, off);
+
+					state = LINE_SKIP;
+					break;
+				}
+
+				keyLen = 0;
+				state = LINE_KEY;
+				/* fall through */
+
+			case LINE_KEY:
+				if(c == '=')
+				{
+					if(isFileKey(key, keyLen))
+						full = addEntry(playlist, off + 1);
+
+					state = LINE_SKIP;
+				}
+				else if(keyLen == sizeof(key))
+					state = LINE_SKIP;
+				else
+					key[keyLen++] = c;
+				break;
+
+			case LINE_SKIP:
+				break;
+			}
+		}
+	}
+
+	if(full < 0)
+	{
+		errno = ENOMEM;
+		goto err;
+	}
+
+	if(ferror(f))
+	{
+		errno = EIO;
+		goto err;
+	}
+
+	fclose(f);
+	free(block);
+
+	strcpy(playlist->file, file);
+	sep = strrchr(file, '/');
+	playlist->dirLen = sep == NULL ? 0 : (size_t)(sep - file) + 1;
+	return playlist->count;
+
+err:
+	if(f != NULL)
+		fclose(f);
+
+	free(block);
+	playlist->count = 0;
+	return -1;
+}
+
+/**
+ * Whether a string is valid UTF-8. Playlists with the .m3u extension may
+ * instead be encoded in Latin-1.
+ */
+static bool isUtf8(const char* s)
+{
+	const uint8_t* p = (const uint8_t*)s;
+
+	while(*p != '\0')
+	{
+		int follow;
+
+		if(*p < 0x80)
+			follow = 0;
+		else if((*p & 0xE0) == 0xC0)
+			follow = 1;
+		else if((*p & 0xF0) == 0xE0)
+			follow = 2;
+		else if((*p & 0xF8) == 0xF0)
+			follow = 3;
+		else
+			return false;
+
+		for(p++; follow > 0; follow--, p++)
+		{
+			if((*p & 0xC0) != 0x80)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Convert the "%XX" escapes of a file URI in place.
+ */
+static void decodeUri(char* s)
+{
+	char* out = s;
+
+	for(; *s != '\0'; s++)
+	{
+		unsigned c;
+
+		if(*s == '%' && sscanf(s + 1, "%2x", &c) == 1 &&
+				s[1] != '\0' && s[2] != '\0' && c != 0)
+		{
+			*out++ = (char)c;
+			s += 2;
+		}
+		else
+			*out++ = *s;
+	}
+
+	*out = '\0';
+}
+
+/**
+ * Read the path of an entry, resolving it against the folder of the
+ * playlist.
+ *
+ * \param	f		Opened playlist file.
+ * \param	n		Entry.
+ * \param	path	Output path.
+ * \param	len		Size of path.
+ * \return			0 on success, or -1 if the entry is not a local path or
+ *					is too long.
+ */
+static int readEntry(const struct playlist_t* playlist, FILE* f, uint32_t n,
+		char* path, size_t len)
+{
+	char	line[PATH_MAX];
+	char*	entry = line;
+	char*	colon;
+	char*	slash;
+	size_t	at = 0;
+	size_t	end;
+	bool	latin1;
+
+	if(fseek(f, playlist->entries[n], SEEK_SET) != 0 ||
+			fgets(line, sizeof(line), f) == NULL)
+		return -1;
+
+	end = strcspn(line, "\r\n");
+	if(line[end] == '\0' && end == sizeof(line) - 1)
+		return -1;
+
+	while(end > 0 && (line[end - 1] == ' ' || line[end - 1] == '\t'))
+		end--;
+	line[end] = '\0';
+
+	while(*entry == ' ' || *entry == '\t')
+		entry++;
+
+	if(strncasecmp(entry, "file://", 7) == 0)
+	{
+		entry += 7;
+		decodeUri(entry);
+	}
+	else if(strstr(entry, "://") != NULL)
+		return -1;
+
+	if(*entry == '\0')
+		return -1;
+
+	for(char* p = entry; *p != '\0'; p++)
+	{
+		if(*p == '\\')
+			*p = '/';
+	}
+
+	/* Paths starting with '/' or a device such as "sdmc:" are absolute. */
+	colon = strchr(entry, ':');
+	slash = strchr(entry, '/');
+	if(entry[0] != '/' && (colon == NULL || (slash != NULL && slash < colon)))
+	{
+		if(playlist->dirLen >= len)
+			return -1;
+
+		memcpy(path, playlist->file, playlist->dirLen);
+		at = playlist->dirLen;
+	}
+
+	latin1 = playlist->type == PLAYLIST_M3U && !isUtf8(entry);
+
+	for(const uint8_t* p = (const uint8_t*)entry; *p != '\0'; p++)
+	{
+		if(latin1 && *p >= 0x80)
+		{
+			if(at + 2 >= len)
+				return -1;
+
+			path[at++] = 0xC0 | (*p >> 6);
+			path[at++] = 0x80 | (*p & 0x3F);
+		}
+		else
+		{
+			if(at + 1 >= len)
+				return -1;
+
+			path[at++] = *p;
+		}
+	}
+
+	path[at] = '\0';
+	return 0;
+}
+
+/**
+ * Find the first entry of a playlist that may be played, starting from an
+ * entry and moving in either direction. Paths relative to the playlist are
+ * resolved, and each is checked to be a file, only as it is reached.
+ *
+ * \param	playlist	Playlist.
+ * \param	n			Entry to start from.
+ * \param	step		1 to search forwards, or -1 to search backwards.
+ * \param	path		Output path of the entry found.
+ * \param	len			Size of path.
+ * \return				Entry found, or -1 if there is none.
+ */
+int32_t findPlaylistEntry(const struct playlist_t* playlist, int32_t n,
+		int step, char* path, size_t len)
+{
+	FILE*	f;
+	int32_t	found = -1;
+
+	if(n < 0 || (uint32_t)n >= playlist->count ||
+			(f = fopen(playlist->file, "rb")) == NULL)
+		return -1;
+
+	for(int tries = 0; tries < PLAYLIST_MAX_SKIP && n >= 0 &&
+			(uint32_t)n < playlist->count; tries++, n += step)
+	{
+		struct stat st;
+
+		/* Playlists within playlists are not followed. */
+		if(readEntry(playlist, f, n, path, len) == 0 &&
+				getPlaylistType(path) == PLAYLIST_NONE &&
+				stat(path, &st) == 0 && S_ISREG(st.st_mode))
+		{
+			found = n;
+			break;
+		}
+	}
+
+	fclose(f);
+	return found;
+}
+
+/**
+ * Free memory used by a playlist.
+ */
+void freePlaylist(struct playlist_t* playlist)
+{
+	free(playlist->entries);
+	playlist->entries = NULL;
+	playlist->count = 0;
+	playlist->cap = 0;
+}
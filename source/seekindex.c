@@ -0,0 +1,808 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "mp3.h"
+#include "platform.h"
+#include "seekindex.h"
+#include "stream.h"
+
+/* Magic and version of index files. Older or newer indexes are rebuilt. */
+#define SEEK_INDEX_MAGIC	"CTSI"
+#define SEEK_INDEX_VERSION	2
+
+/* Files waiting for their index to be built. */
+#define SEEK_QUEUE_LEN		4
+
+/* Size of each block read while scanning a file. */
+#define SCAN_BLOCK_SIZE		(32 * 1024)
+
+/* Longest FLAC frame header, with its CRC. */
+#define FLAC_MAX_HEADER		16
+
+/* Header of an index file, followed by the points and then the path of the
+ * file indexed. */
+struct indexHeader_t
+{
+	char		magic[4];
+	uint32_t	version;
+	uint64_t	size;
+	int64_t		mtime;
+	uint32_t	type;
+	uint32_t	step;
+	uint32_t	count;
+	uint32_t	pathLen;
+	uint64_t	samples;
+};
+
+/* File read in blocks from its start, for parsing its headers in memory. */
+struct scanner_t
+{
+	struct stream_t*	stream;
+	volatile bool*		abort;
+
+	/* Bytes read, of which those from at are yet to be parsed. */
+	uint8_t				buf[SCAN_BLOCK_SIZE];
+	size_t				len;
+	size_t				at;
+
+	/* Offset of buf in the file. */
+	int64_t				base;
+};
+
+/*
+ * Index builder. Files are built most recently queued first, so that the file
+ * playing is indexed before files that were skipped.
+ */
+static struct
+{
+	Thread				thread;
+	LightLock			lock;
+	LightEvent			event;
+	volatile bool		quit;
+
+	/* Number of indexes built. */
+	volatile unsigned	gen;
+
+	char				dir[PATH_MAX];
+
+	char				queue[SEEK_QUEUE_LEN][PATH_MAX];
+	unsigned			count;
+
+	/* File being built, or empty. */
+	char				building[PATH_MAX];
+} builder;
+
+/**
+ * FNV-1a hash of a path.
+ */
+static uint64_t hashPath(const char* file)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	while(*file != '\0')
+	{
+		hash ^= (uint8_t)*file++;
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Get the path of the index file of a file.
+ *
+ * \return	0 on success, or -1 if the path is too long.
+ */
+static int getIndexFile(const char* file, char* out, size_t len)
+{
+	return snprintf(out, len, "%s/%016llx.idx", builder.dir,
+			(unsigned long long)hashPath(file)) < (int)len ? 0 : -1;
+}
+
+/**
+ * Read an index file with a single read.
+ *
+ * \param	indexFile	Index file.
+ * \param	file		File indexed, whose path, size and modification time
+ *						must match those it was built from.
+ * \return				Index, or NULL if there is none or it is out of date.
+ */
+static struct seekIndex_t* readIndex(const char* indexFile, const char* file,
+		uint64_t size, int64_t mtime)
+{
+	struct indexHeader_t*	header;
+	struct seekIndex_t*		index = NULL;
+	struct stat				st;
+	uint8_t*				block = NULL;
+	size_t					pathLen = strlen(file);
+	FILE*					f;
+
+	if((f = fopen(indexFile, "rb")) == NULL)
+		return NULL;
+
+	if(fstat(fileno(f), &st) != 0 ||
+			st.st_size < (off_t)sizeof(struct indexHeader_t) ||
+			st.st_size > (off_t)(sizeof(struct indexHeader_t) +
+				SEEK_INDEX_POINTS * sizeof(struct seekPoint_t) + PATH_MAX) ||
+			(block = malloc(st.st_size)) == NULL ||
+			fread(block, 1, st.st_size, f) != (size_t)st.st_size)
+		goto out;
+
+	header = (struct indexHeader_t*)block;
+	if(memcmp(header->magic, SEEK_INDEX_MAGIC, 4) != 0 ||
+			header->version != SEEK_INDEX_VERSION ||
+			header->size != size || header->mtime != mtime ||
+			header->count > SEEK_INDEX_POINTS ||
+			header->pathLen != pathLen ||
+			(size_t)st.st_size != sizeof(struct indexHeader_t) +
+				header->count * sizeof(struct seekPoint_t) + pathLen ||
+			memcmp(block + st.st_size - pathLen, file, pathLen) != 0)
+		goto out;
+
+	if((index = malloc(sizeof(struct seekIndex_t) +
+					header->count * sizeof(struct seekPoint_t))) == NULL)
+		goto out;
+
+	index->type = header->type;
+	index->step = header->step;
+	index->count = header->count;
+	index->samples = header->samples;
+	memcpy(index->points, header + 1,
+			header->count * sizeof(struct seekPoint_t));
+
+out:
+	free(block);
+	fclose(f);
+	return index;
+}
+
+/**
+ * Write an index file. The previous file is only replaced once the new one
+ * has been written.
+ *
+ * \return	0 on success, or -1 on failure.
+ */
+static int writeIndex(const char* indexFile, const char* file, uint64_t size,
+		int64_t mtime, const struct seekIndex_t* index)
+{
+	struct indexHeader_t	header = { SEEK_INDEX_MAGIC, SEEK_INDEX_VERSION,
+		size, mtime, index->type, index->step, index->count, strlen(file),
+		index->samples };
+	char					tmp[PATH_MAX];
+	FILE*					f;
+	int						err;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", indexFile) >= (int)sizeof(tmp) ||
+			(f = fopen(tmp, "wb")) == NULL)
+		return -1;
+
+	err = fwrite(&header, sizeof(header), 1, f) != 1 ||
+		fwrite(index->points, sizeof(struct seekPoint_t), index->count, f) !=
+			index->count ||
+		fwrite(file, 1, header.pathLen, f) != header.pathLen;
+
+	if(fclose(f) != 0 || err)
+	{
+		remove(tmp);
+		return -1;
+	}
+
+	/* Renaming over an existing file fails on FAT. */
+	remove(indexFile);
+	return rename(tmp, indexFile);
+}
+
+/**
+ * Add a point to an index being built. Points closer than spacing to the
+ * last point, or not after it, are not added. Once the index is full, every
+ * other point is dropped and spacing grows to the average distance between
+ * those kept.
+ *
+ * \param	spacing	Samples between points, which is 0 to add every point.
+ */
+static void addSeekPoint(struct seekIndex_t* index, uint64_t* spacing,
+		uint64_t sample, uint64_t offset)
+{
+	const struct seekPoint_t* last;
+
+	if(index->count > 0)
+	{
+		last = &index->points[index->count - 1];
+		if(sample <= last->sample || sample - last->sample < *spacing)
+			return;
+	}
+
+	if(index->count == SEEK_INDEX_POINTS)
+	{
+		for(uint32_t i = 1; i < SEEK_INDEX_POINTS / 2; i++)
+			index->points[i] = index->points[2 * i];
+
+		index->count = SEEK_INDEX_POINTS / 2;
+		last = &index->points[index->count - 1];
+		*spacing = (last->sample - index->points[0].sample) /
+			(index->count - 1);
+
+		if(sample - last->sample < *spacing)
+			return;
+	}
+
+	index->points[index->count].sample = sample;
+	index->points[index->count].offset = offset;
+	index->count++;
+}
+
+/**
+ * Make bytes available to parse from the current position of a scan.
+ *
+ * \param	n	Bytes needed, up to SCAN_BLOCK_SIZE.
+ * \return		false at the end of the file, on failure, or if aborted.
+ */
+static bool fillScanner(struct scanner_t* scan, size_t n)
+{
+	if(scan->len - scan->at >= n)
+		return true;
+
+	if(*scan->abort == true)
+		return false;
+
+	memmove(scan->buf, scan->buf + scan->at, scan->len - scan->at);
+	scan->base += scan->at;
+	scan->len -= scan->at;
+	scan->at = 0;
+	scan->len += readStream(scan->stream, scan->buf + scan->len,
+			SCAN_BLOCK_SIZE - scan->len);
+
+	return scan->len >= n;
+}
+
+/**
+ * Move the current position of a scan forwards, seeking past bytes that have
+ * not been read.
+ *
+ * \return	false on failure.
+ */
+static bool skipScanner(struct scanner_t* scan, uint64_t n)
+{
+	if(n <= scan->len - scan->at)
+	{
+		scan->at += n;
+		return true;
+	}
+
+	scan->base += scan->at + n;
+	scan->len = scan->at = 0;
+	return seekStream(scan->stream, scan->base, SEEK_SET) == 0;
+}
+
+/**
+ * CRC-8 of FLAC frame headers, with polynomial x^8 + x^2 + x + 1.
+ */
+static uint8_t crc8(const uint8_t* data, size_t len)
+{
+	uint8_t crc = 0;
+
+	while(len-- > 0)
+	{
+		crc ^= *data++;
+		for(int i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+
+	return crc;
+}
+
+/**
+ * Parse a FLAC frame header.
+ *
+ * \param	h			At least FLAC_MAX_HEADER bytes.
+ * \param	fixedBlock	Samples of each channel in every frame of a file with
+ *						a fixed block size.
+ * \param	sample		Output first sample of each channel of the frame.
+ * \param	blockSize	Output samples of each channel in the frame.
+ * \return				Length of the header, or 0 if it is not valid.
+ */
+static size_t parseFlacFrame(const uint8_t* h, uint32_t fixedBlock,
+		uint64_t* sample, uint32_t* blockSize)
+{
+	unsigned	sizeCode = h[2] >> 4;
+	unsigned	rateCode = h[2] & 0x0F;
+	uint64_t	num;
+	size_t		len;
+	int			follow;
+
+	if(h[0] != 0xFF || (h[1] & 0xFE) != 0xF8 || sizeCode == 0 ||
+			rateCode == 0x0F || (h[3] >> 4) >= 11 ||
+			((h[3] >> 1) & 7) == 3 || (h[3] & 1) != 0)
+		return 0;
+
+	/* Frame or sample number, coded as in UTF-8 up to 36 bits. */
+	if(h[4] < 0x80)
+	{
+		follow = 0;
+		num = h[4];
+	}
+	else if(h[4] >= 0xC0 && h[4] != 0xFF)
+	{
+		for(follow = 1; h[4] & (0x40 >> follow); follow++)
+			;
+
+		num = h[4] & (0x3F >> follow);
+	}
+	else
+		return 0;
+
+	for(int i = 0; i < follow; i++)
+	{
+		if((h[5 + i] & 0xC0) != 0x80)
+			return 0;
+
+		num = num << 6 | (h[5 + i] & 0x3F);
+	}
+
+	len = 5 + follow;
+	if(sizeCode == 1)
+		*blockSize = 192;
+	else if(sizeCode <= 5)
+		*blockSize = 576 << (sizeCode - 2);
+	else if(sizeCode == 6)
+		*blockSize = h[len++] + 1;
+	else if(sizeCode == 7)
+	{
+		*blockSize = (h[len] << 8 | h[len + 1]) + 1;
+		len += 2;
+	}
+	else
+		*blockSize = 256 << (sizeCode - 8);
+
+	if(rateCode == 12)
+		len++;
+	else if(rateCode == 13 || rateCode == 14)
+		len += 2;
+
+	if(crc8(h, len) != h[len])
+		return 0;
+
+	*sample = h[1] & 1 ? num : num * fixedBlock;
+	return len + 1;
+}
+
+/**
+ * Index the frames of a FLAC file. Frames are found by their headers, which
+ * must carry the sample that follows the previous frame, so that the sync
+ * code appearing within a frame is not taken for a frame.
+ *
+ * \return	0 on success, or -1 if the file is not FLAC.
+ */
+static int indexFlac(struct scanner_t* scan, struct seekIndex_t* index)
+{
+	uint32_t	fixedBlock = 0;
+	uint32_t	minFrame = 0;
+	uint64_t	expected = 0;
+	uint64_t	spacing = 0;
+	bool		last = false;
+
+	if(fillScanner(scan, 4) == false || memcmp(scan->buf, "fLaC", 4) != 0)
+		return -1;
+
+	scan->at = 4;
+	while(last == false)
+	{
+		const uint8_t*	h;
+		uint32_t		len;
+
+		if(fillScanner(scan, 4 + 11) == false)
+			return -1;
+
+		h = scan->buf + scan->at;
+		last = h[0] & 0x80;
+		len = h[1] << 16 | h[2] << 8 | h[3];
+
+		/* STREAMINFO gives the block size, and the smallest frame. */
+		if((h[0] & 0x7F) == 0)
+		{
+			if((h[4] << 8 | h[5]) == (h[6] << 8 | h[7]))
+				fixedBlock = h[4] << 8 | h[5];
+
+			minFrame = h[8] << 16 | h[9] << 8 | h[10];
+		}
+
+		/* Files with a seek table are seeked with it. */
+		if((h[0] & 0x7F) == 3)
+			return 0;
+
+		if(skipScanner(scan, 4 + len) == false)
+			return -1;
+	}
+
+	while(fillScanner(scan, FLAC_MAX_HEADER) == true)
+	{
+		const uint8_t*	h = scan->buf + scan->at;
+		const uint8_t*	next;
+		uint64_t		sample;
+		uint32_t		blockSize;
+		size_t			n;
+
+		if((n = parseFlacFrame(h, fixedBlock, &sample, &blockSize)) != 0 &&
+				sample == expected)
+		{
+			addSeekPoint(index, &spacing, sample, scan->base + scan->at);
+			expected += blockSize;
+			skipScanner(scan, minFrame > n ? minFrame : n);
+			continue;
+		}
+
+		next = memchr(h + 1, 0xFF, scan->len - scan->at - 1);
+		scan->at = next != NULL ? (size_t)(next - scan->buf) : scan->len;
+	}
+
+	return 0;
+}
+
+/**
+ * Index the pages of the first stream of an Ogg file. Only the page headers
+ * are parsed.
+ *
+ * \return	0 on success, or -1 if the file is not Ogg.
+ */
+static int indexOgg(struct scanner_t* scan, struct seekIndex_t* index)
+{
+	uint64_t	spacing = 0;
+	uint32_t	serial = 0;
+	bool		found = false;
+
+	while(fillScanner(scan, 27) == true)
+	{
+		const uint8_t*	h = scan->buf + scan->at;
+		uint64_t		granule = 0;
+		uint32_t		body = 0;
+
+		if(memcmp(h, "OggS", 4) != 0 || h[4] != 0)
+		{
+			const uint8_t* next;
+
+			if(found == false)
+				return -1;
+
+			/* Find the next page after damage. */
+			next = memchr(h + 1, 'O', scan->len - scan->at - 1);
+			scan->at = next != NULL ? (size_t)(next - scan->buf) : scan->len;
+			continue;
+		}
+
+		if(fillScanner(scan, 27 + h[26]) == false)
+			break;
+
+		h = scan->buf + scan->at;
+		for(int i = 0; i < h[26]; i++)
+			body += h[27 + i];
+
+		for(int i = 7; i >= 0; i--)
+			granule = granule << 8 | h[6 + i];
+
+		if(found == false)
+		{
+			serial = h[14] | h[15] << 8 | h[16] << 16 | (uint32_t)h[17] << 24;
+			found = true;
+		}
+
+		if(serial == (h[14] | h[15] << 8 | h[16] << 16 |
+					(uint32_t)h[17] << 24))
+		{
+			/* No packet ends on a page with a granule position of -1. */
+			if(granule != UINT64_MAX)
+				addSeekPoint(index, &spacing, granule, scan->base + scan->at);
+
+			/* Chained files start another stream after the first ends. */
+			if(h[5] & 0x04)
+				break;
+		}
+
+		if(skipScanner(scan, 27 + h[26] + body) == false)
+			break;
+	}
+
+	return found == true ? 0 : -1;
+}
+
+/**
+ * Build the index of a file and write it to its index file, unless an index
+ * of the same file exists.
+ *
+ * \param	file	File to index.
+ * \param	index	Index, with room for SEEK_INDEX_POINTS points.
+ * \param	scan	Memory to scan the file with.
+ */
+static void buildIndex(const char* file, struct seekIndex_t* index,
+		struct scanner_t* scan)
+{
+	char				indexFile[PATH_MAX];
+	struct seekIndex_t*	old;
+	struct stream_t*	stream;
+	struct stat			st;
+	int64_t				mtime;
+	int					err = -1;
+
+	if(stat(file, &st) != 0 || (mtime = getFileMtime(file)) < 0 ||
+			getIndexFile(file, indexFile, sizeof(indexFile)) != 0)
+		return;
+
+	if((old = readIndex(indexFile, file, st.st_size, mtime)) != NULL)
+	{
+		free(old);
+		return;
+	}
+
+	if((stream = openStream(file)) == NULL)
+		return;
+
+	index->type = stream->type;
+	index->step = 0;
+	index->count = 0;
+	index->samples = 0;
+
+	scan->stream = stream;
+	scan->len = scan->at = 0;
+	scan->base = 0;
+
+	switch(stream->type)
+	{
+	case FILE_TYPE_MP3:
+		err = indexMp3(stream, index, &builder.quit);
+		break;
+
+	case FILE_TYPE_FLAC:
+		err = indexFlac(scan, index);
+		break;
+
+	case FILE_TYPE_VORBIS:
+	case FILE_TYPE_OPUS:
+		err = indexOgg(scan, index);
+		break;
+
+	default:
+		break;
+	}
+
+	closeStream(stream);
+
+	if(err == 0 && builder.quit == false &&
+			writeIndex(indexFile, file, st.st_size, mtime, index) == 0)
+		builder.gen++;
+}
+
+/**
+ * Index builder thread.
+ */
+static void builderThread(void* arg)
+{
+	struct seekIndex_t*	index;
+	struct scanner_t*	scan;
+
+	(void)arg;
+
+	if((index = malloc(sizeof(struct seekIndex_t) +
+					SEEK_INDEX_POINTS * sizeof(struct seekPoint_t))) == NULL ||
+			(scan = malloc(sizeof(struct scanner_t))) == NULL)
+	{
+		free(index);
+		return;
+	}
+
+	scan->abort = &builder.quit;
+
+	while(builder.quit == false)
+	{
+		LightEvent_Wait(&builder.event);
+
+		while(builder.quit == false)
+		{
+			LightLock_Lock(&builder.lock);
+			if(builder.count == 0)
+			{
+				LightLock_Unlock(&builder.lock);
+				break;
+			}
+
+			builder.count--;
+			memcpy(builder.building, builder.queue[builder.count], PATH_MAX);
+			LightLock_Unlock(&builder.lock);
+
+			buildIndex(builder.building, index, scan);
+
+			LightLock_Lock(&builder.lock);
+			builder.building[0] = '\0';
+			LightLock_Unlock(&builder.lock);
+		}
+	}
+
+	free(scan);
+	free(index);
+}
+
+/**
+ * Start the thread that builds seek indexes.
+ *
+ * \param	dir	Folder to keep seek indexes in, which is created if needed.
+ * \return		0 on success, or -1 on failure.
+ */
+int startSeekIndex(const char* dir)
+{
+	LightLock_Init(&builder.lock);
+	LightEvent_Init(&builder.event, RESET_ONESHOT);
+	builder.quit = false;
+	builder.count = 0;
+	builder.building[0] = '\0';
+
+	if(snprintf(builder.dir, sizeof(builder.dir), "%s", dir) >=
+				(int)sizeof(builder.dir) ||
+			(mkdir(dir, 0777) != 0 && errno != EEXIST))
+		return -1;
+
+	/* Build at the lowest priority, so as not to delay the UI or playback. */
+	builder.thread = threadCreate(builderThread, NULL, 32 * 1024, 0x3F, -2,
+			false);
+
+	return builder.thread == NULL ? -1 : 0;
+}
+
+/**
+ * Stop the thread that builds seek indexes.
+ */
+void exitSeekIndex(void)
+{
+	if(builder.thread == NULL)
+		return;
+
+	builder.quit = true;
+	LightEvent_Signal(&builder.event);
+	threadJoin(builder.thread, U64_MAX);
+	threadFree(builder.thread);
+	builder.thread = NULL;
+}
+
+/**
+ * Queue a file to be built, unless it is queued or being built. Must be
+ * called with the lock held.
+ */
+static void pushFile(const char* file)
+{
+	if(strcmp(builder.building, file) == 0)
+		return;
+
+	for(unsigned i = 0; i < builder.count; i++)
+	{
+		if(strcmp(builder.queue[i], file) == 0)
+			return;
+	}
+
+	/* Drop the oldest file, so that it is queued again if played again. */
+	if(builder.count == SEEK_QUEUE_LEN)
+	{
+		memmove(builder.queue[0], builder.queue[1],
+				(SEEK_QUEUE_LEN - 1) * PATH_MAX);
+		builder.count--;
+	}
+
+	strcpy(builder.queue[builder.count++], file);
+	LightEvent_Signal(&builder.event);
+}
+
+/**
+ * Build the seek index of a file being played in the background, unless it
+ * has one already.
+ *
+ * \param	stream	Opened file, which is passed over unless it is being
+ *					played.
+ */
+void queueSeekIndex(const struct stream_t* stream)
+{
+	if(builder.thread == NULL || stream->playing == false ||
+			strlen(stream->file) >= PATH_MAX)
+		return;
+
+	LightLock_Lock(&builder.lock);
+	pushFile(stream->file);
+	LightLock_Unlock(&builder.lock);
+}
+
+/**
+ * Load the seek index of a file with a single read. An index that has not
+ * been built yet is built in the background.
+ *
+ * \param	stream	Opened file, which has no index unless it is being
+ *					played.
+ * \return			Index, to be freed with free(), or NULL if there is none
+ *					yet.
+ */
+struct seekIndex_t* loadSeekIndex(const struct stream_t* stream)
+{
+	char				indexFile[PATH_MAX];
+	struct seekIndex_t*	index;
+	int64_t				mtime;
+	bool				pending = false;
+
+	if(builder.thread == NULL || stream->playing == false ||
+			stream->f == NULL)
+		return NULL;
+
+	/* The index file is not read until the index has been built. */
+	LightLock_Lock(&builder.lock);
+	if(strcmp(builder.building, stream->file) == 0)
+		pending = true;
+
+	for(unsigned i = 0; i < builder.count; i++)
+	{
+		if(strcmp(builder.queue[i], stream->file) == 0)
+			pending = true;
+	}
+	LightLock_Unlock(&builder.lock);
+
+	if(pending == true || stream->size < 0 ||
+			(mtime = getFileMtime(stream->file)) < 0 ||
+			getIndexFile(stream->file, indexFile, sizeof(indexFile)) != 0)
+		return NULL;
+
+	if((index = readIndex(indexFile, stream->file, stream->size,
+					mtime)) == NULL)
+		queueSeekIndex(stream);
+
+	return index;
+}
+
+/**
+ * Find the last point of an index at or before a sample. Points too far
+ * before the sample are not returned, such as past the end of the first
+ * stream of a chained Ogg file.
+ *
+ * \param	sample	Sample of each channel, or granule position.
+ * \return			Point, or NULL if decoding may not start from the index.
+ */
+const struct seekPoint_t* findSeekPoint(const struct seekIndex_t* index,
+		uint64_t sample)
+{
+	const struct seekPoint_t*	last;
+	uint32_t					lo = 0;
+	uint32_t					hi;
+
+	if(index == NULL || index->count < 2 || sample < index->points[0].sample)
+		return NULL;
+
+	/* Past the last point, the index may end before the end of the file,
+	 * which is assumed where the sample is further from the last point than
+	 * twice the average distance between points. */
+	last = &index->points[index->count - 1];
+	if(sample >= last->sample)
+	{
+		uint64_t gap = (last->sample - index->points[0].sample) /
+			(index->count - 1);
+
+		return sample - last->sample <= 2 * gap ? last : NULL;
+	}
+
+	hi = index->count;
+	while(hi - lo > 1)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if(index->points[mid].sample <= sample)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &index->points[lo];
+}
+
+/**
+ * Number of seek indexes built, so that decoders waiting for the index of
+ * their file know when to load it again.
+ */
+unsigned getSeekIndexGen(void)
+{
+	return builder.gen;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+
+#include "platform.h"
+#include "shuffle.h"
+
+/**
+ * Mix the bits of a number, so that each output bit depends on every input
+ * bit.
+ */
+static uint32_t mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+/**
+ * Derive the keys of the permutation from a seed.
+ */
+static void setSeed(struct shuffle_t* shuffle, uint32_t seed)
+{
+	shuffle->seed = seed;
+
+	for(int i = 0; i < SHUFFLE_ROUNDS; i++)
+		shuffle->keys[i] = mix(seed + 0x9E3779B9 * (i + 1));
+}
+
+/**
+ * Permute a position of the order into a track. Positions are permuted
+ * with a Feistel network over the smallest domain holding every track,
+ * which is a bijection. Positions permuted outside of the tracks are
+ * permuted again until they fall within them, which keeps it a bijection
+ * over the tracks alone.
+ */
+static uint32_t permute(const struct shuffle_t* shuffle, uint32_t x)
+{
+	unsigned	half = shuffle->halfBits;
+	uint32_t	mask = (1u << half) - 1;
+
+	do
+	{
+		uint32_t l = x >> half;
+		uint32_t r = x & mask;
+
+		for(int i = 0; i < SHUFFLE_ROUNDS; i++)
+		{
+			uint32_t t = l ^ (mix(r ^ shuffle->keys[i]) & mask);
+
+			l = r;
+			r = t;
+		}
+
+		x = (l << half) | r;
+	} while(x >= shuffle->count);
+
+	return x;
+}
+
+/**
+ * Find the position of a track in the order, reversing permute().
+ */
+static uint32_t unpermute(const struct shuffle_t* shuffle, uint32_t x)
+{
+	unsigned	half = shuffle->halfBits;
+	uint32_t	mask = (1u << half) - 1;
+
+	do
+	{
+		uint32_t l = x >> half;
+		uint32_t r = x & mask;
+
+		for(int i = SHUFFLE_ROUNDS - 1; i >= 0; i--)
+		{
+			uint32_t t = r ^ (mix(l ^ shuffle->keys[i]) & mask);
+
+			r = l;
+			l = t;
+		}
+
+		x = (l << half) | r;
+	} while(x >= shuffle->count);
+
+	return x;
+}
+
+/**
+ * Start shuffling tracks.
+ *
+ * \param	shuffle	Shuffle to start.
+ * \param	count	Number of tracks. Must not be 0.
+ * \param	seed	Seed of the order, so that the same seed gives the same
+ *					order.
+ * \param	first	Track to start from, or count or more to start from the
+ *					first track of the order.
+ */
+void initShuffle(struct shuffle_t* shuffle, uint32_t count, uint32_t seed,
+		uint32_t first)
+{
+	shuffle->count = count;
+	shuffle->halfBits = 1;
+	while(shuffle->halfBits < 16 &&
+			count > (1u << (2 * shuffle->halfBits)))
+		shuffle->halfBits++;
+
+	setSeed(shuffle, seed);
+	shuffle->start = first < count ? unpermute(shuffle, first) : 0;
+	shuffle->played = 0;
+}
+
+/**
+ * Get the track being played.
+ */
+uint32_t getShuffleTrack(const struct shuffle_t* shuffle)
+{
+	uint32_t pos = shuffle->start + shuffle->played;
+
+	/* The cycle wraps around to the start of the order. */
+	if(pos >= shuffle->count || pos < shuffle->start)
+		pos -= shuffle->count;
+
+	return permute(shuffle, pos);
+}
+
+/**
+ * Move to the next track. Once every track has been played, a new order is
+ * started that does not begin with the track just played.
+ *
+ * \return	Next track.
+ */
+uint32_t nextShuffleTrack(struct shuffle_t* shuffle)
+{
+	uint32_t last = getShuffleTrack(shuffle);
+
+	if(++shuffle->played < shuffle->count)
+		return getShuffleTrack(shuffle);
+
+	setSeed(shuffle, mix(shuffle->seed));
+	shuffle->start = 0;
+	shuffle->played = 0;
+	if(shuffle->count > 1 && getShuffleTrack(shuffle) == last)
+		shuffle->start = 1;
+
+	return getShuffleTrack(shuffle);
+}
+
+/**
+ * Move back to the previous track of the cycle.
+ *
+ * \param	track	Output previous track.
+ * \return			0 on success, or -1 if at the first track of the cycle.
+ */
+int prevShuffleTrack(struct shuffle_t* shuffle, uint32_t* track)
+{
+	if(shuffle->played == 0)
+		return -1;
+
+	shuffle->played--;
+	*track = getShuffleTrack(shuffle);
+	return 0;
+}
+
+/**
+ * Get a seed for a new order.
+ */
+uint32_t newShuffleSeed(void)
+{
+	u64 tick = svcGetSystemTick();
+
+	return mix((uint32_t)tick ^ mix((uint32_t)(tick >> 32)));
+}
+
+/**
+ * Read the shuffle mode and seed saved with saveShuffleSettings().
+ *
+ * \param	file	Settings file.
+ * \param	mode	Output mode.
+ * \param	seed	Output seed.
+ * \return			0 on success, or -1 if the file could not be read.
+ */
+int loadShuffleSettings(const char* file, enum shuffle_mode* mode,
+		uint32_t* seed)
+{
+	FILE*			f;
+	unsigned		m;
+	unsigned long	s;
+	int				ret = -1;
+
+	if((f = fopen(file, "r")) == NULL)
+		return -1;
+
+	if(fscanf(f, "%u %lx", &m, &s) == 2 && m < SHUFFLE_MODES)
+	{
+		*mode = m;
+		*seed = s;
+		ret = 0;
+	}
+
+	fclose(f);
+	return ret;
+}
+
+/**
+ * Save the shuffle mode and seed, so that the same order is played after a
+ * restart.
+ *
+ * \param	file	Settings file.
+ * \param	mode	Mode.
+ * \param	seed	Seed of the current order.
+ * \return			0 on success, or -1 on failure.
+ */
+int saveShuffleSettings(const char* file, enum shuffle_mode mode,
+		uint32_t seed)
+{
+	FILE*	f;
+	int		ret;
+
+	if((f = fopen(file, "w")) == NULL)
+		return -1;
+
+	ret = fprintf(f, "%u %08lx\n", (unsigned)mode, (unsigned long)seed) < 0;
+	ret |= fclose(f) != 0;
+	return ret ? -1 : 0;
+}
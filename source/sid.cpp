@@ -6,11 +6,13 @@
 extern "C"
 {
 #include "playback.h"
-static int initSid(const char* file);
-static uint32_t rateSid(void);
-static uint8_t channelSid(void);
-static uint64_t readSid(void* buffer);
-static void exitSid(void);
+#include "stream.h"
+static int initSid(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateSid(void* ctx);
+static uint8_t channelSid(void* ctx);
+static uint64_t readSid(void* ctx, void* buffer);
+static void exitSid(void* ctx);
+static int seekSid(void* ctx, uint64_t frame);
 }
 
 static uint32_t		frequency = 44100;
@@ -18,12 +20,28 @@ static int			channels = SIDEMU_STEREO;
 static int			selectedSong = 0;
 static size_t		buffSize = 0.5*frequency*channels; // 0.5 seconds
 
+// PSID/RSID header, load address and the whole of the C64 memory
+static const size_t	maxFileSize = 0x7C + 2 + 0x10000;
+
 // don't change anything below - only 16 bit/sigend PCM is supported my ctrmus
 static int			sampleFormat = SIDEMU_SIGNED_PCM;
 static int			bitsPerSample = SIDEMU_16BIT;
 
-emuEngine	*myEmuEngine = NULL;
-sidTune		*myTune = NULL;
+struct sid_t
+{
+	emuEngine	*myEmuEngine;
+	sidTune		*myTune;
+
+	// samples of each channel emulated since the song started
+	uint64_t	frames;
+};
+
+/*
+ * libsidplay keeps the emulated C64 in global state, so only one emuEngine
+ * may exist at a time. Further instances fail to initialise until the
+ * current one is freed.
+ */
+static volatile bool	engineInUse = false;
 
 /**
  * Set decoder parameters for SID.
@@ -38,40 +56,64 @@ extern "C" void setSid(struct decoder_fn* decoder)
 	decoder->buffSize = buffSize;
 	decoder->decode = &readSid;
 	decoder->exit = &exitSid;
+	decoder->getFileSamples = NULL;
+	decoder->seek = &seekSid;
+	decoder->ctx = NULL;
 }
 
 /**
  * Initialise SID playback.
  *
- * \param	file	Location of SID file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened SID file. It is read whole and closed on success.
  * \return			0 on success, else failure.
  */
-int initSid(const char* file)
+int initSid(struct decoder_fn* decoder, struct stream_t* stream)
 {
-	// init emuEngine
-	myEmuEngine = new emuEngine;
-	if ( !myEmuEngine )
+	struct sid_t *sid;
+	ubyte *data;
+	size_t len;
+
+	if(__atomic_exchange_n(&engineInUse, true, __ATOMIC_ACQ_REL))
 		return -1;
 
+	sid = new sid_t();
+
+	// init emuEngine
+	sid->myEmuEngine = new emuEngine;
+	if ( !sid->myEmuEngine )
+		goto err;
+
 	//configure emuEngine
 	struct emuConfig myEmuConfig;
-	myEmuEngine->getConfig(myEmuConfig);
+	sid->myEmuEngine->getConfig(myEmuConfig);
 	myEmuConfig.frequency = frequency;
 	myEmuConfig.channels = channels;
 	myEmuConfig.bitsPerSample = bitsPerSample;
 	myEmuConfig.sampleFormat = sampleFormat;
-	myEmuEngine->setConfig(myEmuConfig);
+	sid->myEmuEngine->setConfig(myEmuConfig);
 
-	// load the SID file
-	myTune=new sidTune ( file );
-	if ( !myTune )
-		return -1;
+	// load the SID file, which sidTune copies
+	if ( (data = (ubyte *)malloc(maxFileSize)) == NULL )
+		goto err;
+
+	len = readStream(stream, data, maxFileSize);
+	sid->myTune=new sidTune ( data, len );
+	free(data);
+	if ( !sid->myTune || !sid->myTune->getStatus() )
+		goto err;
 
 	// init emuEngine with sidTune
-	if ( !sidEmuInitializeSong(*myEmuEngine,*myTune,selectedSong) )
-		return -1;
+	if ( !sidEmuInitializeSong(*sid->myEmuEngine,*sid->myTune,selectedSong) )
+		goto err;
 
+	closeStream(stream);
+	decoder->ctx = sid;
 	return 0;
+
+err:
+	exitSid(sid);
+	return -1;
 }
 
 /**
@@ -79,8 +121,9 @@ int initSid(const char* file)
  *
  * \return	Sampling rate.
  */
-uint32_t rateSid(void)
+uint32_t rateSid(void* ctx)
 {
+	(void)ctx;
 	return (frequency);
 }
 
@@ -89,8 +132,9 @@ uint32_t rateSid(void)
  *
  * \return	Number of channels for opened file.
  */
-uint8_t channelSid(void)
+uint8_t channelSid(void* ctx)
 {
+	(void)ctx;
 	return channels;
 }
 
@@ -100,25 +144,71 @@ uint8_t channelSid(void)
  * \param buffer	Output.
  * \return			Samples read for each channel.
  */
-uint64_t readSid(void* buffer)
+uint64_t readSid(void* ctx, void* buffer)
 {
-	sidEmuFillBuffer( *myEmuEngine, *myTune, buffer, buffSize*bitsPerSample/8 );
-	if (myTune->getStatus())
+	struct sid_t *sid = (struct sid_t *)ctx;
+
+	sidEmuFillBuffer( *sid->myEmuEngine, *sid->myTune, buffer, buffSize*bitsPerSample/8 );
+	sid->frames += buffSize/channels;
+	if (sid->myTune->getStatus())
 		return buffSize;
 	return 0;
 }
 
+/**
+ * Seek to a sample of SID file. The C64 is emulated up to the sample with
+ * its output discarded, from the start of the song when seeking backwards.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, else failure.
+ */
+int seekSid(void* ctx, uint64_t frame)
+{
+	struct sid_t *sid = (struct sid_t *)ctx;
+	int16_t *scratch;
+
+	if ( frame < sid->frames )
+	{
+		if ( !sidEmuInitializeSong(*sid->myEmuEngine,*sid->myTune,selectedSong) )
+			return -1;
+
+		sid->frames = 0;
+	}
+
+	if ( (scratch = (int16_t *)malloc(buffSize*sizeof(int16_t))) == NULL )
+		return -1;
+
+	while ( sid->frames < frame && sid->myTune->getStatus() )
+	{
+		uint64_t n = frame - sid->frames;
+
+		if ( n > buffSize/channels )
+			n = buffSize/channels;
+
+		sidEmuFillBuffer( *sid->myEmuEngine, *sid->myTune, scratch, n*channels*bitsPerSample/8 );
+		sid->frames += n;
+	}
+
+	free(scratch);
+	return 0;
+}
+
 /**
  * Free Sid file.
  */
-void exitSid(void)
+void exitSid(void* ctx)
 {
-	if(myTune)
+	struct sid_t *sid = (struct sid_t *)ctx;
+
+	if(sid->myTune)
 	{
-		delete(myTune);
+		delete(sid->myTune);
 	}
-	if (myEmuEngine)
+	if (sid->myEmuEngine)
 	{
-		delete(myEmuEngine);
+		delete(sid->myEmuEngine);
 	}
+
+	delete(sid);
+	__atomic_store_n(&engineInUse, false, __ATOMIC_RELEASE);
 }
@@ -0,0 +1,1057 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "platform.h"
+#include "stream.h"
+
+/* Alignment of the memory blocks are read into. */
+#define STREAM_BLOCK_ALIGN	64
+
+/* Blocks read ahead of the block being read, which with it and the block
+ * before it take every block of a stream. */
+#define STREAM_AHEAD		(STREAM_BLOCKS - 2)
+
+enum block_state
+{
+	BLOCK_EMPTY = 0,
+	BLOCK_LOADING,
+	BLOCK_READY
+};
+
+/* Block of a file held in memory. */
+struct streamBlock_t
+{
+	int64_t				off;
+	size_t				len;
+	enum block_state	state;
+	uint8_t*			data;
+};
+
+/*
+ * Blocks of a stream read ahead. Blocks are loaded by the prefetch thread,
+ * or by the reader of the stream when it reaches a block that has not been
+ * loaded.
+ */
+struct readAhead_t
+{
+	/* Guards next and blocks. */
+	LightLock				lock;
+
+	/* Guards the file of the stream, which both threads read. */
+	LightLock				fileLock;
+
+	/* Signalled each time a block is loaded. */
+	LightEvent				loaded;
+
+	/* Offset of the block being read. */
+	int64_t					next;
+
+	struct streamBlock_t	blocks[STREAM_BLOCKS];
+	uint8_t*				buffer;
+};
+
+/* File held in memory by the track cache. */
+struct cachedFile_t
+{
+	char		file[PATH_MAX];
+	int64_t		size;
+	int64_t		mtime;
+
+	/* Contents of the file, or NULL if the entry is unused. */
+	uint8_t*	data;
+	unsigned	id;
+
+	/* Bytes loaded from the start of the file, which only grows, and
+	 * whether the file could not be read. Written atomically by the
+	 * prefetch thread. */
+	size_t		loaded;
+	bool		failed;
+
+	/* Streams reading the file, and system tick at which it was last
+	 * used. */
+	unsigned	refs;
+	u64			lastUse;
+};
+
+/*
+ * Track cache. Files are loaded whole by the prefetch thread, one block at a
+ * time, and the least recently used file not being read is evicted to make
+ * room for another.
+ */
+static struct
+{
+	/* Guards every field of files except the data loaded, and want. */
+	LightLock				lock;
+
+	/* Signalled each time a block of a file is loaded. */
+	LightEvent				loaded;
+
+	struct cachedFile_t		files[TRACK_CACHE_FILES];
+	size_t					used;
+	unsigned				lastId;
+
+	/* File requested with preloadFile(), not yet added. */
+	char					want[PATH_MAX];
+
+	/* File being loaded, which may not be evicted. */
+	struct cachedFile_t*	loading;
+
+	/* File opened by the prefetch thread to load, and its position. */
+	FILE*					f;
+	unsigned				fileId;
+	int64_t					filePos;
+} cache;
+
+/*
+ * Prefetch thread state. The thread loads the missing block nearest to the
+ * reader of each stream read ahead, until each stream has STREAM_AHEAD
+ * blocks loaded ahead of the block being read.
+ */
+static struct
+{
+	Thread				thread;
+	LightEvent			event;
+	volatile bool		quit;
+
+	/* Guards streams, and is held while a block is loaded, so that a stream
+	 * is never closed while the thread reads it. */
+	LightLock			lock;
+	struct stream_t*	streams[PREFETCH_STREAMS];
+
+	bool				disabled;
+	uint32_t			latencyUs;
+
+	/* Updated atomically, as every thread reads streams. */
+	struct streamStats_t	stats;
+} prefetch;
+
+/**
+ * Convert system ticks to microseconds.
+ */
+static uint32_t ticksToUs(u64 ticks)
+{
+	return ticks * 1000000 / SYSCLOCK_ARM11;
+}
+
+/**
+ * Read from a file. The file of a stream read ahead must be locked.
+ *
+ * \param	filePos	Position of f, which is updated.
+ * \param	off		Offset to read from.
+ * \param	buffer	Output.
+ * \param	size	Bytes to read.
+ * \return			Bytes read.
+ */
+static size_t readFile(FILE* f, int64_t* filePos, int64_t off, void* buffer,
+		size_t size)
+{
+	size_t n;
+
+	if(prefetch.latencyUs > 0)
+		svcSleepThread((s64)prefetch.latencyUs * 1000);
+
+	if(*filePos != off)
+	{
+		if(fseek(f, off, SEEK_SET) != 0)
+			return 0;
+
+		*filePos = off;
+	}
+
+	n = fread(buffer, 1, size, f);
+	*filePos += n;
+
+	__atomic_add_fetch(&prefetch.stats.bytesRead, n, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&prefetch.stats.reads, 1, __ATOMIC_RELAXED);
+	return n;
+}
+
+/**
+ * Count a read of a stream that waited for the file.
+ *
+ * \param	start	System tick at which the read started waiting.
+ */
+static void addStall(u64 start)
+{
+	uint32_t us = ticksToUs(svcGetSystemTick() - start);
+
+	__atomic_add_fetch(&prefetch.stats.stalls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&prefetch.stats.stallTotalUs, us, __ATOMIC_RELAXED);
+
+	/* Only streams being decoded are timed, which are read by one thread. */
+	if(us > prefetch.stats.stallMaxUs)
+		prefetch.stats.stallMaxUs = us;
+}
+
+/**
+ * Find a block that is loaded or being loaded. ra->lock must be held.
+ *
+ * \param	off		Offset of block.
+ * \return			Block, or NULL if not found.
+ */
+static struct streamBlock_t* findBlock(struct readAhead_t* ra, int64_t off)
+{
+	for(int i = 0; i < STREAM_BLOCKS; i++)
+	{
+		if(ra->blocks[i].state != BLOCK_EMPTY && ra->blocks[i].off == off)
+			return &ra->blocks[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Take a block that is empty, or that holds data outside of the block
+ * before the one being read and the blocks read ahead of it, to load a
+ * block into. ra->lock must be held.
+ *
+ * \param	off		Offset of block to load.
+ * \return			Block, now being loaded, or NULL if every block is in use.
+ */
+static struct streamBlock_t* claimBlock(struct readAhead_t* ra, int64_t off)
+{
+	struct streamBlock_t* block = NULL;
+
+	for(int i = 0; i < STREAM_BLOCKS; i++)
+	{
+		struct streamBlock_t* b = &ra->blocks[i];
+
+		if(b->state == BLOCK_EMPTY)
+		{
+			block = b;
+			break;
+		}
+
+		if(b->state == BLOCK_READY &&
+				(b->off < ra->next - STREAM_BLOCK_SIZE ||
+				 b->off > ra->next + STREAM_AHEAD * STREAM_BLOCK_SIZE))
+			block = b;
+	}
+
+	if(block != NULL)
+	{
+		block->off = off;
+		block->len = 0;
+		block->state = BLOCK_LOADING;
+	}
+
+	return block;
+}
+
+/**
+ * Load a block claimed with claimBlock() from the file.
+ */
+static void loadBlock(struct stream_t* stream, struct streamBlock_t* block)
+{
+	struct readAhead_t*	ra = stream->ra;
+	size_t				len;
+
+	LightLock_Lock(&ra->fileLock);
+	len = readFile(stream->f, &stream->filePos, block->off, block->data,
+			STREAM_BLOCK_SIZE);
+	LightLock_Unlock(&ra->fileLock);
+
+	LightLock_Lock(&ra->lock);
+	block->len = len;
+	block->state = BLOCK_READY;
+	LightLock_Unlock(&ra->lock);
+
+	LightEvent_Signal(&ra->loaded);
+}
+
+/**
+ * Claim the missing block nearest ahead of the reader of a stream.
+ *
+ * \return	Block to load, or NULL if every block ahead is loaded.
+ */
+static struct streamBlock_t* claimAhead(struct stream_t* stream)
+{
+	struct readAhead_t*		ra = stream->ra;
+	struct streamBlock_t*	block = NULL;
+
+	LightLock_Lock(&ra->lock);
+	for(int i = 0; i <= STREAM_AHEAD; i++)
+	{
+		int64_t off = ra->next + (int64_t)i * STREAM_BLOCK_SIZE;
+
+		if(off >= stream->size)
+			break;
+
+		if(findBlock(ra, off) == NULL)
+		{
+			block = claimBlock(ra, off);
+			break;
+		}
+	}
+	LightLock_Unlock(&ra->lock);
+
+	return block;
+}
+
+/**
+ * Load the next block missing ahead of any stream.
+ *
+ * \return	true if a block was loaded, or false if there was none to load.
+ */
+static bool prefetchBlock(void)
+{
+	bool loaded = false;
+
+	LightLock_Lock(&prefetch.lock);
+	for(int i = 0; i < PREFETCH_STREAMS && loaded == false; i++)
+	{
+		struct streamBlock_t* block;
+
+		if(prefetch.streams[i] == NULL ||
+				(block = claimAhead(prefetch.streams[i])) == NULL)
+			continue;
+
+		loadBlock(prefetch.streams[i], block);
+		__atomic_add_fetch(&prefetch.stats.prefetched, 1, __ATOMIC_RELAXED);
+		loaded = true;
+	}
+	LightLock_Unlock(&prefetch.lock);
+
+	return loaded;
+}
+
+/**
+ * Find a file in the track cache. cache.lock must be held.
+ *
+ * \return	File, or NULL if not found or if it changed since it was loaded.
+ */
+static struct cachedFile_t* findCached(const char* file, int64_t size,
+		int64_t mtime)
+{
+	for(int i = 0; i < TRACK_CACHE_FILES; i++)
+	{
+		struct cachedFile_t* entry = &cache.files[i];
+
+		if(entry->data != NULL && entry->size == size &&
+				entry->mtime == mtime && strcmp(entry->file, file) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * Evict the least recently used file that is neither read nor being loaded.
+ * cache.lock must be held.
+ *
+ * \return	true if a file was evicted, or false if none could be.
+ */
+static bool evictCached(void)
+{
+	struct cachedFile_t* lru = NULL;
+
+	for(int i = 0; i < TRACK_CACHE_FILES; i++)
+	{
+		struct cachedFile_t* entry = &cache.files[i];
+
+		if(entry->data == NULL || entry->refs > 0 || entry == cache.loading)
+			continue;
+
+		if(lru == NULL || entry->lastUse < lru->lastUse)
+			lru = entry;
+	}
+
+	if(lru == NULL)
+		return false;
+
+	free(lru->data);
+	lru->data = NULL;
+	cache.used -= lru->size;
+	return true;
+}
+
+/**
+ * Find an unused entry of the track cache. cache.lock must be held.
+ *
+ * \return	Entry, or NULL if every entry is used.
+ */
+static struct cachedFile_t* findUnused(void)
+{
+	for(int i = 0; i < TRACK_CACHE_FILES; i++)
+	{
+		if(cache.files[i].data == NULL)
+			return &cache.files[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Add a file to the track cache, to be loaded by the prefetch thread.
+ * cache.lock must be held.
+ *
+ * \return	File, or NULL if it is too large or there is no room for it.
+ */
+static struct cachedFile_t* addCached(const char* file, int64_t size,
+		int64_t mtime)
+{
+	struct cachedFile_t* entry = NULL;
+
+	if(size <= 0 || size > TRACK_CACHE_MAX_FILE ||
+			strlen(file) >= sizeof(entry->file))
+		return NULL;
+
+	/* Evict files until there is room for the file and an unused entry. */
+	while(cache.used + size > TRACK_CACHE_SIZE ||
+			(entry = findUnused()) == NULL)
+	{
+		if(evictCached() == false)
+			return NULL;
+	}
+
+	if((entry->data = malloc(size)) == NULL)
+		return NULL;
+
+	strcpy(entry->file, file);
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->id = ++cache.lastId;
+	entry->loaded = 0;
+	entry->failed = false;
+	entry->refs = 0;
+	entry->lastUse = svcGetSystemTick();
+	cache.used += size;
+	return entry;
+}
+
+/**
+ * Read a stream from the track cache, waiting for the block being loaded
+ * if it is the one being read.
+ *
+ * \param	out		Output.
+ * \param	size	Bytes to read.
+ * \return			Bytes read, which is 0 if the position of the stream is
+ *					not loaded.
+ */
+static size_t readCached(struct stream_t* stream, uint8_t* out, size_t size)
+{
+	struct cachedFile_t*	entry = stream->cached;
+	u64						start = 0;
+	size_t					loaded;
+	size_t					n;
+
+	while((int64_t)(loaded = __atomic_load_n(&entry->loaded,
+					__ATOMIC_ACQUIRE)) <= stream->pos)
+	{
+		/* Positions well beyond the file loaded are read from the file. */
+		if((int64_t)loaded == entry->size ||
+				__atomic_load_n(&entry->failed, __ATOMIC_ACQUIRE) == true ||
+				stream->pos >= (int64_t)loaded + STREAM_BLOCK_SIZE)
+			break;
+
+		if(start == 0)
+			start = svcGetSystemTick();
+
+		LightEvent_WaitTimeout(&cache.loaded, 10 * 1000 * 1000);
+	}
+
+	if(start != 0)
+		addStall(start);
+
+	if((int64_t)loaded <= stream->pos)
+		return 0;
+
+	n = loaded - stream->pos;
+	if(n > size)
+		n = size;
+
+	memcpy(out, entry->data + stream->pos, n);
+	stream->pos += n;
+	return n;
+}
+
+/**
+ * Read a stream from the track cache, adding its file if it is not there.
+ *
+ * \return	0 on success, or -1 if the file may not be cached.
+ */
+static int attachCached(struct stream_t* stream)
+{
+	struct cachedFile_t*	entry;
+	int64_t					mtime;
+
+	if(stream->size < 0 || (mtime = getFileMtime(stream->file)) < 0)
+		return -1;
+
+	LightLock_Lock(&cache.lock);
+	if((entry = findCached(stream->file, stream->size, mtime)) != NULL &&
+			entry->failed == false)
+		__atomic_add_fetch(&prefetch.stats.cacheHits, 1, __ATOMIC_RELAXED);
+	else if(entry == NULL)
+		entry = addCached(stream->file, stream->size, mtime);
+	else
+		entry = NULL;
+
+	if(entry != NULL)
+	{
+		entry->refs++;
+		entry->lastUse = svcGetSystemTick();
+		stream->cached = entry;
+	}
+	LightLock_Unlock(&cache.lock);
+
+	if(entry == NULL)
+		return -1;
+
+	LightEvent_Signal(&prefetch.event);
+	return 0;
+}
+
+/**
+ * Choose the next file of the track cache to load. Files being read are
+ * loaded first, followed by the file added last. cache.lock must be held.
+ *
+ * \return	File, or NULL if every file is loaded.
+ */
+static struct cachedFile_t* nextCached(void)
+{
+	struct cachedFile_t* next = NULL;
+
+	for(int i = 0; i < TRACK_CACHE_FILES; i++)
+	{
+		struct cachedFile_t* entry = &cache.files[i];
+
+		if(entry->data == NULL || entry->failed == true ||
+				(int64_t)entry->loaded == entry->size)
+			continue;
+
+		if(next == NULL || (entry->refs > 0 && next->refs == 0) ||
+				((entry->refs > 0) == (next->refs > 0) &&
+				 entry->lastUse > next->lastUse))
+			next = entry;
+	}
+
+	return next;
+}
+
+/**
+ * Add the file requested with preloadFile() to the track cache.
+ */
+static void addWanted(void)
+{
+	char		want[PATH_MAX];
+	struct stat	st;
+	int64_t		mtime;
+
+	LightLock_Lock(&cache.lock);
+	strcpy(want, cache.want);
+	cache.want[0] = '\0';
+	LightLock_Unlock(&cache.lock);
+
+	/* The file is checked without the lock, as it reads the SD card. */
+	if(want[0] == '\0' || stat(want, &st) != 0 || !S_ISREG(st.st_mode) ||
+			(mtime = getFileMtime(want)) < 0)
+		return;
+
+	LightLock_Lock(&cache.lock);
+	if(findCached(want, st.st_size, mtime) == NULL)
+		addCached(want, st.st_size, mtime);
+	LightLock_Unlock(&cache.lock);
+}
+
+/**
+ * Load the next block of a file of the track cache.
+ *
+ * \return	true if a block was loaded, or false if every file is loaded.
+ */
+static bool loadCachedBlock(void)
+{
+	struct cachedFile_t*	entry;
+	size_t					len;
+	size_t					n = 0;
+
+	addWanted();
+
+	LightLock_Lock(&cache.lock);
+	cache.loading = entry = nextCached();
+	LightLock_Unlock(&cache.lock);
+
+	if(entry == NULL)
+		return false;
+
+	if(cache.fileId != entry->id)
+	{
+		if(cache.f != NULL)
+			fclose(cache.f);
+
+		cache.f = fopen(entry->file, "rb");
+		cache.fileId = entry->id;
+		cache.filePos = 0;
+	}
+
+	len = entry->size - entry->loaded;
+	if(len > STREAM_BLOCK_SIZE)
+		len = STREAM_BLOCK_SIZE;
+
+	if(cache.f != NULL)
+		n = readFile(cache.f, &cache.filePos, entry->loaded,
+				entry->data + entry->loaded, len);
+
+	if(n < len)
+		__atomic_store_n(&entry->failed, true, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&entry->loaded, entry->loaded + n, __ATOMIC_RELEASE);
+
+	if(n < len || (int64_t)entry->loaded == entry->size)
+	{
+		if(cache.f != NULL)
+			fclose(cache.f);
+
+		cache.f = NULL;
+		cache.fileId = 0;
+	}
+
+	LightLock_Lock(&cache.lock);
+	cache.loading = NULL;
+	LightLock_Unlock(&cache.lock);
+
+	LightEvent_Signal(&cache.loaded);
+	return true;
+}
+
+/**
+ * Prefetch thread. Loads blocks each time a stream is started or moves to
+ * another block.
+ */
+static void prefetchThread(void* arg)
+{
+	(void)arg;
+
+	while(prefetch.quit == false)
+	{
+		LightEvent_Wait(&prefetch.event);
+
+		/* Streams being read are read ahead before files are cached. */
+		while(prefetch.quit == false &&
+				(prefetchBlock() == true || loadCachedBlock() == true))
+			;
+	}
+}
+
+/**
+ * Start the thread that reads streams ahead of their decoders.
+ *
+ * \param	prio	Priority of the thread, which should be higher than that of
+ *					the decoders, as it mostly waits for the SD card.
+ * \return			0 on success, or -1 on failure.
+ */
+int startPrefetch(int prio)
+{
+	LightLock_Init(&prefetch.lock);
+	LightEvent_Init(&prefetch.event, RESET_ONESHOT);
+	LightLock_Init(&cache.lock);
+	LightEvent_Init(&cache.loaded, RESET_ONESHOT);
+	prefetch.quit = false;
+
+	prefetch.thread = threadCreate(prefetchThread, NULL, 16 * 1024, prio, -2,
+			false);
+
+	return prefetch.thread == NULL ? -1 : 0;
+}
+
+/**
+ * Stop the prefetch thread and empty the track cache. Streams read ahead
+ * must be closed first.
+ */
+void exitPrefetch(void)
+{
+	if(prefetch.thread == NULL)
+		return;
+
+	prefetch.quit = true;
+	LightEvent_Signal(&prefetch.event);
+	threadJoin(prefetch.thread, U64_MAX);
+	threadFree(prefetch.thread);
+	prefetch.thread = NULL;
+
+	for(int i = 0; i < TRACK_CACHE_FILES; i++)
+	{
+		free(cache.files[i].data);
+		cache.files[i].data = NULL;
+	}
+
+	if(cache.f != NULL)
+		fclose(cache.f);
+
+	cache.f = NULL;
+	cache.fileId = 0;
+	cache.used = 0;
+	cache.want[0] = '\0';
+}
+
+/**
+ * Open a file, read its start and detect its type.
+ *
+ * \param	file	File location.
+ * \return			Stream, or NULL on failure with errno set. If the type of
+ *					the file isn't supported, type is FILE_TYPE_ERROR.
+ */
+struct stream_t* openStream(const char* file)
+{
+	struct stream_t*	stream;
+	struct stat			st;
+	u64					tick = svcGetSystemTick();
+
+	if(strlen(file) >= sizeof(stream->file))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if((stream = malloc(sizeof(struct stream_t))) == NULL)
+		return NULL;
+
+	if((stream->f = fopen(file, "rb")) == NULL)
+	{
+		free(stream);
+		return NULL;
+	}
+
+	strcpy(stream->file, file);
+	stream->openTick = tick;
+	stream->size = fstat(fileno(stream->f), &st) == 0 ? st.st_size : -1;
+
+	readProbe(stream->f, &stream->probe);
+	stream->filePos = ftell(stream->f);
+	stream->pos = 0;
+	stream->ra = NULL;
+	stream->cached = NULL;
+	stream->timed = false;
+	stream->playing = false;
+
+	if((stream->type = probeType(&stream->probe)) == FILE_TYPE_ERROR)
+		errno = FILE_NOT_SUPPORTED;
+
+	return stream;
+}
+
+/**
+ * Read from a stream read ahead, waiting for blocks that are not loaded.
+ *
+ * \param	out		Output.
+ * \param	size	Bytes to read.
+ * \return			Bytes read.
+ */
+static size_t readBlocks(struct stream_t* stream, uint8_t* out, size_t size)
+{
+	struct readAhead_t*	ra = stream->ra;
+	size_t				read = 0;
+	u64					start = 0;
+
+	while(read < size && stream->pos < stream->size)
+	{
+		int64_t					off = stream->pos - stream->pos %
+			STREAM_BLOCK_SIZE;
+		struct streamBlock_t*	block;
+		bool					moved;
+		bool					ready = false;
+		bool					load = false;
+		size_t					n = 0;
+
+		LightLock_Lock(&ra->lock);
+		moved = ra->next != off;
+		ra->next = off;
+
+		if((block = findBlock(ra, off)) == NULL &&
+				(block = claimBlock(ra, off)) != NULL)
+			load = true;
+		else if(block != NULL && block->state == BLOCK_READY)
+		{
+			size_t at = stream->pos - off;
+
+			n = block->len > at ? block->len - at : 0;
+			if(n > size - read)
+				n = size - read;
+
+			memcpy(out + read, block->data + at, n);
+			ready = true;
+		}
+		LightLock_Unlock(&ra->lock);
+
+		if(moved == true)
+			LightEvent_Signal(&prefetch.event);
+
+		if(ready == true)
+		{
+			/* The file ended early, or could not be read. */
+			if(n == 0)
+				break;
+
+			stream->pos += n;
+			read += n;
+			continue;
+		}
+
+		if(start == 0)
+			start = svcGetSystemTick();
+
+		/* Wait for the prefetch thread to load the block, or load it. */
+		if(load == true)
+			loadBlock(stream, block);
+		else
+			LightEvent_Wait(&ra->loaded);
+	}
+
+	if(start != 0)
+		addStall(start);
+
+	return read;
+}
+
+/**
+ * Read from a stream.
+ *
+ * \param	buffer	Output.
+ * \param	size	Bytes to read.
+ * \return			Bytes read, which is less than size at the end of the
+ *					stream or on failure.
+ */
+size_t readStream(struct stream_t* stream, void* buffer, size_t size)
+{
+	uint8_t*	out = buffer;
+	size_t		read = 0;
+	size_t		n;
+	u64			start;
+
+	/* Start of file is already in memory. */
+	if(stream->pos < (int64_t)stream->probe.len)
+	{
+		read = stream->probe.len - stream->pos;
+		if(read > size)
+			read = size;
+
+		memcpy(out, stream->probe.data + stream->pos, read);
+		stream->pos += read;
+	}
+
+	if(read < size && stream->cached != NULL)
+		read += readCached(stream, out + read, size - read);
+
+	if(read == size)
+		return read;
+
+	if(stream->ra != NULL)
+		return read + readBlocks(stream, out + read, size - read);
+
+	start = svcGetSystemTick();
+	n = readFile(stream->f, &stream->filePos, stream->pos, out + read,
+			size - read);
+	stream->pos += n;
+	read += n;
+
+	if(stream->timed == true)
+		addStall(start);
+
+	return read;
+}
+
+/**
+ * Set position of a stream.
+ *
+ * \param	offset	Offset from whence.
+ * \param	whence	SEEK_SET, SEEK_CUR or SEEK_END.
+ * \return			0 on success, or -1 on failure.
+ */
+int seekStream(struct stream_t* stream, int64_t offset, int whence)
+{
+	int64_t pos;
+
+	switch(whence)
+	{
+		case SEEK_SET:
+			pos = offset;
+			break;
+
+		case SEEK_CUR:
+			pos = stream->pos + offset;
+			break;
+
+		case SEEK_END:
+			if(stream->size < 0)
+				return -1;
+
+			pos = stream->size + offset;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if(pos < 0)
+		return -1;
+
+	/* The file is only repositioned when it is next read. */
+	stream->pos = pos;
+	return 0;
+}
+
+/**
+ * Get position of a stream.
+ */
+int64_t tellStream(const struct stream_t* stream)
+{
+	return stream->pos;
+}
+
+/**
+ * Read a stream ahead of its reader in the prefetch thread, from now until
+ * it is closed. Reads of the stream are counted as stalls where they wait
+ * for the file, whether or not it is read ahead.
+ *
+ * \return	0 on success, or -1 if the stream is read directly, such as when
+ *			the prefetch thread is not running or read-ahead is disabled.
+ */
+int startReadAhead(struct stream_t* stream)
+{
+	struct readAhead_t*	ra;
+	int64_t				pos;
+	int					slot = -1;
+
+	stream->timed = true;
+
+	/* Files held entirely in memory need not be read ahead. */
+	if(prefetch.thread == NULL || prefetch.disabled == true ||
+			stream->ra != NULL || stream->cached != NULL ||
+			stream->size <= (int64_t)stream->probe.len)
+		return -1;
+
+	if(attachCached(stream) == 0)
+		return 0;
+
+	if((ra = calloc(1, sizeof(struct readAhead_t))) == NULL)
+		return -1;
+
+	if((ra->buffer = memalign(STREAM_BLOCK_ALIGN,
+					STREAM_BLOCKS * STREAM_BLOCK_SIZE)) == NULL)
+	{
+		free(ra);
+		return -1;
+	}
+
+	LightLock_Init(&ra->lock);
+	LightLock_Init(&ra->fileLock);
+	LightEvent_Init(&ra->loaded, RESET_ONESHOT);
+	for(int i = 0; i < STREAM_BLOCKS; i++)
+		ra->blocks[i].data = ra->buffer + i * STREAM_BLOCK_SIZE;
+
+	pos = stream->pos > (int64_t)stream->probe.len ?
+		stream->pos : (int64_t)stream->probe.len;
+	ra->next = pos - pos % STREAM_BLOCK_SIZE;
+
+	LightLock_Lock(&prefetch.lock);
+	for(int i = 0; i < PREFETCH_STREAMS && slot < 0; i++)
+	{
+		if(prefetch.streams[i] == NULL)
+			slot = i;
+	}
+
+	if(slot >= 0)
+	{
+		stream->ra = ra;
+		prefetch.streams[slot] = stream;
+	}
+	LightLock_Unlock(&prefetch.lock);
+
+	if(slot < 0)
+	{
+		free(ra->buffer);
+		free(ra);
+		return -1;
+	}
+
+	LightEvent_Signal(&prefetch.event);
+	return 0;
+}
+
+/**
+ * Load a file into the track cache in the prefetch thread, once streams
+ * being read have been read ahead, so that it may later be played from
+ * memory. Only the file most recently requested is loaded.
+ *
+ * \param	file	File to load, or NULL.
+ */
+void preloadFile(const char* file)
+{
+	if(file == NULL || prefetch.thread == NULL || prefetch.disabled == true ||
+			strlen(file) >= sizeof(cache.want))
+		return;
+
+	LightLock_Lock(&cache.lock);
+	strcpy(cache.want, file);
+	LightLock_Unlock(&cache.lock);
+
+	LightEvent_Signal(&prefetch.event);
+}
+
+/**
+ * Enable or disable read-ahead of streams started after this call. Enabled
+ * by default.
+ */
+void setReadAhead(bool enable)
+{
+	prefetch.disabled = !enable;
+}
+
+/**
+ * Delay every read of a file, so that slow storage such as the SD card of
+ * the 3DS may be simulated on the host.
+ *
+ * \param	us	Delay in microseconds, or 0 for none.
+ */
+void setStreamLatency(uint32_t us)
+{
+	prefetch.latencyUs = us;
+}
+
+/**
+ * Get statistics of reads from files since the program started.
+ *
+ * \param	out		Output statistics.
+ */
+void getStreamStats(struct streamStats_t* out)
+{
+	memcpy(out, &prefetch.stats, sizeof(prefetch.stats));
+}
+
+/**
+ * Close a stream. Does nothing if stream is NULL.
+ */
+void closeStream(struct stream_t* stream)
+{
+	if(stream == NULL)
+		return;
+
+	if(stream->ra != NULL)
+	{
+		LightLock_Lock(&prefetch.lock);
+		for(int i = 0; i < PREFETCH_STREAMS; i++)
+		{
+			if(prefetch.streams[i] == stream)
+				prefetch.streams[i] = NULL;
+		}
+		LightLock_Unlock(&prefetch.lock);
+
+		free(stream->ra->buffer);
+		free(stream->ra);
+	}
+
+	if(stream->cached != NULL)
+	{
+		LightLock_Lock(&cache.lock);
+		stream->cached->refs--;
+		stream->cached->lastUse = svcGetSystemTick();
+		LightLock_Unlock(&cache.lock);
+	}
+
+	fclose(stream->f);
+	free(stream);
+}
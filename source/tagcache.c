@@ -0,0 +1,251 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "library.h"
+#include "platform.h"
+#include "stream.h"
+#include "tagcache.h"
+
+/* Number of files whose tags are kept. Must be a power of two. */
+#define TAG_CACHE_SLOTS	512
+
+/* Number of files waiting to be read. Enough for a screen of files. */
+#define TAG_QUEUE_LEN	32
+
+enum slot_state
+{
+	SLOT_EMPTY = 0,
+	SLOT_QUEUED,
+	SLOT_NO_TAGS,
+	SLOT_TAGS
+};
+
+/* Tags of a file, identified by a hash of its path. */
+struct tagSlot_t
+{
+	uint64_t		hash;
+	enum slot_state	state;
+	struct tags_t	tags;
+};
+
+/*
+ * Tag cache. Slots are indexed directly by the hash of the path, so a file
+ * replaces any other with the same index. Files are read most recently
+ * queued first, so that the files on screen are read before those that have
+ * been scrolled past. Once the queue is full, the oldest file is dropped.
+ */
+static struct
+{
+	Thread				thread;
+	LightLock			lock;
+	LightEvent			event;
+	volatile bool		quit;
+	volatile unsigned	gen;
+
+	struct tagSlot_t	slots[TAG_CACHE_SLOTS];
+
+	struct
+	{
+		uint64_t		hash;
+		char			file[PATH_MAX];
+	}					queue[TAG_QUEUE_LEN];
+	unsigned			head;
+	unsigned			count;
+} cache;
+
+/**
+ * FNV-1a hash of a path.
+ */
+static uint64_t hashPath(const char* file)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	while(*file != '\0')
+	{
+		hash ^= (uint8_t)*file++;
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Add a file to the queue. Must be called with the lock held.
+ */
+static void pushFile(uint64_t hash, const char* file)
+{
+	unsigned i = cache.head;
+
+	/* Drop the oldest file, so that it is queued again if it is shown. */
+	if(cache.count == TAG_QUEUE_LEN)
+	{
+		struct tagSlot_t* slot =
+			&cache.slots[cache.queue[i].hash & (TAG_CACHE_SLOTS - 1)];
+
+		if(slot->hash == cache.queue[i].hash && slot->state == SLOT_QUEUED)
+			slot->state = SLOT_EMPTY;
+	}
+	else
+		cache.count++;
+
+	cache.queue[i].hash = hash;
+	strcpy(cache.queue[i].file, file);
+	cache.head = (i + 1) % TAG_QUEUE_LEN;
+}
+
+/**
+ * Take the most recently queued file. Must be called with the lock held.
+ *
+ * \return	false if the queue is empty.
+ */
+static bool popFile(uint64_t* hash, char* file)
+{
+	if(cache.count == 0)
+		return false;
+
+	cache.head = (cache.head + TAG_QUEUE_LEN - 1) % TAG_QUEUE_LEN;
+	cache.count--;
+	*hash = cache.queue[cache.head].hash;
+	memcpy(file, cache.queue[cache.head].file, PATH_MAX);
+	return true;
+}
+
+/**
+ * Tag reader thread. Reads queued files, taking tags from the library index
+ * where the file is indexed.
+ */
+static void tagThread(void* arg)
+{
+	static char		file[PATH_MAX];
+	struct tags_t	tags;
+	uint64_t		hash;
+
+	(void)arg;
+
+	while(cache.quit == false)
+	{
+		LightEvent_Wait(&cache.event);
+
+		while(cache.quit == false)
+		{
+			struct stream_t*	stream;
+			struct tagSlot_t*	slot;
+			int					found;
+
+			LightLock_Lock(&cache.lock);
+			if(popFile(&hash, file) == false)
+			{
+				LightLock_Unlock(&cache.lock);
+				break;
+			}
+			LightLock_Unlock(&cache.lock);
+
+			if((found = getLibraryTags(file, &tags)) < 0)
+			{
+				memset(&tags, 0, sizeof(tags));
+				if((stream = openStream(file)) != NULL)
+				{
+					found = readTags(stream, &tags) == 0;
+					closeStream(stream);
+				}
+			}
+
+			LightLock_Lock(&cache.lock);
+			slot = &cache.slots[hash & (TAG_CACHE_SLOTS - 1)];
+			if(slot->hash == hash && slot->state == SLOT_QUEUED)
+			{
+				slot->tags = tags;
+				slot->state = found > 0 ? SLOT_TAGS : SLOT_NO_TAGS;
+				cache.gen++;
+			}
+			LightLock_Unlock(&cache.lock);
+		}
+	}
+}
+
+/**
+ * Start the tag reader thread.
+ *
+ * \return	0 on success, or -1 on failure.
+ */
+int startTagCache(void)
+{
+	s32 prio;
+
+	LightLock_Init(&cache.lock);
+	LightEvent_Init(&cache.event, RESET_ONESHOT);
+	cache.quit = false;
+
+	/* Run below the UI, so that only its idle time is used. */
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	cache.thread = threadCreate(tagThread, NULL, 32 * 1024, prio + 1, -2,
+			false);
+
+	return cache.thread == NULL ? -1 : 0;
+}
+
+/**
+ * Stop the tag reader thread.
+ */
+void exitTagCache(void)
+{
+	if(cache.thread == NULL)
+		return;
+
+	cache.quit = true;
+	LightEvent_Signal(&cache.event);
+	threadJoin(cache.thread, U64_MAX);
+	threadFree(cache.thread);
+	cache.thread = NULL;
+}
+
+/**
+ * Get the tags of a file. Tags that have not been read yet are read in the
+ * background, so this is called only for files that are shown.
+ *
+ * \param	file	Full path of file.
+ * \param	tags	Output tags.
+ * \return			1 if the file has tags, 0 if it has none, or -1 if they
+ *					have not been read yet.
+ */
+int getTags(const char* file, struct tags_t* tags)
+{
+	uint64_t			hash;
+	struct tagSlot_t*	slot;
+	int					ret = -1;
+
+	if(cache.thread == NULL || strlen(file) >= PATH_MAX)
+		return -1;
+
+	hash = hashPath(file);
+	slot = &cache.slots[hash & (TAG_CACHE_SLOTS - 1)];
+
+	LightLock_Lock(&cache.lock);
+	if(slot->hash == hash && slot->state == SLOT_TAGS)
+	{
+		*tags = slot->tags;
+		ret = 1;
+	}
+	else if(slot->hash == hash && slot->state == SLOT_NO_TAGS)
+		ret = 0;
+	else if(slot->hash != hash || slot->state == SLOT_EMPTY)
+	{
+		slot->hash = hash;
+		slot->state = SLOT_QUEUED;
+		pushFile(hash, file);
+		LightEvent_Signal(&cache.event);
+	}
+	LightLock_Unlock(&cache.lock);
+
+	return ret;
+}
+
+/**
+ * Number of files whose tags have been read, so that the files shown may be
+ * redrawn with their tags.
+ */
+unsigned getTagCacheGen(void)
+{
+	return cache.gen;
+}
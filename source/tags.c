@@ -0,0 +1,588 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "file.h"
+#include "opus.h"
+#include "stream.h"
+#include "tags.h"
+#include "vorbis.h"
+
+/* Longest tag value read, in bytes of its original encoding. */
+#define TAG_READ_MAX	256
+
+/* Limits on the structures walked, so that corrupt files end quickly. */
+#define FLAC_BLOCKS_MAX	128
+#define COMMENTS_MAX	1024
+
+static uint32_t be32(const uint8_t* b)
+{
+	return (uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+static uint32_t le32(const uint8_t* b)
+{
+	return (uint32_t)b[3] << 24 | b[2] << 16 | b[1] << 8 | b[0];
+}
+
+/**
+ * Get a syncsafe integer, of which only the lower 7 bits of each byte are
+ * used.
+ */
+static uint32_t syncsafe(const uint8_t* b)
+{
+	return (uint32_t)(b[0] & 0x7F) << 21 | (b[1] & 0x7F) << 14 |
+		(b[2] & 0x7F) << 7 | (b[3] & 0x7F);
+}
+
+/**
+ * Append a code point to a UTF-8 string.
+ *
+ * \param	dst		Output string of size TAG_LEN, which is kept terminated.
+ * \param	len		Length of output string, updated.
+ * \param	cp		Code point.
+ * \return			false if there is no room for the code point.
+ */
+static bool putUtf8(char* dst, size_t* len, uint32_t cp)
+{
+	uint8_t	b[4];
+	size_t	n;
+
+	if(cp < 0x80)
+	{
+		b[0] = cp;
+		n = 1;
+	}
+	else if(cp < 0x800)
+	{
+		b[0] = 0xC0 | cp >> 6;
+		b[1] = 0x80 | (cp & 0x3F);
+		n = 2;
+	}
+	else if(cp < 0x10000)
+	{
+		b[0] = 0xE0 | cp >> 12;
+		b[1] = 0x80 | ((cp >> 6) & 0x3F);
+		b[2] = 0x80 | (cp & 0x3F);
+		n = 3;
+	}
+	else
+	{
+		b[0] = 0xF0 | cp >> 18;
+		b[1] = 0x80 | ((cp >> 12) & 0x3F);
+		b[2] = 0x80 | ((cp >> 6) & 0x3F);
+		b[3] = 0x80 | (cp & 0x3F);
+		n = 4;
+	}
+
+	if(*len + n >= TAG_LEN)
+		return false;
+
+	memcpy(dst + *len, b, n);
+	*len += n;
+	dst[*len] = '\0';
+	return true;
+}
+
+/**
+ * Copy ISO-8859-1 text, up to a null character, converting it to UTF-8.
+ */
+static void copyLatin1(char* dst, const uint8_t* src, size_t len)
+{
+	size_t out = 0;
+
+	dst[0] = '\0';
+	for(size_t i = 0; i < len && src[i] != '\0'; i++)
+	{
+		if(!putUtf8(dst, &out, src[i]))
+			break;
+	}
+}
+
+/**
+ * Copy UTF-8 text, up to a null character, without splitting a character
+ * when truncating it.
+ */
+static void copyUtf8(char* dst, const uint8_t* src, size_t len)
+{
+	size_t n = 0;
+
+	while(n < len && src[n] != '\0')
+		n++;
+
+	if(n >= TAG_LEN)
+	{
+		n = TAG_LEN - 1;
+		while(n > 0 && (src[n] & 0xC0) == 0x80)
+			n--;
+	}
+
+	memcpy(dst, src, n);
+	dst[n] = '\0';
+}
+
+/**
+ * Copy UTF-16 text, up to a null character, converting it to UTF-8.
+ *
+ * \param	bigEndian	Byte order, if the text doesn't start with a byte
+ *						order mark.
+ */
+static void copyUtf16(char* dst, const uint8_t* src, size_t len,
+		bool bigEndian)
+{
+	size_t out = 0;
+
+	dst[0] = '\0';
+	if(len >= 2 && ((src[0] == 0xFE && src[1] == 0xFF) ||
+				(src[0] == 0xFF && src[1] == 0xFE)))
+	{
+		bigEndian = src[0] == 0xFE;
+		src += 2;
+		len -= 2;
+	}
+
+	for(size_t i = 0; i + 1 < len; i += 2)
+	{
+		uint32_t cp = bigEndian ? src[i] << 8 | src[i + 1] :
+			src[i + 1] << 8 | src[i];
+
+		if(cp == 0)
+			break;
+
+		/* Combine a surrogate pair. */
+		if(cp >= 0xD800 && cp < 0xDC00 && i + 3 < len)
+		{
+			uint32_t lo = bigEndian ? src[i + 2] << 8 | src[i + 3] :
+				src[i + 3] << 8 | src[i + 2];
+
+			if(lo >= 0xDC00 && lo < 0xE000)
+			{
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				i += 2;
+			}
+		}
+
+		if(!putUtf8(dst, &out, cp))
+			break;
+	}
+}
+
+/**
+ * Parse a track number, such as "7" or "7/12".
+ */
+static uint16_t parseTrack(const char* text)
+{
+	unsigned track = 0;
+
+	while(*text >= '0' && *text <= '9' && track < 10000)
+		track = track * 10 + (*text++ - '0');
+
+	return track < 10000 ? track : 0;
+}
+
+/**
+ * Store a Vorbis comment, of the form "FIELD=value", if it is a tag of
+ * interest.
+ *
+ * \param	tags	Tags to store comment in.
+ * \param	comment	Comment, which need not be null terminated.
+ * \param	len		Length of comment.
+ */
+void addVorbisComment(struct tags_t* tags, const char* comment, size_t len)
+{
+	static const char track[] = "TRACKNUMBER=";
+	const struct
+	{
+		const char*	field;
+		char*		dst;
+	} fields[] = {
+		{ "TITLE=",		tags->title },
+		{ "ARTIST=",	tags->artist },
+		{ "ALBUM=",		tags->album }
+	};
+
+	if(len >= sizeof(track) - 1 &&
+			strncasecmp(comment, track, sizeof(track) - 1) == 0)
+	{
+		char text[TAG_LEN];
+
+		if(tags->track == 0)
+		{
+			copyUtf8(text, (const uint8_t*)comment + sizeof(track) - 1,
+					len - (sizeof(track) - 1));
+			tags->track = parseTrack(text);
+		}
+
+		return;
+	}
+
+	for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+	{
+		size_t n = strlen(fields[i].field);
+
+		if(len < n || strncasecmp(comment, fields[i].field, n) != 0)
+			continue;
+
+		/* Only the first of repeated fields is kept. */
+		if(fields[i].dst[0] == '\0')
+			copyUtf8(fields[i].dst, (const uint8_t*)comment + n, len - n);
+
+		return;
+	}
+}
+
+/**
+ * Whether any tag is present.
+ */
+int hasTags(const struct tags_t* tags)
+{
+	return tags->title[0] != '\0' || tags->artist[0] != '\0' ||
+		tags->album[0] != '\0' || tags->track != 0;
+}
+
+/**
+ * Copy the text of an ID3v2 text frame, which starts with its encoding.
+ */
+static void copyId3Text(char* dst, const uint8_t* src, size_t len)
+{
+	if(len < 1)
+		return;
+
+	switch(src[0])
+	{
+		case 0:
+			copyLatin1(dst, src + 1, len - 1);
+			break;
+
+		case 1:
+		case 2:
+			/* Without a byte order mark, UTF-16 is big endian. */
+			copyUtf16(dst, src + 1, len - 1, true);
+			break;
+
+		case 3:
+			copyUtf8(dst, src + 1, len - 1);
+			break;
+	}
+}
+
+/**
+ * Read an ID3v2 tag, skipping frames that aren't needed by their declared
+ * size, such as pictures.
+ *
+ * \return	0 on success, or -1 if there is no ID3v2 tag.
+ */
+static int readId3v2(struct stream_t* stream, struct tags_t* tags)
+{
+	static const char* const ids[][2] = {
+		/* ID3v2.2, ID3v2.3 and ID3v2.4 */
+		{ "TT2", "TIT2" },
+		{ "TP1", "TPE1" },
+		{ "TAL", "TALB" },
+		{ "TRK", "TRCK" }
+	};
+	uint8_t		header[10];
+	uint8_t		text[TAG_READ_MAX];
+	unsigned	version;
+	size_t		headerLen;
+	int64_t		end;
+
+	if(readStream(stream, header, 10) != 10 ||
+			memcmp(header, "ID3", 3) != 0 || header[3] < 2 || header[3] > 4)
+		return -1;
+
+	version = header[3];
+	headerLen = version == 2 ? 6 : 10;
+	end = 10 + syncsafe(header + 6);
+
+	/* Unsynchronisation of a whole tag may alter frame headers. It is
+	 * rarely used, so such tags are ignored. */
+	if(version < 4 && (header[5] & 0x80))
+		return -1;
+
+	/* Skip an extended header. Its size only includes itself in v2.4. */
+	if(version >= 3 && (header[5] & 0x40))
+	{
+		uint8_t ext[4];
+
+		if(readStream(stream, ext, 4) != 4 ||
+				seekStream(stream, version == 4 ? (int64_t)syncsafe(ext) - 4 :
+					be32(ext), SEEK_CUR) != 0)
+			return -1;
+	}
+
+	while(tellStream(stream) + (int64_t)headerLen <= end)
+	{
+		uint8_t		frame[10];
+		uint32_t	size;
+		uint8_t		flags = 0;
+		int64_t		next;
+		size_t		skip = 0;
+		size_t		n;
+		int			field = -1;
+
+		if(readStream(stream, frame, headerLen) != headerLen || frame[0] == 0)
+			break;
+
+		if(version == 2)
+			size = frame[3] << 16 | frame[4] << 8 | frame[5];
+		else
+		{
+			size = version == 4 ? syncsafe(frame + 4) : be32(frame + 4);
+			flags = frame[9];
+		}
+
+		if((next = tellStream(stream) + size) > end)
+			break;
+
+		for(int i = 0; i < 4; i++)
+		{
+			if(memcmp(frame, ids[i][version != 2], version == 2 ? 3 : 4) == 0)
+				field = i;
+		}
+
+		/* Skip compressed and encrypted frames, and any group identifier
+		 * and data length before the text. */
+		if(version == 3)
+		{
+			if(flags & 0xC0)
+				field = -1;
+
+			skip = (flags & 0x20) != 0;
+		}
+		else if(version == 4)
+		{
+			if(flags & 0x0C)
+				field = -1;
+
+			skip = ((flags & 0x40) != 0) + ((flags & 0x01) != 0) * 4;
+		}
+
+		if(field < 0 || size <= skip)
+			goto next;
+
+		n = size - skip < sizeof(text) ? size - skip : sizeof(text);
+		if(seekStream(stream, skip, SEEK_CUR) != 0 ||
+				readStream(stream, text, n) != n)
+			break;
+
+		/* Undo unsynchronisation of a frame, which follows each 0xFF with
+		 * 0x00. */
+		if(version == 4 && (flags & 0x02))
+		{
+			size_t out = 0;
+
+			for(size_t i = 0; i < n; i++)
+			{
+				if(i == 0 || text[i] != 0x00 || text[i - 1] != 0xFF)
+					text[out++] = text[i];
+			}
+
+			n = out;
+		}
+
+		switch(field)
+		{
+			case 0:
+				copyId3Text(tags->title, text, n);
+				break;
+
+			case 1:
+				copyId3Text(tags->artist, text, n);
+				break;
+
+			case 2:
+				copyId3Text(tags->album, text, n);
+				break;
+
+			case 3:
+			{
+				char track[TAG_LEN];
+
+				track[0] = '\0';
+				copyId3Text(track, text, n);
+				tags->track = parseTrack(track);
+				break;
+			}
+		}
+
+next:
+		if(seekStream(stream, next, SEEK_SET) != 0)
+			break;
+	}
+
+	return 0;
+}
+
+/**
+ * Read an ID3v1 tag, which is at the end of a file.
+ *
+ * \return	0 on success, or -1 if there is no ID3v1 tag.
+ */
+static int readId3v1(struct stream_t* stream, struct tags_t* tags)
+{
+	uint8_t tag[128];
+
+	if(seekStream(stream, -128, SEEK_END) != 0 ||
+			readStream(stream, tag, sizeof(tag)) != sizeof(tag) ||
+			memcmp(tag, "TAG", 3) != 0)
+		return -1;
+
+	/* Fields are padded with spaces or null characters. */
+	for(int i = 3; i < 93; i += 30)
+	{
+		int len = 30;
+
+		while(len > 0 && (tag[i + len - 1] == ' ' || tag[i + len - 1] == 0))
+			len--;
+
+		copyLatin1(i == 3 ? tags->title : i == 33 ? tags->artist :
+				tags->album, tag + i, len);
+	}
+
+	/* ID3v1.1 stores the track number at the end of the comment. */
+	if(tag[125] == 0 && tag[126] != 0)
+		tags->track = tag[126];
+
+	return 0;
+}
+
+/**
+ * Read the VORBIS_COMMENT block of a FLAC file, skipping other metadata
+ * blocks, such as pictures, by their declared size.
+ *
+ * \return	0 on success, or -1 if the file is not a FLAC file.
+ */
+static int readFlacTags(struct stream_t* stream, struct tags_t* tags)
+{
+	uint8_t	b[4];
+	char	comment[TAG_READ_MAX];
+	bool	last = false;
+
+	if(readStream(stream, b, 4) != 4 || memcmp(b, "fLaC", 4) != 0)
+		return -1;
+
+	for(int block = 0; !last && block < FLAC_BLOCKS_MAX; block++)
+	{
+		int64_t		next;
+		uint32_t	count;
+
+		if(readStream(stream, b, 4) != 4)
+			return -1;
+
+		last = b[0] & 0x80;
+		next = tellStream(stream) + (be32(b) & 0xFFFFFF);
+
+		/* Blocks other than VORBIS_COMMENT, such as STREAMINFO, are
+		 * skipped. */
+		if((b[0] & 0x7F) != 4)
+		{
+			if(seekStream(stream, next, SEEK_SET) != 0)
+				return -1;
+
+			continue;
+		}
+
+		/* Skip the vendor string. */
+		if(readStream(stream, b, 4) != 4 ||
+				seekStream(stream, le32(b), SEEK_CUR) != 0 ||
+				readStream(stream, b, 4) != 4)
+			return -1;
+
+		count = le32(b);
+		for(uint32_t i = 0; i < count && i < COMMENTS_MAX; i++)
+		{
+			uint32_t len;
+
+			if(tellStream(stream) + 4 > next || readStream(stream, b, 4) != 4)
+				break;
+
+			if((len = le32(b)) > sizeof(comment) ||
+					tellStream(stream) + len > next)
+			{
+				if(seekStream(stream, len, SEEK_CUR) != 0)
+					break;
+
+				continue;
+			}
+
+			if(readStream(stream, comment, len) != len)
+				break;
+
+			addVorbisComment(tags, comment, len);
+		}
+
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Read the name, author and release strings of a PSID or RSID header.
+ *
+ * \return	0 on success, or -1 if the header is too short.
+ */
+static int readSidTags(struct stream_t* stream, struct tags_t* tags)
+{
+	const uint8_t* data = stream->probe.data;
+
+	if(stream->probe.len < 0x76 ||
+			(memcmp(data, "PSID", 4) != 0 && memcmp(data, "RSID", 4) != 0))
+		return -1;
+
+	copyLatin1(tags->title, data + 0x16, 32);
+	copyLatin1(tags->artist, data + 0x36, 32);
+	copyLatin1(tags->album, data + 0x56, 32);
+	return 0;
+}
+
+/**
+ * Read the tags of a file from its headers, without initialising a decoder.
+ * Reads ID3v2 tags of MP3 files, VORBIS_COMMENT blocks of FLAC files,
+ * comment headers of Opus and Vorbis files, and PSID headers of SID files.
+ *
+ * \param	stream	Opened file, positioned at its start. Its position is
+ *					undefined afterwards.
+ * \param	tags	Output tags, which are emptied first.
+ * \return			0 if any tag was read, or -1 if not.
+ */
+int readTags(struct stream_t* stream, struct tags_t* tags)
+{
+	memset(tags, 0, sizeof(struct tags_t));
+
+	if(seekStream(stream, 0, SEEK_SET) != 0)
+		return -1;
+
+	switch(stream->type)
+	{
+		case FILE_TYPE_MP3:
+			/* Only files without an ID3v2 tag are read from the end. */
+			if(readId3v2(stream, tags) != 0)
+				readId3v1(stream, tags);
+
+			break;
+
+		case FILE_TYPE_FLAC:
+			readFlacTags(stream, tags);
+			break;
+
+		case FILE_TYPE_OPUS:
+			readOpusTags(stream, tags);
+			break;
+
+		case FILE_TYPE_VORBIS:
+			readVorbisTags(stream, tags);
+			break;
+
+		case FILE_TYPE_SID:
+			readSidTags(stream, tags);
+			break;
+
+		default:
+			break;
+	}
+
+	return hasTags(tags) ? 0 : -1;
+}
@@ -3,35 +3,250 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "error.h"
 #include "file.h"
 #include "flac.h"
+#include "library.h"
 #include "mp3.h"
 #include "opus.h"
+#include "output.h"
 #include "playback.h"
+#include "playlist.h"
+#include "sid.h"
+#include "stream.h"
 #include "vorbis.h"
 #include "wav.h"
 
+/**
+ * Play a file through the playback engine, as on the 3DS.
+ *
+ * \param	file	File to play.
+ * \param	wav		WAV file to write output to, or NULL to discard output.
+ * \return			0 on success, or -1 on failure.
+ */
+static int playTest(const char* file, const char* wav)
+{
+	struct playbackInfo_t	info = { 0 };
+	struct errInfo_t		errInfo;
+	struct output_fn		output;
+	struct stream_t*		stream;
+	struct streamStats_t	stats;
+	const char*				env;
+	volatile int			error = 0;
+	Handle					event;
+	u64						start;
+	int						ret = 0;
+
+	/* Simulate the SD card of the 3DS, and compare with read-ahead off. */
+	if((env = getenv("CTRMUS_READ_LATENCY_US")) != NULL)
+		setStreamLatency(strtoul(env, NULL, 10));
+
+	if((env = getenv("CTRMUS_READ_AHEAD")) != NULL)
+		setReadAhead(strcmp(env, "0") != 0);
+
+	if((stream = openStream(file)) == NULL)
+	{
+		printf("Error: %s\n", ctrmus_strerror(errno));
+		return -1;
+	}
+
+	if(svcCreateEvent(&event, RESET_ONESHOT) != 0)
+	{
+		closeStream(stream);
+		return -1;
+	}
+
+	errInfo.error = &error;
+	errInfo.failEvent = &event;
+	info.errInfo = &errInfo;
+	info.gapless = true;
+	info.decodeAheadMs = DECODE_AHEAD_MS;
+	info.waveBufs = WAVEBUFS_DEFAULT;
+
+	if(wav != NULL)
+		setWavOutput(&output, wav);
+	else
+		setNullOutput(&output, 0);
+
+	if(startPlaybackEngine(&info, &output) != 0)
+	{
+		puts("Unable to start playback engine.");
+		closeStream(stream);
+		svcCloseHandle(event);
+		return -1;
+	}
+
+	start = osGetTime();
+	startPlayback(stream, NULL);
+
+	while(true)
+	{
+		svcWaitSynchronization(event, U64_MAX);
+
+		if(error == PLAYBACK_STOPPED)
+			break;
+
+		if(error > 0)
+		{
+			printf("Error: %s\n", ctrmus_strerror(error));
+			ret = -1;
+			break;
+		}
+	}
+
+	printf("Played %zu samples in %llu ms.\n", info.samples_played,
+			(unsigned long long)(osGetTime() - start));
+
+	exitPlaybackEngine();
+
+	getStreamStats(&stats);
+	printf("Read %llu bytes in %lu reads, %lu ahead, %lu from cache. "
+			"Stalled %lu times for %llu ms, at most %lu us.\n",
+			(unsigned long long)stats.bytesRead, (unsigned long)stats.reads,
+			(unsigned long)stats.prefetched, (unsigned long)stats.cacheHits,
+			(unsigned long)stats.stalls,
+			(unsigned long long)stats.stallTotalUs / 1000,
+			(unsigned long)stats.stallMaxUs);
+	svcCloseHandle(event);
+	return ret;
+}
+
+/**
+ * Index a folder as the library scanner does on the 3DS, reusing and then
+ * replacing an existing index file, and print the indexed files.
+ *
+ * \param	root	Folder to index.
+ * \param	file	Index file.
+ * \return			0 on success, or -1 on failure.
+ */
+static int libraryTest(const char* root, const char* file)
+{
+	struct library_t	old, lib = { 0 };
+	bool				hasOld;
+	u64					start;
+
+	if(initMp3Library() != 0)
+		return -1;
+
+	start = osGetTime();
+	hasOld = loadLibrary(&old, file) == 0;
+	printf("Loaded %u entries in %llu ms.\n", hasOld ? old.count : 0,
+			(unsigned long long)(osGetTime() - start));
+
+	start = osGetTime();
+	if(scanLibrary(&lib, hasOld ? &old : NULL, root, NULL) != 0)
+	{
+		printf("%s: %s\n", root, ctrmus_strerror(errno));
+		freeLibrary(&old);
+		exitMp3Library();
+		return -1;
+	}
+
+	printf("Indexed %u entries in %llu ms.\n", lib.count,
+			(unsigned long long)(osGetTime() - start));
+
+	for(uint32_t i = 1; i < lib.count; i++)
+	{
+		const struct libEntry_t* e = &lib.entries[i];
+
+		if(e->type == LIBRARY_TYPE_DIR)
+			continue;
+
+		printf("%-6s %7.1f s %6u Hz %u ch  %s/%s\n", fileToStr(e->type),
+				e->durationMs / 1000.0, e->rate, e->channels,
+				getLibraryString(&lib, lib.entries[e->parent].name),
+				getLibraryString(&lib, e->name));
+
+		if(e->title != LIBRARY_NONE || e->artist != LIBRARY_NONE)
+			printf("       %u. %s - %s (%s)\n", e->track,
+					e->title != LIBRARY_NONE ?
+						getLibraryString(&lib, e->title) : "",
+					e->artist != LIBRARY_NONE ?
+						getLibraryString(&lib, e->artist) : "",
+					e->album != LIBRARY_NONE ?
+						getLibraryString(&lib, e->album) : "");
+	}
+
+	if(saveLibrary(&lib, file) != 0)
+		printf("%s: %s\n", file, ctrmus_strerror(errno));
+
+	freeLibrary(&old);
+	freeLibrary(&lib);
+	exitMp3Library();
+	return 0;
+}
+
+/**
+ * Read a playlist as the player does on the 3DS, and print the path of each
+ * entry that may be played.
+ *
+ * \param	file	Playlist file.
+ * \return			0 on success, or -1 on failure.
+ */
+static int playlistTest(const char* file)
+{
+	struct playlist_t	playlist = { 0 };
+	char				path[PATH_MAX];
+	int32_t				n = 0;
+	u64					start;
+
+	start = osGetTime();
+	if(openPlaylist(&playlist, file) < 0)
+	{
+		printf("%s: %s\n", file, ctrmus_strerror(errno));
+		return -1;
+	}
+
+	printf("Read %u entries in %llu ms.\n", playlist.count,
+			(unsigned long long)(osGetTime() - start));
+
+	while((n = findPlaylistEntry(&playlist, n, 1, path, sizeof(path))) >= 0)
+		printf("%6d  %s\n", n++, path);
+
+	freePlaylist(&playlist);
+	return 0;
+}
+
 /**
  * Test the various decoder modules in ctrmus.
  */
 int main(int argc, char *argv[])
 {
 	struct decoder_fn	decoder;
+	struct stream_t		*stream;
 	enum file_types		ft;
 	const char			*file = argv[1];
 	int16_t				*buffer = NULL;
 	FILE				*out;
 
+	if(argc >= 3 && argc <= 4 && strcmp(argv[1], "-p") == 0)
+		return playTest(argv[2], argc == 4 ? argv[3] : NULL);
+
+	if(argc == 4 && strcmp(argv[1], "-l") == 0)
+		return libraryTest(argv[2], argv[3]);
+
+	if(argc == 3 && strcmp(argv[1], "-m") == 0)
+		return playlistTest(argv[2]);
+
 	if(argc != 2)
 	{
 		puts("FILE is required.");
 		printf("%s FILE\n", argv[0]);
+		printf("%s -p FILE [OUT.wav]\n", argv[0]);
+		printf("%s -l FOLDER INDEX\n", argv[0]);
+		printf("%s -m PLAYLIST\n", argv[0]);
 		return 0;
 	}
 
-	switch(ft = getFileType(file))
+	if((stream = openStream(file)) == NULL)
+	{
+		printf("%s: %s\n", file, ctrmus_strerror(errno));
+		goto err;
+	}
+
+	switch(ft = stream->type)
 	{
 		case FILE_TYPE_WAV:
 			setWav(&decoder);
@@ -53,20 +268,34 @@ int main(int argc, char *argv[])
 			setVorbis(&decoder);
 			break;
 
+		case FILE_TYPE_SID:
+			setSid(&decoder);
+			break;
+
 		default:
 			puts("Unsupported file.");
+			closeStream(stream);
 			goto err;
 	}
 
 	printf("Type: %s\n", fileToStr(ft));
 
-	if((*decoder.init)(file) != 0)
+	if(initMp3Library() != 0)
+	{
+		puts("Unable to initialise MP3 library.");
+		closeStream(stream);
+		goto err;
+	}
+
+	if((*decoder.init)(&decoder, stream) != 0)
 	{
 		puts("Unable to initialise decoder.");
+		closeStream(stream);
 		goto err;
 	}
 
-	if((*decoder.channels)() > 2 || (*decoder.channels)() < 1)
+	if((*decoder.channels)(decoder.ctx) > 2 ||
+			(*decoder.channels)(decoder.ctx) < 1)
 	{
 		puts("Unable to obtain number of channels.");
 		goto err;
@@ -77,7 +306,7 @@ int main(int argc, char *argv[])
 
 	while(true)
 	{
-		size_t read = (*decoder.decode)(&buffer[0]);
+		size_t read = (*decoder.decode)(decoder.ctx, &buffer[0]);
 
 		if(read <= 0)
 			break;
@@ -85,7 +314,8 @@ int main(int argc, char *argv[])
 		fwrite(buffer, read * sizeof(int16_t), 1, out);
 	}
 
-	(*decoder.exit)();
+	(*decoder.exit)(decoder.ctx);
+	exitMp3Library();
 	free(buffer);
 	fclose(out);
 
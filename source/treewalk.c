@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "library.h"
+#include "treewalk.h"
+
+/**
+ * Enter a folder, placing its cursor before its first entry when walking
+ * forwards, or after its last entry when walking backwards. Folders are
+ * listed from the library index where they have been indexed, which does
+ * not read the SD card.
+ *
+ * \param	name	Name of the folder within the deepest folder entered, or
+ *					NULL for the root folder, whose path is already set.
+ * \param	step	Direction of the walk.
+ * \return			0 on success, or -1 if the folder could not be read or is
+ *					too deep.
+ */
+static int pushLevel(struct treeWalk_t* walk, const char* name, int step)
+{
+	struct treeLevel_t*	level;
+	size_t				len = strlen(walk->path);
+
+	if(walk->depth == TREE_MAX_DEPTH + 1)
+		return -1;
+
+	if(name != NULL)
+	{
+		const char* sep = len > 0 && walk->path[len - 1] == '/' ? "" : "/";
+
+		if(snprintf(walk->path + len, sizeof(walk->path) - len, "%s%s",
+					sep, name) >= (int)(sizeof(walk->path) - len))
+		{
+			walk->path[len] = '\0';
+			return -1;
+		}
+	}
+
+	level = &walk->levels[walk->depth];
+	if(getLibraryDirList(walk->path, &level->list) < 0 &&
+			readDirList(&level->list, walk->path) < 0)
+	{
+		walk->path[len] = '\0';
+		return -1;
+	}
+
+	level->pos = step > 0 ? -1 : level->list.dirNum + level->list.fileNum;
+	level->pathLen = strlen(walk->path);
+	walk->depth++;
+	return 0;
+}
+
+/**
+ * Leave the deepest folder entered. Its listing is kept, so that the next
+ * folder entered at the same depth reuses its memory.
+ */
+static void popLevel(struct treeWalk_t* walk)
+{
+	walk->depth--;
+	walk->path[walk->levels[walk->depth - 1].pathLen] = '\0';
+}
+
+/**
+ * Find an entry of a listing by name.
+ *
+ * \param	isDir	Entry is a folder.
+ * \return			Index of entry, or -1 if not found.
+ */
+static int findEntry(const struct dirList_t* list, const char* name,
+		int isDir)
+{
+	int first = isDir ? 0 : list->dirNum;
+	int last = isDir ? list->dirNum : list->dirNum + list->fileNum;
+
+	for(int i = first; i < last; i++)
+	{
+		if(strcmp(getDirEntryName(list, i), name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Start a walk over a folder tree.
+ *
+ * \param	walk	Walk, which must be zeroed before its first use.
+ * \param	root	Root folder.
+ * \param	file	File below the root folder to start from, or NULL to
+ *					start before the first file.
+ * \return			0 on success, or -1 if the root folder, or the folder of
+ *					file, could not be read.
+ */
+int startTreeWalk(struct treeWalk_t* walk, const char* root,
+		const char* file)
+{
+	size_t		rootLen = strlen(root);
+	const char*	p;
+
+	walk->depth = 0;
+	if(rootLen == 0 || rootLen >= sizeof(walk->path))
+		return -1;
+
+	strcpy(walk->path, root);
+	if(pushLevel(walk, NULL, 1) != 0)
+		return -1;
+
+	if(file == NULL)
+		return 0;
+
+	if(strncmp(file, root, rootLen) != 0 ||
+			(root[rootLen - 1] != '/' && file[rootLen] != '/'))
+		return -1;
+
+	/* Place the cursor of each folder on the way to the file. */
+	for(p = file + rootLen; *p != '\0'; )
+	{
+		struct treeLevel_t*	level = &walk->levels[walk->depth - 1];
+		char				name[NAME_MAX + 1];
+		size_t				n;
+		int					isDir;
+
+		while(*p == '/')
+			p++;
+
+		if((n = strcspn(p, "/")) == 0 || n >= sizeof(name))
+			return -1;
+
+		memcpy(name, p, n);
+		name[n] = '\0';
+		p += n;
+		isDir = *p != '\0';
+
+		if((level->pos = findEntry(&level->list, name, isDir)) < 0 ||
+				(isDir && pushLevel(walk, name, 1) != 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Move to the next or previous file of the walk.
+ *
+ * \param	step	1 for the next file, or -1 for the previous file.
+ * \param	file	Output path of the file.
+ * \param	len		Size of file.
+ * \return			0 on success, or -1 once past the first or last file, after
+ *					which the walk may be moved back in the other direction.
+ */
+int stepTreeWalk(struct treeWalk_t* walk, int step, char* file, size_t len)
+{
+	while(walk->depth > 0)
+	{
+		struct treeLevel_t*	level = &walk->levels[walk->depth - 1];
+		int					n = level->list.dirNum + level->list.fileNum;
+		const char*			name;
+		const char*			sep;
+
+		level->pos += step;
+		if(level->pos < 0 || level->pos >= n)
+		{
+			level->pos = level->pos < 0 ? -1 : n;
+			if(walk->depth == 1)
+				return -1;
+
+			popLevel(walk);
+			continue;
+		}
+
+		name = getDirEntryName(&level->list, level->pos);
+
+		/* Folders that could not be read are passed over. */
+		if(level->pos < level->list.dirNum)
+		{
+			pushLevel(walk, name, step);
+			continue;
+		}
+
+		sep = level->pathLen > 0 && walk->path[level->pathLen - 1] == '/' ?
+			"" : "/";
+		if(snprintf(file, len, "%s%s%s", walk->path, sep, name) < (int)len)
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Free memory used by a walk.
+ */
+void freeTreeWalk(struct treeWalk_t* walk)
+{
+	for(int i = 0; i < TREE_MAX_DEPTH + 1; i++)
+		freeDirList(&walk->levels[i].list);
+
+	walk->depth = 0;
+}
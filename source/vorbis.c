@@ -4,18 +4,31 @@
 
 #include "vorbis.h"
 #include "playback.h"
+#include "seekindex.h"
+#include "stream.h"
+#include "tags.h"
+
+struct vorbis_t
+{
+	OggVorbis_File	vorbisFile;
+	vorbis_info		*vi;
+	struct stream_t	*stream;
+	int				current_section;
+
+	/* Seek index, once loaded. */
+	struct seekIndex_t	*index;
+};
 
-static OggVorbis_File	vorbisFile;
-static vorbis_info		*vi;
-static FILE				*f;
 static const size_t		buffSize = 8 * 4096;
 
-static int initVorbis(const char* file);
-static uint32_t rateVorbis(void);
-static uint8_t channelVorbis(void);
-static uint64_t decodeVorbis(void* buffer);
-static void exitVorbis(void);
-static uint64_t fillVorbisBuffer(char* bufferOut);
+static int initVorbis(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateVorbis(void* ctx);
+static uint8_t channelVorbis(void* ctx);
+static uint64_t decodeVorbis(void* ctx, void* buffer);
+static void exitVorbis(void* ctx);
+static uint64_t fillVorbisBuffer(struct vorbis_t* vorbis, char* bufferOut);
+static size_t getFileSamplesVorbis(void* ctx);
+static int seekVorbis(void* ctx, uint64_t frame);
 
 /**
  * Set decoder parameters for Vorbis.
@@ -30,31 +43,137 @@ void setVorbis(struct decoder_fn* decoder)
 	decoder->buffSize = buffSize;
 	decoder->decode = &decodeVorbis;
 	decoder->exit = &exitVorbis;
+	decoder->getFileSamples = &getFileSamplesVorbis;
+	decoder->seek = &seekVorbis;
+	decoder->ctx = NULL;
+}
+
+static size_t getFileSamplesVorbis(void* ctx)
+{
+	struct vorbis_t* vorbis = ctx;
+	ogg_int64_t len = ov_pcm_total(&vorbis->vorbisFile, -1);
+
+	if(len < 0)
+		return 0;
+
+	return len * (size_t)vorbis->vi->channels;
+}
+
+static size_t onReadVorbis(void* ptr, size_t size, size_t nmemb,
+		void* stream)
+{
+	return size == 0 ? 0 : readStream(stream, ptr, size * nmemb) / size;
+}
+
+static int onSeekVorbis(void* stream, ogg_int64_t offset, int whence)
+{
+	return seekStream(stream, offset, whence);
+}
+
+static long onTellVorbis(void* stream)
+{
+	return tellStream(stream);
 }
 
 /**
  * Initialise Vorbis decoder.
  *
- * \param	file	Location of vorbis file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened vorbis file, which is closed by exitVorbis().
  * \return			0 on success, else failure.
  */
-int initVorbis(const char* file)
+int initVorbis(struct decoder_fn* decoder, struct stream_t* stream)
 {
+	/* The stream is closed by exitVorbis(), not by ov_clear(). */
+	const ov_callbacks cb = {
+		onReadVorbis, onSeekVorbis, NULL, onTellVorbis
+	};
+	struct vorbis_t* vorbis;
 	int err = -1;
 
-	if((f = fopen(file, "rb")) == NULL)
+	if((vorbis = calloc(1, sizeof(struct vorbis_t))) == NULL)
 		goto out;
 
-	if(ov_open(f, &vorbisFile, NULL, 0) < 0)
-		goto out;
+	if(ov_open_callbacks(stream, &vorbis->vorbisFile, NULL, 0, cb) < 0)
+		goto err;
 
-	if((vi = ov_info(&vorbisFile, -1)) == NULL)
-		goto out;
+	if((vorbis->vi = ov_info(&vorbis->vorbisFile, -1)) == NULL)
+	{
+		ov_clear(&vorbis->vorbisFile);
+		goto err;
+	}
 
+	vorbis->stream = stream;
+	decoder->ctx = vorbis;
+	queueSeekIndex(stream);
 	err = 0;
 
 out:
 	return err;
+
+err:
+	free(vorbis);
+	goto out;
+}
+
+/**
+ * Decode and drop samples up to a sample, after seeking to a page before it.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, or -1 if already past the sample or on
+ *					failure.
+ */
+static int skipVorbis(struct vorbis_t* vorbis, uint64_t frame)
+{
+	const size_t	scratchSize = 4096;
+	ogg_int64_t		pos = ov_pcm_tell(&vorbis->vorbisFile);
+	size_t			frameSize = vorbis->vi->channels * sizeof(int16_t);
+	char*			scratch;
+	int				err = 0;
+
+	if(pos < 0 || (uint64_t)pos > frame ||
+			(scratch = malloc(scratchSize)) == NULL)
+		return -1;
+
+	while(err == 0 && (uint64_t)pos < frame)
+	{
+		uint64_t	left = (frame - pos) * frameSize;
+		long		n = ov_read(&vorbis->vorbisFile, scratch,
+				left < scratchSize ? (int)left : (int)scratchSize,
+				&vorbis->current_section);
+
+		if(n <= 0)
+			err = -1;
+		else
+			pos += n / frameSize;
+	}
+
+	free(scratch);
+	return err;
+}
+
+/**
+ * Seek to a sample of Vorbis file. With a seek index, decoding starts from
+ * the page indexed before the sample, rather than from a search over the
+ * file.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, else failure.
+ */
+static int seekVorbis(void* ctx, uint64_t frame)
+{
+	struct vorbis_t*			vorbis = ctx;
+	const struct seekPoint_t*	point;
+
+	if(vorbis->index == NULL)
+		vorbis->index = loadSeekIndex(vorbis->stream);
+
+	if((point = findSeekPoint(vorbis->index, frame)) != NULL &&
+			ov_raw_seek(&vorbis->vorbisFile, point->offset) == 0 &&
+			skipVorbis(vorbis, frame) == 0)
+		return 0;
+
+	return ov_pcm_seek(&vorbis->vorbisFile, frame) == 0 ? 0 : -1;
 }
 
 /**
@@ -62,9 +181,9 @@ out:
  *
  * \return	Sampling rate.
  */
-uint32_t rateVorbis(void)
+uint32_t rateVorbis(void* ctx)
 {
-	return vi->rate;
+	return ((struct vorbis_t*)ctx)->vi->rate;
 }
 
 /**
@@ -72,9 +191,9 @@ uint32_t rateVorbis(void)
  *
  * \return	Number of channels for opened file.
  */
-uint8_t channelVorbis(void)
+uint8_t channelVorbis(void* ctx)
 {
-	return vi->channels;
+	return ((struct vorbis_t*)ctx)->vi->channels;
 }
 
 /**
@@ -84,39 +203,42 @@ uint8_t channelVorbis(void)
  * \return			Samples read for each channel. 0 for end of file, negative
  *					for error.
  */
-uint64_t decodeVorbis(void* buffer)
+uint64_t decodeVorbis(void* ctx, void* buffer)
 {
-	return fillVorbisBuffer(buffer);
+	return fillVorbisBuffer(ctx, buffer);
 }
 
 /**
  * Free Vorbis decoder.
  */
-void exitVorbis(void)
+void exitVorbis(void* ctx)
 {
-	ov_clear(&vorbisFile);
-	fclose(f);
+	struct vorbis_t* vorbis = ctx;
+
+	ov_clear(&vorbis->vorbisFile);
+	closeStream(vorbis->stream);
+	free(vorbis->index);
+	free(vorbis);
 }
 
 /**
  * Decode Vorbis file to fill buffer.
  *
- * \param opusFile		File to decode.
+ * \param vorbis		Decoder instance.
  * \param bufferOut		Pointer to buffer.
  * \return				Samples read per channel.
  */
-uint64_t fillVorbisBuffer(char* bufferOut)
+uint64_t fillVorbisBuffer(struct vorbis_t* vorbis, char* bufferOut)
 {
 	uint64_t samplesRead = 0;
 	int samplesToRead = buffSize;
 
 	while(samplesToRead > 0)
 	{
-		static int current_section;
 		int samplesJustRead =
-			ov_read(&vorbisFile, bufferOut,
+			ov_read(&vorbis->vorbisFile, bufferOut,
 					samplesToRead > 4096 ? 4096	: samplesToRead,
-					&current_section);
+					&vorbis->current_section);
 
 		if(samplesJustRead < 0)
 			return samplesJustRead;
@@ -135,23 +257,39 @@ uint64_t fillVorbisBuffer(char* bufferOut)
 }
 
 /**
- * Checks if the input file is Vorbis.
+ * Read the tags of a Vorbis file from its comment header.
  *
- * \param in	Input file.
- * \return		0 if Vorbis file, else not or failure.
+ * \param	stream	Opened Vorbis file, positioned at its start.
+ * \param	tags	Tags to store comments in.
+ * \return			0 on success, or -1 if the headers could not be read.
  */
-int isVorbis(const char *in)
+int readVorbisTags(struct stream_t* stream, struct tags_t* tags)
 {
-	FILE *ft = fopen(in, "r");
-	OggVorbis_File testvf;
-	int err;
+	const ov_callbacks cb = {
+		onReadVorbis, onSeekVorbis, NULL, onTellVorbis
+	};
+	OggVorbis_File*	vorbisFile;
+	vorbis_comment*	vc;
 
-	if(ft == NULL)
+	if((vorbisFile = calloc(1, sizeof(OggVorbis_File))) == NULL)
 		return -1;
 
-	err = ov_test(ft, &testvf, NULL, 0);
+	/* Only the headers are read, rather than also seeking to the end of the
+	 * file to find its duration. */
+	if(ov_test_callbacks(stream, vorbisFile, NULL, 0, cb) < 0)
+	{
+		free(vorbisFile);
+		return -1;
+	}
 
-	ov_clear(&testvf);
-	fclose(ft);
-	return err;
+	if((vc = ov_comment(vorbisFile, -1)) != NULL)
+	{
+		for(int i = 0; i < vc->comments; i++)
+			addVorbisComment(tags, vc->user_comments[i],
+					vc->comment_lengths[i]);
+	}
+
+	ov_clear(vorbisFile);
+	free(vorbisFile);
+	return vc == NULL ? -1 : 0;
 }
@@ -7,16 +7,23 @@
 
 #include "wav.h"
 #include "playback.h"
+#include "stream.h"
+
+struct wav_t
+{
+	drwav				wav;
+	struct stream_t*	stream;
+};
 
-static drwav wav;
 static const size_t buffSize = 16 * 1024;
 
-static int initWav(const char* file);
-static uint32_t rateWav(void);
-static uint8_t channelWav(void);
-static uint64_t readWav(void* buffer);
-static void exitWav(void);
-static size_t getFileSamplesWav(void);
+static int initWav(struct decoder_fn* decoder, struct stream_t* stream);
+static uint32_t rateWav(void* ctx);
+static uint8_t channelWav(void* ctx);
+static uint64_t readWav(void* ctx, void* buffer);
+static void exitWav(void* ctx);
+static size_t getFileSamplesWav(void* ctx);
+static int seekWav(void* ctx, uint64_t frame);
 
 /**
  * Set decoder parameters for WAV.
@@ -32,22 +39,80 @@ void setWav(struct decoder_fn* decoder)
 	decoder->decode = &readWav;
 	decoder->exit = &exitWav;
 	decoder->getFileSamples = &getFileSamplesWav;
+	decoder->seek = &seekWav;
+	decoder->ctx = NULL;
+}
+
+static size_t onReadWav(void* pUserData, void* pBufferOut, size_t bytesToRead)
+{
+	return readStream(pUserData, pBufferOut, bytesToRead);
+}
+
+static drwav_bool32 onSeekWav(void* pUserData, int offset,
+		drwav_seek_origin origin)
+{
+#if DRWAV_VERSION_MINOR >= 14
+	int whence = origin == DRWAV_SEEK_SET ? SEEK_SET :
+		origin == DRWAV_SEEK_END ? SEEK_END : SEEK_CUR;
+#else
+	int whence = origin == drwav_seek_origin_start ? SEEK_SET : SEEK_CUR;
+#endif
+
+	return seekStream(pUserData, offset, whence) == 0;
+}
+
+#if DRWAV_VERSION_MINOR >= 14
+static drwav_bool32 onTellWav(void* pUserData, drwav_int64* pCursor)
+{
+	*pCursor = tellStream(pUserData);
+	return DRWAV_TRUE;
 }
+#endif
 
 /**
  * Initialise WAV playback.
  *
- * \param	file	Location of WAV file to play.
+ * \param	decoder	Structure to store instance in.
+ * \param	stream	Opened WAV file, which is closed by exitWav().
  * \return			0 on success, else failure.
  */
-int initWav(const char* file)
+int initWav(struct decoder_fn* decoder, struct stream_t* stream)
 {
-	return !drwav_init_file(&wav, file, NULL);
+	struct wav_t* wav = malloc(sizeof(struct wav_t));
+
+	if(wav == NULL)
+		return -1;
+
+#if DRWAV_VERSION_MINOR >= 14
+	if(!drwav_init(&wav->wav, onReadWav, onSeekWav, onTellWav, stream, NULL))
+#else
+	if(!drwav_init(&wav->wav, onReadWav, onSeekWav, stream, NULL))
+#endif
+	{
+		free(wav);
+		return -1;
+	}
+
+	wav->stream = stream;
+	decoder->ctx = wav;
+	return 0;
 }
 
-static size_t getFileSamplesWav(void)
+static size_t getFileSamplesWav(void* ctx)
 {
-	return wav.totalPCMFrameCount * (size_t)wav.channels;
+	drwav* wav = &((struct wav_t*)ctx)->wav;
+	return wav->totalPCMFrameCount * (size_t)wav->channels;
+}
+
+/**
+ * Seek to a sample of Wav file.
+ *
+ * \param	frame	Sample of each channel.
+ * \return			0 on success, else failure.
+ */
+static int seekWav(void* ctx, uint64_t frame)
+{
+	return drwav_seek_to_pcm_frame(&((struct wav_t*)ctx)->wav, frame) ? 0 : -1;
 }
 
 /**
@@ -55,9 +120,9 @@ static size_t getFileSamplesWav(void)
  *
  * \return	Sampling rate.
  */
-uint32_t rateWav(void)
+uint32_t rateWav(void* ctx)
 {
-	return wav.sampleRate;
+	return ((struct wav_t*)ctx)->wav.sampleRate;
 }
 
 /**
@@ -65,9 +130,9 @@ uint32_t rateWav(void)
  *
  * \return	Number of channels for opened file.
  */
-uint8_t channelWav(void)
+uint8_t channelWav(void* ctx)
 {
-	return wav.channels;
+	return ((struct wav_t*)ctx)->wav.channels;
 }
 
 /**
@@ -76,21 +141,26 @@ uint8_t channelWav(void)
  * \param buffer	Output.
  * \return			Samples read for each channel.
  */
-uint64_t readWav(void* buffer)
+uint64_t readWav(void* ctx, void* buffer)
 {
+	drwav* wav = &((struct wav_t*)ctx)->wav;
 	size_t buffSizeFrames;
 	uint64_t samplesRead;
 
-	buffSizeFrames = buffSize / (size_t)wav.channels;
-	samplesRead = drwav_read_pcm_frames_s16(&wav, buffSizeFrames, buffer);
-	samplesRead *= (uint64_t)wav.channels;
+	buffSizeFrames = buffSize / (size_t)wav->channels;
+	samplesRead = drwav_read_pcm_frames_s16(wav, buffSizeFrames, buffer);
+	samplesRead *= (uint64_t)wav->channels;
 	return samplesRead;
 }
 
 /**
  * Free Wav file.
  */
-void exitWav(void)
+void exitWav(void* ctx)
 {
-	drwav_uninit(&wav);
+	struct wav_t* wav = ctx;
+
+	drwav_uninit(&wav->wav);
+	closeStream(wav->stream);
+	free(wav);
 }